@@ -0,0 +1,198 @@
+#include "bench.h"
+#include "crypto/cipher_suite.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+#include <map>
+#include <thread>
+
+namespace bench {
+
+namespace {
+
+volatile const void* g_sink = nullptr;
+
+double time_batch(const std::function<void()>& op, uint64_t iterations) {
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < iterations; i++) op();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+// "1.23 GB/s", "45.6 Mitems/s"
+std::string human(double value, const char* unit) {
+    const char* prefixes[] = {"", "K", "M", "G", "T"};
+    size_t p = 0;
+    while (value >= 1000.0 && p + 1 < sizeof(prefixes) / sizeof(prefixes[0])) {
+        value /= 1000.0;
+        p++;
+    }
+    char buf[48];
+    std::snprintf(buf, sizeof(buf), "%.3g %s%s", value, prefixes[p], unit);
+    return buf;
+}
+
+// Higher is better: bytes/s, else items/s, else calls/s
+double throughput(const json& b) {
+    double bytes = b.value("bytes_per_second", 0.0);
+    if (bytes > 0) return bytes;
+    double items = b.value("items_per_second", 0.0);
+    if (items > 0) return items;
+    double ns = b.value("ns_per_op", 0.0);
+    return ns > 0 ? 1e9 / ns : 0.0;
+}
+
+// "789 ns", "1.5 ms"
+std::string human_time(double ns) {
+    const char* units[] = {"ns", "us", "ms", "s"};
+    size_t u = 0;
+    while (ns >= 1000.0 && u + 1 < sizeof(units) / sizeof(units[0])) {
+        ns /= 1000.0;
+        u++;
+    }
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.3g %s", ns, units[u]);
+    return buf;
+}
+
+} // namespace
+
+std::string case_name(const std::string& group, const Params& params) {
+    std::string name = group;
+    for (const auto& p : params) name += "/" + p.first + ":" + p.second;
+    return name;
+}
+
+void keep(const void* p) {
+    g_sink = p;
+}
+
+Runner::Runner(const RunnerOptions& options) : options_(options) {
+    if (options_.repetitions == 0) options_.repetitions = 1;
+}
+
+bool Runner::selected(const std::string& name) const {
+    return options_.filter.empty() || name.find(options_.filter) != std::string::npos;
+}
+
+void Runner::run(const std::string& group, const Params& params, uint64_t bytes, uint64_t items,
+                 const std::function<void()>& op) {
+    Result result;
+    result.name = case_name(group, params);
+    if (!selected(result.name)) return;
+    result.group = group;
+    result.params = params;
+
+    // Grow the batch until it runs for min_time, aiming a little past it
+    uint64_t iterations = 1;
+    for (;;) {
+        double elapsed = time_batch(op, iterations);
+        if (elapsed >= options_.min_time) break;
+        double scale = elapsed > 0 ? options_.min_time * 1.2 / elapsed : 10.0;
+        iterations = static_cast<uint64_t>(iterations * std::min(std::max(scale, 2.0), 10.0));
+    }
+
+    std::vector<double> samples;
+    for (size_t r = 0; r < options_.repetitions; r++) {
+        samples.push_back(time_batch(op, iterations) * 1e9 / iterations);
+    }
+    std::sort(samples.begin(), samples.end());
+    result.iterations = iterations;
+    result.repetitions = samples.size();
+    result.ns_per_op = samples[samples.size() / 2];
+    result.min_ns_per_op = samples.front();
+    result.max_ns_per_op = samples.back();
+    if (bytes) result.bytes_per_second = bytes * 1e9 / result.ns_per_op;
+    if (items) result.items_per_second = items * 1e9 / result.ns_per_op;
+
+    std::printf("%-64s %12s", result.name.c_str(), human_time(result.ns_per_op).c_str());
+    if (bytes) std::printf(" %12s", human(result.bytes_per_second, "B/s").c_str());
+    if (items) std::printf(" %12s", human(result.items_per_second, "items/s").c_str());
+    std::printf("\n");
+    std::fflush(stdout);
+    results_.push_back(std::move(result));
+}
+
+json Runner::report() const {
+    std::time_t now = std::time(nullptr);
+    char ts[32];
+    std::strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+    std::string suite_reason;
+    crypto::CipherSuite suite = crypto::detect_suite(suite_reason);
+
+    json context;
+    context["date"] = ts;
+    context["hardware_threads"] = std::thread::hardware_concurrency();
+#if defined(__VERSION__)
+    context["compiler"] = __VERSION__;
+#endif
+#ifdef NDEBUG
+    context["assertions"] = false;
+#else
+    context["assertions"] = true;
+#endif
+    context["cipher_suite"] = crypto::suite_name(suite);
+    context["cipher_suite_reason"] = suite_reason;
+    context["min_time"] = options_.min_time;
+    context["repetitions"] = options_.repetitions;
+
+    json benchmarks = json::array();
+    for (const auto& r : results_) {
+        json b;
+        b["name"] = r.name;
+        b["group"] = r.group;
+        json params = json::object();
+        for (const auto& p : r.params) params[p.first] = p.second;
+        b["params"] = params;
+        b["iterations"] = r.iterations;
+        b["repetitions"] = r.repetitions;
+        b["ns_per_op"] = r.ns_per_op;
+        b["min_ns_per_op"] = r.min_ns_per_op;
+        b["max_ns_per_op"] = r.max_ns_per_op;
+        if (r.bytes_per_second > 0) b["bytes_per_second"] = r.bytes_per_second;
+        if (r.items_per_second > 0) b["items_per_second"] = r.items_per_second;
+        benchmarks.push_back(b);
+    }
+
+    json j;
+    j["context"] = context;
+    j["benchmarks"] = benchmarks;
+    return j;
+}
+
+size_t compare(const json& baseline, const json& current, double threshold, std::ostream& out) {
+    std::map<std::string, json> before;
+    for (const auto& b : baseline.at("benchmarks")) before[b.at("name").get<std::string>()] = b;
+
+    size_t regressions = 0;
+    char line[256];
+    std::snprintf(line, sizeof(line), "%-64s %12s %12s %8s", "case", "baseline", "current", "change");
+    out << line << std::endl;
+    for (const auto& b : current.at("benchmarks")) {
+        std::string name = b.at("name");
+        auto it = before.find(name);
+        if (it == before.end()) {
+            out << name << "  (new)" << std::endl;
+            continue;
+        }
+        double old_rate = throughput(it->second);
+        double new_rate = throughput(b);
+        before.erase(it);
+        if (old_rate <= 0) continue;
+        double change = new_rate / old_rate - 1.0;
+        bool regressed = change < -threshold;
+        if (regressed) regressions++;
+        const char* unit = b.contains("bytes_per_second") ? "B/s" : b.contains("items_per_second") ? "items/s" : "op/s";
+        std::snprintf(line, sizeof(line), "%-64s %12s %12s %+7.1f%%%s", name.c_str(), human(old_rate, unit).c_str(),
+                      human(new_rate, unit).c_str(), change * 100.0, regressed ? "  REGRESSION" : "");
+        out << line << std::endl;
+    }
+    for (const auto& missing : before) {
+        out << missing.first << "  (missing from current run)" << std::endl;
+    }
+    return regressions;
+}
+
+} // namespace bench
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <utility>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+namespace bench {
+
+// Parameters of one case, in name order, e.g. {{"suite", "aes-256-gcm"}, {"size", "65536"}}
+using Params = std::vector<std::pair<std::string, std::string>>;
+
+// "<group>/<key>:<value>/...", the key reports are matched on
+std::string case_name(const std::string& group, const Params& params);
+
+struct Result {
+    std::string name;
+    std::string group;
+    Params params;
+    uint64_t iterations = 0;        // calls per repetition
+    size_t repetitions = 0;
+    double ns_per_op = 0.0;         // median over repetitions
+    double min_ns_per_op = 0.0;
+    double max_ns_per_op = 0.0;
+    double bytes_per_second = 0.0;  // 0 for cases that process no bytes
+    double items_per_second = 0.0;  // 0 for cases that count no items
+};
+
+struct RunnerOptions {
+    std::string filter;       // substring of case names; empty runs every case
+    double min_time = 0.25;   // seconds each repetition runs for at least
+    size_t repetitions = 5;
+};
+
+class Runner {
+public:
+    explicit Runner(const RunnerOptions& options);
+
+    // Callers check this before building expensive fixtures
+    bool selected(const std::string& name) const;
+
+    // Calls `op` until a batch takes min_time, then times `repetitions`
+    // batches of that size. `bytes` and `items` are what one call processes.
+    // Skips cases the filter excludes.
+    void run(const std::string& group, const Params& params, uint64_t bytes, uint64_t items,
+             const std::function<void()>& op);
+
+    const std::vector<Result>& results() const { return results_; }
+
+    // {"context": {...}, "benchmarks": [...]}
+    json report() const;
+
+private:
+    RunnerOptions options_;
+    std::vector<Result> results_;
+};
+
+// Keeps the compiler from discarding a computation whose result is unused
+void keep(const void* p);
+
+// Matches the cases of two reports by name and prints each one's throughput
+// change. Returns the number of cases slower than `baseline` by more than
+// `threshold` (a fraction, e.g. 0.05).
+size_t compare(const json& baseline, const json& current, double threshold, std::ostream& out);
+
+} // namespace bench
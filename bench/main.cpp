@@ -0,0 +1,424 @@
+#include "bench.h"
+#include "chunker/chunker.h"
+#include "crypto/encryptor.h"
+#include "ledger/ledger.h"
+#include "ledger/manifest.h"
+#include "merkle/merkle_tree.h"
+#include "pipeline/backup_pipeline.h"
+#include "pipeline/restore_pipeline.h"
+#include "storage/memory_backend.h"
+#include "utils/file_utils.h"
+#include "utils/hash_utils.h"
+#include "utils/json_utils.h"
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+struct Settings {
+    bench::RunnerOptions runner;
+    std::string json_path;    // report destination; empty prints none
+    std::string dir;          // scratch files; default under the system temp directory
+    size_t data_mb = 64;      // size of the file the chunker benchmarks read
+};
+
+const crypto::CipherSuite kSuites[] = {crypto::CipherSuite::Aes256Gcm, crypto::CipherSuite::ChaCha20Poly1305};
+
+std::mt19937_64& rng() {
+    static std::mt19937_64 gen(0x5eb5eb5e);
+    return gen;
+}
+
+void fill_random(uint8_t* data, size_t len) {
+    auto& gen = rng();
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t v = gen();
+        std::memcpy(data + i, &v, 8);
+    }
+    for (; i < len; i++) data[i] = static_cast<uint8_t>(gen());
+}
+
+std::string random_hex(size_t bytes) {
+    std::vector<uint8_t> raw(bytes);
+    fill_random(raw.data(), raw.size());
+    return utils::HashUtils::to_hex(raw.data(), raw.size());
+}
+
+// A flat single-file manifest shaped like a backup's: standalone chunk
+// objects with fingerprints, no packs
+ledger::Manifest make_manifest(size_t chunk_count) {
+    ledger::Manifest m;
+    m.file_name = "bench.bin";
+    m.chunk_size = 1024 * 1024;
+    m.original_size = chunk_count * m.chunk_size;
+    m.mtime_ns = 1700000000000000000LL;
+    m.timestamp = "2024-01-01T00:00:00Z";
+    m.merkle_root = random_hex(32);
+    for (size_t i = 0; i < chunk_count; i++) {
+        ledger::ChunkInfo c;
+        c.id = i;
+        c.offset = i * m.chunk_size;
+        c.size = m.chunk_size;
+        c.hash = random_hex(32);
+        c.iv = random_hex(12);
+        c.fingerprint = random_hex(16);
+        c.uri = "http://localhost:3000/uploads/bench.bin.chunk" + std::to_string(i) + "." + c.iv + ".enc";
+        m.chunks.push_back(c);
+    }
+    return m;
+}
+
+// Writes a legacy JSON ledger of `length` chained entries next to `log_path`;
+// opening the log imports it with a single sync instead of one per entry
+void seed_ledger(const std::string& log_path, size_t length, const json& payload) {
+    std::string payload_str = payload.dump();
+    json entries = json::array();
+    utils::Digest prev{};
+    for (size_t i = 0; i < length; i++) {
+        std::string ts = "2024-01-01T00:00:00Z";
+        std::string prev_hex = utils::HashUtils::to_hex(prev);
+        utils::Sha256 sha;
+        sha.update(reinterpret_cast<const uint8_t*>(prev_hex.data()), prev_hex.size());
+        sha.update(reinterpret_cast<const uint8_t*>(payload_str.data()), payload_str.size());
+        sha.update(reinterpret_cast<const uint8_t*>(ts.data()), ts.size());
+        utils::Digest hash = sha.final_digest();
+        entries.push_back({{"prev_hash", prev_hex}, {"payload", payload}, {"ts", ts},
+                           {"entry_hash", utils::HashUtils::to_hex(hash)}});
+        prev = hash;
+    }
+    utils::JsonUtils::write_to_file(fs::path(log_path).replace_extension(".json").string(), entries);
+}
+
+void bench_chunker(bench::Runner& runner, const Settings& settings) {
+    const std::string path = settings.dir + "/chunker.bin";
+    bool written = false;
+    const size_t file_size = settings.data_mb * 1024 * 1024;
+    for (auto mode : {chunker::ChunkingMode::Fixed, chunker::ChunkingMode::ContentDefined}) {
+        for (size_t kb : {256, 1024, 4096}) {
+            for (bool mmap : {true, false}) {
+                bench::Params params{{"mode", chunker::ChunkingParams::mode_name(mode)},
+                                     {"chunk_kb", std::to_string(kb)},
+                                     {"mmap", mmap ? "on" : "off"}};
+                if (!runner.selected(bench::case_name("chunker/next", params))) continue;
+                if (!written) {
+                    std::vector<uint8_t> data(file_size);
+                    fill_random(data.data(), data.size());
+                    utils::FileUtils::write_file(path, data);
+                    written = true;
+                }
+                chunker::ChunkingParams chunking;
+                chunking.mode = mode;
+                chunking.chunk_size = kb * 1024;
+                chunking.avg_size = kb * 1024;
+                chunking.min_size = chunking.avg_size / 4;
+                chunking.max_size = chunking.avg_size * 4;
+                chunking.memory_map = mmap;
+                runner.run("chunker/next", params, file_size, 0, [&] {
+                    chunker::Chunker c(path, chunking);
+                    while (c.hasNext()) {
+                        chunker::Chunk chunk = c.next();
+                        bench::keep(chunk.bytes());
+                    }
+                });
+            }
+        }
+    }
+}
+
+void bench_crypto(bench::Runner& runner) {
+    std::array<uint8_t, 32> key{};
+    fill_random(key.data(), key.size());
+    for (auto suite : kSuites) {
+        crypto::Encryptor encryptor(key, suite);
+        for (size_t size : {4096, 65536, 1 << 20, 16 << 20}) {
+            bench::Params params{{"suite", crypto::suite_name(suite)}, {"size", std::to_string(size)}};
+            bool any = false;
+            for (const char* group : {"crypto/encrypt", "crypto/decrypt", "crypto/encrypt_into", "crypto/decrypt_from"}) {
+                any = any || runner.selected(bench::case_name(group, params));
+            }
+            if (!any) continue;
+            std::vector<uint8_t> plaintext(size);
+            fill_random(plaintext.data(), plaintext.size());
+
+            // The CipherResult API
+            crypto::CipherResult sealed = encryptor.encrypt(plaintext.data(), plaintext.size());
+            runner.run("crypto/encrypt", params, size, 0, [&] {
+                crypto::CipherResult r = encryptor.encrypt(plaintext.data(), plaintext.size());
+                bench::keep(r.ciphertext.data());
+            });
+            runner.run("crypto/decrypt", params, size, 0, [&] {
+                std::vector<uint8_t> out = encryptor.decrypt(sealed);
+                bench::keep(out.data());
+            });
+
+            // The wire-format path the pipelines use, into reused buffers
+            std::vector<uint8_t> blob;
+            std::vector<uint8_t> opened;
+            encryptor.encrypt_into(plaintext.data(), plaintext.size(), blob);
+            runner.run("crypto/encrypt_into", params, size, 0, [&] {
+                encryptor.encrypt_into(plaintext.data(), plaintext.size(), blob);
+                bench::keep(blob.data());
+            });
+            encryptor.encrypt_into(plaintext.data(), plaintext.size(), blob);
+            runner.run("crypto/decrypt_from", params, size, 0, [&] {
+                encryptor.decrypt_from(blob.data(), blob.size(), opened);
+                bench::keep(opened.data());
+            });
+        }
+    }
+}
+
+void bench_merkle(bench::Runner& runner) {
+    for (size_t leaves : {1024, 65536, 1 << 20}) {
+        std::vector<merkle::Digest> digests;
+        for (size_t threads : {1, 0}) {
+            bench::Params params{{"leaves", std::to_string(leaves)}, {"threads", threads ? std::to_string(threads) : "all"}};
+            if (!runner.selected(bench::case_name("merkle/compute_root", params))) continue;
+            if (digests.empty()) {
+                digests.resize(leaves);
+                for (auto& d : digests) fill_random(d.data(), d.size());
+            }
+            runner.run("merkle/compute_root", params, leaves * sizeof(merkle::Digest), leaves, [&] {
+                merkle::Digest root = merkle::MerkleTree::compute_root(digests, threads);
+                bench::keep(root.data());
+            });
+        }
+    }
+}
+
+void bench_ledger(bench::Runner& runner, const Settings& settings) {
+    // Ledger events are backup manifests
+    json payload = make_manifest(16).to_json();
+    for (size_t length : {1000, 10000, 100000}) {
+        bench::Params params{{"length", std::to_string(length)}};
+        bool append = runner.selected(bench::case_name("ledger/append_event", params));
+        bool verify = runner.selected(bench::case_name("ledger/verify_chain", params));
+        if (!append && !verify) continue;
+
+        std::string path = settings.dir + "/ledger-" + std::to_string(length) + ".log";
+        seed_ledger(path, length, payload);
+        ledger::Ledger log(path);
+        if (verify) {
+            // Full: from genesis, ignoring the checkpoint the previous call moved
+            runner.run("ledger/verify_chain", params, 0, length, [&] {
+                if (!log.verify_chain(true)) throw std::runtime_error("Seeded ledger failed verification");
+            });
+        }
+        if (append) {
+            // Each append syncs the log and replaces the commit pointer, so
+            // this follows the scratch directory's storage
+            runner.run("ledger/append_event", params, 0, 1, [&] { log.append_event(payload); });
+        }
+    }
+}
+
+void bench_manifest(bench::Runner& runner) {
+    for (size_t chunks : {1024, 16384, 262144}) {
+        bench::Params params{{"chunks", std::to_string(chunks)}};
+        bool to = runner.selected(bench::case_name("manifest/to_json", params));
+        bool from = runner.selected(bench::case_name("manifest/from_json", params));
+        if (!to && !from) continue;
+
+        // Both include the text form, as manifests are uploaded and fetched as text
+        ledger::Manifest manifest = make_manifest(chunks);
+        std::string text = manifest.to_json().dump();
+        runner.run("manifest/to_json", params, text.size(), chunks, [&] {
+            std::string out = manifest.to_json().dump();
+            bench::keep(out.data());
+        });
+        runner.run("manifest/from_json", params, text.size(), chunks, [&] {
+            ledger::Manifest m = ledger::Manifest::from_json(json::parse(text));
+            bench::keep(m.chunks.data());
+        });
+    }
+}
+
+// Discards std::cout while alive; the pipelines log every chunk
+class QuietStdout {
+public:
+    QuietStdout() : saved_(std::cout.rdbuf(sink_.rdbuf())) {}
+    ~QuietStdout() { std::cout.rdbuf(saved_); }
+
+private:
+    std::ostringstream sink_;
+    std::streambuf* saved_;
+};
+
+// Whole backups and restores against the in-memory backend, so what is timed
+// is the client pipeline alone: reading, chunking, sealing, hashing, writing
+void bench_pipeline(bench::Runner& runner, const Settings& settings) {
+    const std::string source = settings.dir + "/pipeline.bin";
+    const size_t file_size = settings.data_mb * 1024 * 1024;
+    bool written = false;
+    std::array<uint8_t, 32> master{};
+    fill_random(master.data(), master.size());
+    crypto::OperationKeys backup_keys = crypto::KeyManager::operation_keys(master, crypto::KeyScope::Backup);
+    crypto::OperationKeys restore_keys = crypto::KeyManager::operation_keys(master, crypto::KeyScope::Restore);
+    auto store = storage::MemoryBackend::open("bench");
+
+    for (size_t kb : {1024, 4096}) {
+        bench::Params params{{"storage", "mem"}, {"chunk_kb", std::to_string(kb)}};
+        bool backup = runner.selected(bench::case_name("pipeline/backup", params));
+        bool restore = runner.selected(bench::case_name("pipeline/restore", params));
+        if (!backup && !restore) continue;
+        if (!written) {
+            std::vector<uint8_t> data(file_size);
+            fill_random(data.data(), data.size());
+            utils::FileUtils::write_file(source, data);
+            written = true;
+        }
+
+        pipeline::PipelineOptions options;
+        options.chunking.chunk_size = kb * 1024;
+        options.chunking.memory_map = true;
+        options.pack_size = 0;
+        pipeline::BackupPipeline backup_pipeline(backup_keys, "mem://bench", options);
+        std::vector<ledger::ChunkInfo> chunks;
+        runner.run("pipeline/backup", params, file_size, 0, [&] {
+            // Every run stores fresh objects; drop the previous run's
+            store->clear();
+            QuietStdout quiet;
+            chunks = backup_pipeline.run(source, "pipeline.bin");
+        });
+        if (!restore) continue;
+
+        if (chunks.empty()) {
+            QuietStdout quiet;
+            chunks = backup_pipeline.run(source, "pipeline.bin");
+        }
+        ledger::Manifest manifest;
+        manifest.file_name = "pipeline.bin";
+        manifest.original_size = file_size;
+        manifest.chunk_size = kb * 1024;
+        manifest.chunks = chunks;
+        pipeline::RestorePipeline restore_pipeline(restore_keys.data, pipeline::RestoreOptions());
+        const std::string output = settings.dir + "/restored.bin";
+        runner.run("pipeline/restore", params, file_size, 0, [&] {
+            QuietStdout quiet;
+            restore_pipeline.run(manifest, output);
+        });
+        store->clear();
+    }
+}
+
+void usage() {
+    std::cout << "Usage:" << std::endl;
+    std::cout << "  secure_backup_bench [options]                       Run the benchmarks" << std::endl;
+    std::cout << "  secure_backup_bench compare <baseline.json> <current.json> [--threshold <percent>]" << std::endl;
+    std::cout << "                                                      Flag cases whose throughput fell (default: 5%)" << std::endl;
+    std::cout << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << "  --filter <text>      Run only cases whose name contains this, e.g. crypto/ or suite:chacha" << std::endl;
+    std::cout << "  --min-time <s>       Minimum duration of each timed batch (default: 0.25)" << std::endl;
+    std::cout << "  --repetitions <n>    Timed batches per case; the median is reported (default: 5)" << std::endl;
+    std::cout << "  --json <file>        Write the results as JSON" << std::endl;
+    std::cout << "  --data-mb <n>        Size of the file the chunker and pipeline cases read (default: 64)" << std::endl;
+    std::cout << "  --dir <path>         Scratch directory; ledger append cases measure its storage (default: system temp)" << std::endl;
+}
+
+int compare_reports(const std::vector<std::string>& args) {
+    if (args.size() < 3) {
+        usage();
+        return 2;
+    }
+    double threshold = 5.0;
+    for (size_t i = 3; i + 1 < args.size(); i += 2) {
+        if (args[i] == "--threshold") {
+            threshold = std::stod(args[i + 1]);
+        } else {
+            std::cerr << "Unknown option: " << args[i] << std::endl;
+            return 2;
+        }
+    }
+    json baseline = utils::JsonUtils::read_from_file(args[1]);
+    json current = utils::JsonUtils::read_from_file(args[2]);
+    size_t regressions = bench::compare(baseline, current, threshold / 100.0, std::cout);
+    if (regressions) {
+        std::cout << regressions << " case(s) regressed by more than " << threshold << "%" << std::endl;
+        return 1;
+    }
+    std::cout << "No regressions beyond " << threshold << "%" << std::endl;
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> args(argv + 1, argv + argc);
+    try {
+        if (!args.empty() && args[0] == "compare") {
+            return compare_reports(args);
+        }
+
+        Settings settings;
+        for (size_t i = 0; i < args.size(); i++) {
+            if (args[i] == "--help" || args[i] == "-h") {
+                usage();
+                return 0;
+            }
+            if (i + 1 >= args.size()) {
+                std::cerr << "Missing value for " << args[i] << std::endl;
+                return 2;
+            }
+            const std::string& value = args[++i];
+            if (args[i - 1] == "--filter") {
+                settings.runner.filter = value;
+            } else if (args[i - 1] == "--min-time") {
+                settings.runner.min_time = std::stod(value);
+            } else if (args[i - 1] == "--repetitions") {
+                settings.runner.repetitions = std::stoul(value);
+            } else if (args[i - 1] == "--json") {
+                settings.json_path = value;
+            } else if (args[i - 1] == "--data-mb") {
+                settings.data_mb = std::stoul(value);
+            } else if (args[i - 1] == "--dir") {
+                settings.dir = value;
+            } else {
+                std::cerr << "Unknown option: " << args[i - 1] << std::endl;
+                usage();
+                return 2;
+            }
+        }
+
+        bool own_dir = settings.dir.empty();
+        if (own_dir) {
+            settings.dir = (fs::temp_directory_path() / ("secure-backup-bench-" + std::to_string(getpid()))).string();
+        }
+        fs::create_directories(settings.dir);
+
+        bench::Runner runner(settings.runner);
+        try {
+            bench_chunker(runner, settings);
+            bench_crypto(runner);
+            bench_merkle(runner);
+            bench_ledger(runner, settings);
+            bench_manifest(runner);
+            bench_pipeline(runner, settings);
+        } catch (...) {
+            if (own_dir) fs::remove_all(settings.dir);
+            throw;
+        }
+        if (own_dir) fs::remove_all(settings.dir);
+
+        if (!settings.json_path.empty()) {
+            utils::JsonUtils::write_to_file(settings.json_path, runner.report());
+            std::cout << "Wrote " << runner.results().size() << " results to " << settings.json_path << std::endl;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 2;
+    }
+    return 0;
+}
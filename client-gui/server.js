@@ -25,6 +25,18 @@ if (!fs.existsSync(cliPath)) {
 
 // API: List Ledger
 app.get('/api/ledger', (req, res) => {
+    if (!useMock) {
+        // The C++ CLI keeps an append-only binary log; ask it for the JSON view
+        exec(`${cliPath} ledger`, { maxBuffer: 256 * 1024 * 1024 }, (error, stdout) => {
+            if (error) return res.status(500).json({ error: 'Failed to read ledger' });
+            try {
+                res.json(JSON.parse(stdout));
+            } catch (e) {
+                res.status(500).json({ error: 'Failed to read ledger' });
+            }
+        });
+        return;
+    }
     const ledgerPath = path.resolve(__dirname, '../data/ledger.json');
     if (fs.existsSync(ledgerPath)) {
         try {
@@ -0,0 +1,428 @@
+#include "key_agent.h"
+#include <openssl/crypto.h>
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#ifndef _WIN32
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
+namespace agent {
+
+namespace {
+
+const char kMagic[4] = {'S', 'B', 'K', 'A'};
+const uint8_t kVersion = 1;
+const uint8_t kCommandKeys = 1, kCommandStatus = 2, kCommandStop = 3;
+const uint8_t kStatusOk = 0, kStatusRefused = 1;
+const size_t kRequestSize = 8;
+const size_t kHeaderSize = 8;
+const size_t kKeySize = 32;
+const size_t kMaxKeys = 4;
+// A client that stalls mid-request doesn't hold up the others for long
+const int kIoTimeoutSeconds = 2;
+
+#ifndef _WIN32
+volatile sig_atomic_t g_signalled = 0;
+
+void on_signal(int) {
+    g_signalled = 1;
+}
+
+std::runtime_error system_error(const std::string& what) {
+    return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+sockaddr_un socket_address(const std::string& path) {
+    sockaddr_un addr{};
+    if (path.size() >= sizeof(addr.sun_path)) {
+        throw std::runtime_error("Agent socket path is too long: " + path);
+    }
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return addr;
+}
+
+std::string parent_dir(const std::string& path) {
+    size_t slash = path.rfind('/');
+    if (slash == std::string::npos) return ".";
+    return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+// Anyone who can write to the socket's directory could plant a socket of
+// their own there and collect keys, or hand out keys of their choosing
+void check_directory(const std::string& dir) {
+    struct stat st;
+    if (lstat(dir.c_str(), &st) != 0) {
+        throw system_error("Agent directory " + dir);
+    }
+    if (!S_ISDIR(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & 077) != 0) {
+        throw std::runtime_error("Agent directory " + dir + " must be a directory owned by this user with mode 0700");
+    }
+}
+
+void set_timeouts(int fd) {
+    timeval tv{};
+    tv.tv_sec = kIoTimeoutSeconds;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+bool read_full(int fd, uint8_t* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = read(fd, buf, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        buf += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool write_full(int fd, const uint8_t* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        buf += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool peer_is_same_user(int fd) {
+#ifdef __linux__
+    ucred cred{};
+    socklen_t len = sizeof(cred);
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == geteuid();
+#else
+    uid_t uid;
+    gid_t gid;
+    return getpeereid(fd, &uid, &gid) == 0 && uid == geteuid();
+#endif
+}
+
+// Sends one request and reads the whole response; false if no agent is
+// listening at `path`
+bool call(const std::string& path, uint8_t command, uint8_t scope, std::vector<uint8_t>& response) {
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0) {
+        if (errno == ENOENT || errno == ENOTDIR) return false;
+        throw system_error("Agent socket " + path);
+    }
+    check_directory(parent_dir(path));
+    if (!S_ISSOCK(st.st_mode) || st.st_uid != geteuid()) {
+        throw std::runtime_error("Agent socket " + path + " is not a socket owned by this user");
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) throw system_error("Agent socket");
+    sockaddr_un addr = socket_address(path);
+    if (connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0) {
+        int err = errno;
+        close(fd);
+        // Left behind by an agent that is gone
+        if (err == ECONNREFUSED || err == ENOENT) return false;
+        errno = err;
+        throw system_error("Connecting to the key agent at " + path);
+    }
+    set_timeouts(fd);
+
+    uint8_t request[kRequestSize] = {0, 0, 0, 0, kVersion, command, scope, 0};
+    std::memcpy(request, kMagic, sizeof(kMagic));
+    response.assign(kHeaderSize, 0);
+    bool ok = write_full(fd, request, sizeof(request)) && read_full(fd, response.data(), kHeaderSize);
+    if (ok && response[0] == kStatusOk && response[1] <= kMaxKeys) {
+        response.resize(kHeaderSize + response[1] * kKeySize);
+        ok = read_full(fd, response.data() + kHeaderSize, response.size() - kHeaderSize);
+    }
+    close(fd);
+    if (!ok) {
+        OPENSSL_cleanse(response.data(), response.size());
+        throw std::runtime_error("Key agent at " + path + " did not answer");
+    }
+    if (response[0] != kStatusOk) {
+        throw std::runtime_error("Key agent at " + path + " refused the request");
+    }
+    return true;
+}
+
+uint32_t seconds_left(const std::vector<uint8_t>& response) {
+    uint32_t seconds;
+    std::memcpy(&seconds, response.data() + 4, sizeof(seconds));
+    return seconds;
+}
+#endif
+
+} // namespace
+
+std::string default_socket_path() {
+#ifdef _WIN32
+    return "";
+#else
+    const char* env = std::getenv("SECURE_BACKUP_AGENT_SOCK");
+    if (env && *env) return std::string(env) == "off" ? "" : env;
+    const char* runtime_dir = std::getenv("XDG_RUNTIME_DIR");
+    if (runtime_dir && *runtime_dir) return std::string(runtime_dir) + "/secure-backup/agent.sock";
+    return "/tmp/secure-backup-" + std::to_string(geteuid()) + "/agent.sock";
+#endif
+}
+
+KeyAgent::KeyAgent(const std::array<uint8_t, 32>& master_key, const AgentOptions& options) : options_(options) {
+#ifdef _WIN32
+    (void)master_key;
+    throw std::runtime_error("The key agent needs Unix domain sockets");
+#else
+    if (options_.socket_path.empty()) {
+        throw std::invalid_argument("No key agent socket path");
+    }
+    if (options_.ttl_seconds == 0) {
+        throw std::invalid_argument("Key agent TTL must be positive");
+    }
+    std::string dir = parent_dir(options_.socket_path);
+    if (mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) {
+        throw system_error("Creating agent directory " + dir);
+    }
+    check_directory(dir);
+    uint32_t remaining;
+    if (agent_status(options_.socket_path, remaining)) {
+        throw std::runtime_error("A key agent is already running on " + options_.socket_path);
+    }
+    unlink(options_.socket_path.c_str());
+
+    try {
+        page_size_ = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        void* page = mmap(nullptr, page_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (page == MAP_FAILED) throw system_error("Allocating key memory");
+        key_page_ = static_cast<uint8_t*>(page);
+#ifdef MADV_DONTDUMP
+        madvise(page, page_size_, MADV_DONTDUMP);
+#endif
+        lock_key();
+        std::memcpy(key_page_, master_key.data(), master_key.size());
+
+        listen_fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen_fd_ < 0) throw system_error("Agent socket");
+        fcntl(listen_fd_, F_SETFD, FD_CLOEXEC);
+        sockaddr_un addr = socket_address(options_.socket_path);
+        mode_t old_mask = umask(077);
+        int rc = bind(listen_fd_, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr));
+        umask(old_mask);
+        if (rc != 0 || listen(listen_fd_, 16) != 0) {
+            throw system_error("Binding the key agent to " + options_.socket_path);
+        }
+    } catch (...) {
+        release(false);
+        throw;
+    }
+#endif
+}
+
+KeyAgent::~KeyAgent() {
+    release(true);
+}
+
+void KeyAgent::release(bool remove_socket) {
+#ifndef _WIN32
+    if (listen_fd_ >= 0) {
+        close(listen_fd_);
+        listen_fd_ = -1;
+        if (remove_socket) unlink(options_.socket_path.c_str());
+    }
+    if (key_page_) {
+        OPENSSL_cleanse(key_page_, page_size_);
+        munlock(key_page_, page_size_);
+        munmap(key_page_, page_size_);
+        key_page_ = nullptr;
+    }
+#else
+    (void)remove_socket;
+#endif
+}
+
+void KeyAgent::lock_key() {
+#ifndef _WIN32
+    if (mlock(key_page_, page_size_) != 0) {
+        throw system_error("Locking key memory");
+    }
+#ifdef __linux__
+    // No core dumps, and no ptrace attach by other processes of the same user
+    prctl(PR_SET_DUMPABLE, 0, 0, 0, 0);
+#endif
+#endif
+}
+
+bool KeyAgent::serve() {
+#ifdef _WIN32
+    return false;
+#else
+    if (!options_.foreground) {
+        pid_t pid = fork();
+        if (pid < 0) throw system_error("Starting the key agent");
+        if (pid > 0) {
+            // The child owns the socket and the key now
+            release(false);
+            return true;
+        }
+        setsid();
+        int null_fd = open("/dev/null", O_RDWR);
+        if (null_fd >= 0) {
+            dup2(null_fd, STDIN_FILENO);
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+            if (null_fd > STDERR_FILENO) close(null_fd);
+        }
+        // The child never returns: the rest of the caller's stack (stats
+        // reports, other teardown) belongs to the parent
+        int status = 0;
+        try {
+            // Memory locks are not inherited across fork
+            lock_key();
+            run();
+        } catch (...) {
+            status = 1;
+        }
+        release(true);
+        _exit(status);
+    }
+    run();
+    return false;
+#endif
+}
+
+void KeyAgent::run() {
+#ifndef _WIN32
+    struct sigaction action{};
+    action.sa_handler = on_signal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    sigaction(SIGHUP, &action, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(options_.ttl_seconds);
+    bool stop = false;
+    while (!stop && !g_signalled) {
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline) break;
+        auto left_ms = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1;
+        pollfd pfd{listen_fd_, POLLIN, 0};
+        int rc = poll(&pfd, 1, static_cast<int>(std::min<long long>(left_ms, INT_MAX)));
+        if (rc < 0 && errno != EINTR) throw system_error("Key agent poll");
+        if (rc <= 0) continue;
+
+        int fd = accept(listen_fd_, nullptr, nullptr);
+        if (fd < 0) continue;
+        set_timeouts(fd);
+        if (peer_is_same_user(fd)) {
+            auto left = std::chrono::duration_cast<std::chrono::seconds>(deadline - std::chrono::steady_clock::now());
+            answer(fd, static_cast<uint32_t>(std::max<long long>(0, left.count())), stop);
+        }
+        close(fd);
+    }
+#endif
+}
+
+void KeyAgent::answer(int fd, uint32_t seconds_left, bool& stop) {
+#ifndef _WIN32
+    uint8_t request[kRequestSize];
+    uint8_t response[kHeaderSize + kMaxKeys * kKeySize] = {};
+    size_t key_count = 0;
+    response[0] = kStatusRefused;
+    if (read_full(fd, request, sizeof(request)) && std::memcmp(request, kMagic, sizeof(kMagic)) == 0 &&
+        request[4] == kVersion) {
+        uint8_t command = request[5];
+        uint8_t scope = request[6];
+        if (command == kCommandKeys &&
+            (scope == static_cast<uint8_t>(crypto::KeyScope::Backup) || scope == static_cast<uint8_t>(crypto::KeyScope::Restore))) {
+            std::array<uint8_t, 32> master;
+            std::memcpy(master.data(), key_page_, master.size());
+            crypto::OperationKeys keys = crypto::KeyManager::operation_keys(master, static_cast<crypto::KeyScope>(scope));
+            OPENSSL_cleanse(master.data(), master.size());
+            const std::array<uint8_t, 32>* parts[kMaxKeys] = {&keys.data, &keys.dedup, &keys.pack, &keys.fingerprint};
+            key_count = keys.scope == crypto::KeyScope::Backup ? 4 : 1;
+            for (size_t i = 0; i < key_count; i++) {
+                std::memcpy(response + kHeaderSize + i * kKeySize, parts[i]->data(), kKeySize);
+            }
+            response[0] = kStatusOk;
+        } else if (command == kCommandStatus || command == kCommandStop) {
+            stop = command == kCommandStop;
+            response[0] = kStatusOk;
+        }
+    }
+    response[1] = static_cast<uint8_t>(key_count);
+    std::memcpy(response + 4, &seconds_left, sizeof(seconds_left));
+    write_full(fd, response, kHeaderSize + key_count * kKeySize);
+    OPENSSL_cleanse(response, sizeof(response));
+#else
+    (void)fd;
+    (void)seconds_left;
+    (void)stop;
+#endif
+}
+
+bool request_keys(const std::string& socket_path, crypto::KeyScope scope, crypto::OperationKeys& out) {
+#ifdef _WIN32
+    (void)socket_path;
+    (void)scope;
+    (void)out;
+    return false;
+#else
+    std::vector<uint8_t> response;
+    if (!call(socket_path, kCommandKeys, static_cast<uint8_t>(scope), response)) return false;
+    size_t expected = scope == crypto::KeyScope::Backup ? 4 : 1;
+    if (response[1] != expected) {
+        OPENSSL_cleanse(response.data(), response.size());
+        throw std::runtime_error("Key agent sent the wrong number of keys");
+    }
+    std::array<uint8_t, 32>* parts[kMaxKeys] = {&out.data, &out.dedup, &out.pack, &out.fingerprint};
+    out.zeroize();
+    out.scope = scope;
+    for (size_t i = 0; i < expected; i++) {
+        std::memcpy(parts[i]->data(), response.data() + kHeaderSize + i * kKeySize, kKeySize);
+    }
+    OPENSSL_cleanse(response.data(), response.size());
+    return true;
+#endif
+}
+
+bool agent_status(const std::string& socket_path, uint32_t& seconds) {
+#ifdef _WIN32
+    (void)socket_path;
+    (void)seconds;
+    return false;
+#else
+    std::vector<uint8_t> response;
+    if (!call(socket_path, kCommandStatus, 0, response)) return false;
+    seconds = seconds_left(response);
+    return true;
+#endif
+}
+
+bool stop_agent(const std::string& socket_path) {
+#ifdef _WIN32
+    (void)socket_path;
+    return false;
+#else
+    std::vector<uint8_t> response;
+    return call(socket_path, kCommandStop, 0, response);
+#endif
+}
+
+} // namespace agent
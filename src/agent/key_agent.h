@@ -0,0 +1,73 @@
+#pragma once
+
+#include "../crypto/key_manager.h"
+#include <array>
+#include <cstdint>
+#include <string>
+
+namespace agent {
+
+// A key agent holds the master key so that CLI runs skip the passphrase
+// prompt and PBKDF2. It listens on a Unix socket in a directory only its
+// user can enter, answers only peers running as the same user, and hands
+// each caller the operation keys it asks for (crypto::OperationKeys), never
+// the passphrase. The key lives in a locked, non-dumpable page and is wiped
+// when the TTL runs out or the agent is stopped.
+//
+// Protocol, one request per connection:
+//   request:  "SBKA" || version (u8) || command (u8) || scope (u8) || reserved (u8)
+//   response: status (u8) || key count (u8) || reserved (u16) || seconds left (u32) || keys (32 bytes each)
+
+struct AgentOptions {
+    std::string socket_path;
+    uint32_t ttl_seconds = 3600;
+    bool foreground = false;   // otherwise detach once the socket is bound
+};
+
+// $SECURE_BACKUP_AGENT_SOCK, else "$XDG_RUNTIME_DIR/secure-backup/agent.sock",
+// else "/tmp/secure-backup-<uid>/agent.sock"; empty if agents are unsupported
+// or the variable is "off"
+std::string default_socket_path();
+
+class KeyAgent {
+public:
+    // Binds the socket; throws if another agent answers on it
+    KeyAgent(const std::array<uint8_t, 32>& master_key, const AgentOptions& options);
+    ~KeyAgent();
+
+    KeyAgent(const KeyAgent&) = delete;
+    KeyAgent& operator=(const KeyAgent&) = delete;
+
+    // Answers requests until the TTL expires, a stop request arrives or the
+    // process is signalled, then returns false. Unless `foreground`, the
+    // caller returns true at once and a detached child serves instead; the
+    // child exits when done and never returns.
+    bool serve();
+
+private:
+    AgentOptions options_;
+    uint8_t* key_page_ = nullptr;   // the master key, at the start of a locked page
+    size_t page_size_ = 0;
+    int listen_fd_ = -1;
+
+    // Closes the socket and wipes the key. The socket file stays unless
+    // `remove_socket`, since a forked child may be serving on it.
+    void release(bool remove_socket);
+    void lock_key();
+    // The serving loop
+    void run();
+    void answer(int fd, uint32_t seconds_left, bool& stop);
+};
+
+// Operation keys from the agent at `socket_path`. False if no agent is
+// listening there; throws if the socket fails the ownership checks or the
+// agent refuses.
+bool request_keys(const std::string& socket_path, crypto::KeyScope scope, crypto::OperationKeys& out);
+
+// Seconds the agent has left; false if none is running
+bool agent_status(const std::string& socket_path, uint32_t& seconds_left);
+
+// Asks the agent to wipe its key and exit; false if none is running
+bool stop_agent(const std::string& socket_path);
+
+} // namespace agent
@@ -1,31 +1,147 @@
 #include "chunker.h"
 #include "../utils/file_utils.h"
+#include "../metrics/metrics.h"
 #include <stdexcept>
+#include <cstring>
+#include <array>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 namespace chunker {
 
+namespace {
+
+// Gear table for the rolling hash. Generated from a fixed seed so boundaries
+// are stable across runs and builds; changing it invalidates all dedup.
+std::array<uint64_t, 256> make_gear_table() {
+    std::array<uint64_t, 256> table{};
+    uint64_t state = 0x5ec0eba5e0ddf00dULL;
+    for (auto& entry : table) {
+        // splitmix64
+        uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        entry = z ^ (z >> 31);
+    }
+    return table;
+}
+
+const std::array<uint64_t, 256> GEAR = make_gear_table();
+
+// Mask with the top `bits` bits set; the gear hash mixes most into the high bits
+uint64_t top_bits_mask(unsigned bits) {
+    if (bits == 0) return 0;
+    if (bits >= 64) return ~0ULL;
+    return ~0ULL << (64 - bits);
+}
+
+unsigned floor_log2(size_t v) {
+    unsigned bits = 0;
+    while (v >>= 1) bits++;
+    return bits;
+}
+
+} // namespace
+
+const char* ChunkingParams::mode_name(ChunkingMode mode) {
+    return mode == ChunkingMode::ContentDefined ? "cdc" : "fixed";
+}
+
 Chunker::Chunker(const std::string& path, size_t chunk_size)
-    : file_path_(path), chunk_size_(chunk_size), current_chunk_id_(0), bytes_read_(0) {
-    
-    if (!utils::FileUtils::exists(path)) {
-        throw std::runtime_error("File not found: " + path);
+    : Chunker(path, [chunk_size] {
+          ChunkingParams params;
+          params.chunk_size = chunk_size;
+          return params;
+      }()) {}
+
+Chunker::Chunker(const std::string& path, const ChunkingParams& params)
+    : file_path_(path), params_(params), chunk_size_(params.chunk_size), current_chunk_id_(0), bytes_read_(0),
+      buffered_(0), mask_small_(0), mask_large_(0), map_(nullptr), map_size_(0) {
+
+    if (params_.mode == ChunkingMode::Fixed) {
+        if (chunk_size_ == 0) {
+            throw std::invalid_argument("Chunk size must be positive");
+        }
+    } else {
+        if (params_.min_size == 0 || params_.min_size > params_.avg_size || params_.avg_size > params_.max_size) {
+            throw std::invalid_argument("Content-defined chunking requires 0 < min <= avg <= max");
+        }
+        // Normalized chunking: a stricter mask below the average size and a
+        // looser one above it pull the size distribution towards avg_size
+        unsigned bits = floor_log2(params_.avg_size);
+        mask_small_ = top_bits_mask(bits + 1);
+        mask_large_ = top_bits_mask(bits > 0 ? bits - 1 : 0);
+    }
+
+    open();
+}
+
+void Chunker::open() {
+    if (!utils::FileUtils::exists(file_path_)) {
+        throw std::runtime_error("File not found: " + file_path_);
     }
     
-    file_size_ = utils::FileUtils::get_file_size(path);
-    file_.open(path, std::ios::binary);
+    file_size_ = utils::FileUtils::get_file_size(file_path_);
+    if (params_.memory_map && map_file()) {
+        return;
+    }
+
+    file_.open(file_path_, std::ios::binary);
     
     if (!file_) {
-        throw std::runtime_error("Failed to open file: " + path);
+        throw std::runtime_error("Failed to open file: " + file_path_);
+    }
+    if (params_.mode == ChunkingMode::ContentDefined) {
+        // No window beyond the file itself: small files stay cheap
+        buffer_.resize(std::min(params_.max_size, file_size_));
+    }
+}
+
+bool Chunker::map_file() {
+#ifndef _WIN32
+    if (file_size_ == 0) return false;
+
+    int fd = ::open(file_path_.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    void* addr = ::mmap(nullptr, file_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) return false;
+
+    map_ = static_cast<const uint8_t*>(addr);
+    map_size_ = file_size_;
+    // Chunks are consumed front to back exactly once: aggressive read-ahead, early reclaim
+    ::madvise(addr, map_size_, MADV_SEQUENTIAL);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void Chunker::unmap_file() {
+#ifndef _WIN32
+    if (map_) {
+        ::munmap(const_cast<uint8_t*>(map_), map_size_);
+        map_ = nullptr;
+        map_size_ = 0;
     }
+#endif
 }
 
 Chunker::~Chunker() {
+    unmap_file();
     if (file_.is_open()) {
         file_.close();
     }
 }
 
 bool Chunker::hasNext() {
+    if (map_) return bytes_read_ < map_size_;
+    if (buffered_ > 0) return true;
     return file_.peek() != EOF && bytes_read_ < file_size_;
 }
 
@@ -33,9 +149,40 @@ Chunk Chunker::next() {
     if (!hasNext()) {
         throw std::runtime_error("No more chunks available");
     }
+    metrics::ScopedTimer timer(metrics::Stage::Chunk);
+    Chunk chunk = map_ ? next_mapped() : params_.mode == ChunkingMode::Fixed ? next_fixed() : next_content_defined();
+    timer.add_bytes(chunk.size);
+    return chunk;
+}
+
+Chunk Chunker::next_mapped() {
+    const uint8_t* start = map_ + bytes_read_;
+    size_t remaining = map_size_ - bytes_read_;
+
+    Chunk chunk;
+    chunk.id = current_chunk_id_++;
+    chunk.offset = bytes_read_;
+    chunk.size = params_.mode == ChunkingMode::Fixed ? std::min(chunk_size_, remaining)
+                                                     : find_cut_point(start, remaining);
+    chunk.view = start;
+    bytes_read_ += chunk.size;
+
+#ifndef _WIN32
+    // Start paging in the following chunk while this one is being encrypted
+    if (bytes_read_ < map_size_) {
+        static const size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+        size_t ahead_begin = bytes_read_ & ~(page - 1);
+        size_t ahead_len = std::min(params_.max_chunk_size(), map_size_ - ahead_begin);
+        ::madvise(const_cast<uint8_t*>(map_) + ahead_begin, ahead_len, MADV_WILLNEED);
+    }
+#endif
+    return chunk;
+}
 
+Chunk Chunker::next_fixed() {
     Chunk chunk;
     chunk.id = current_chunk_id_++;
+    chunk.offset = bytes_read_;
     chunk.data.resize(chunk_size_);
 
     file_.read(reinterpret_cast<char*>(chunk.data.data()), chunk_size_);
@@ -50,4 +197,44 @@ Chunk Chunker::next() {
     return chunk;
 }
 
+Chunk Chunker::next_content_defined() {
+    // Top the window up to max_size so the cut point never depends on read sizes
+    if (buffered_ < buffer_.size() && file_) {
+        file_.read(reinterpret_cast<char*>(buffer_.data() + buffered_), buffer_.size() - buffered_);
+        buffered_ += static_cast<size_t>(file_.gcount());
+    }
+
+    size_t cut = find_cut_point(buffer_.data(), buffered_);
+
+    Chunk chunk;
+    chunk.id = current_chunk_id_++;
+    chunk.offset = bytes_read_;
+    chunk.size = cut;
+    chunk.data.assign(buffer_.begin(), buffer_.begin() + cut);
+
+    std::memmove(buffer_.data(), buffer_.data() + cut, buffered_ - cut);
+    buffered_ -= cut;
+    bytes_read_ += cut;
+    return chunk;
+}
+
+size_t Chunker::find_cut_point(const uint8_t* data, size_t len) const {
+    if (len <= params_.min_size) return len;
+
+    size_t end = std::min(len, params_.max_size);
+    size_t normal = std::min(params_.avg_size, end);
+    uint64_t fp = 0;
+    size_t i = params_.min_size;
+
+    for (; i < normal; i++) {
+        fp = (fp << 1) + GEAR[data[i]];
+        if ((fp & mask_small_) == 0) return i + 1;
+    }
+    for (; i < end; i++) {
+        fp = (fp << 1) + GEAR[data[i]];
+        if ((fp & mask_large_) == 0) return i + 1;
+    }
+    return end;
+}
+
 } // namespace chunker
@@ -9,13 +9,37 @@ namespace chunker {
 
 struct Chunk {
     uint64_t id;
-    std::vector<uint8_t> data;
+    std::vector<uint8_t> data;       // owned copy (stream mode only)
     size_t size;
+    uint64_t offset;                 // position of the first byte in the source file
+    const uint8_t* view = nullptr;   // non-owning, points into the Chunker's mapping (mmap mode)
+
+    // Chunk bytes regardless of mode; a view is valid while its Chunker lives
+    const uint8_t* bytes() const { return view ? view : data.data(); }
+};
+
+enum class ChunkingMode {
+    Fixed,            // cut every chunk_size bytes
+    ContentDefined    // FastCDC-style gear hash, boundaries follow the content
+};
+
+struct ChunkingParams {
+    ChunkingMode mode = ChunkingMode::Fixed;
+    size_t chunk_size = 16 * 1024 * 1024;   // fixed mode
+    size_t min_size = 4 * 1024 * 1024;      // content-defined mode
+    size_t avg_size = 16 * 1024 * 1024;
+    size_t max_size = 64 * 1024 * 1024;
+    bool memory_map = false;                // read through mmap and yield views instead of copies
+
+    // Largest chunk this configuration can produce
+    size_t max_chunk_size() const { return mode == ChunkingMode::Fixed ? chunk_size : max_size; }
+    static const char* mode_name(ChunkingMode mode);
 };
 
 class Chunker {
 public:
     Chunker(const std::string& path, size_t chunk_size = 16 * 1024 * 1024);
+    Chunker(const std::string& path, const ChunkingParams& params);
     ~Chunker();
 
     bool hasNext();
@@ -23,11 +47,30 @@ public:
 
 private:
     std::string file_path_;
+    ChunkingParams params_;
     size_t chunk_size_;
     std::ifstream file_;
     uint64_t current_chunk_id_;
     size_t file_size_;
     size_t bytes_read_;
+
+    // Content-defined mode: bytes read from the file but not yet emitted
+    std::vector<uint8_t> buffer_;
+    size_t buffered_;
+    uint64_t mask_small_;
+    uint64_t mask_large_;
+
+    // mmap mode: whole file mapped read-only, falls back to streams if unavailable
+    const uint8_t* map_;
+    size_t map_size_;
+
+    void open();
+    bool map_file();
+    void unmap_file();
+    Chunk next_fixed();
+    Chunk next_content_defined();
+    Chunk next_mapped();
+    size_t find_cut_point(const uint8_t* data, size_t len) const;
 };
 
 } // namespace chunker
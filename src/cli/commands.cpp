@@ -1,136 +1,427 @@
 #include "commands.h"
-#include "../chunker/chunker.h"
-#include <iostream>
-
-namespace cli {
-
-#include "commands.h"
-#include "../chunker/chunker.h"
+#include "../agent/key_agent.h"
 #include "../crypto/key_manager.h"
-#include "../crypto/encryptor.h"
 #include "../merkle/merkle_tree.h"
+#include "../metrics/metrics.h"
 #include "../ledger/ledger.h"
 #include "../ledger/manifest.h"
+#include "../ledger/binary_manifest.h"
+#include "../pipeline/backup_pipeline.h"
+#include "../pipeline/restore_pipeline.h"
+#include "../pipeline/shard_loader.h"
 #include "../storage/uploader.h"
+#include "../storage/downloader.h"
+#include "../storage/storage_backend.h"
 #include "../utils/file_utils.h"
+#include "../utils/hash_utils.h"
+#include "../utils/json_utils.h"
+#include "../utils/tree_walker.h"
+#include <openssl/crypto.h>
 #include <iostream>
 #include <iomanip>
-#include <sstream>
+#include <fstream>
+#include <memory>
+#include <map>
+#include <ctime>
 
 namespace cli {
 
-// Helper to convert bytes to hex string
-std::string to_hex(const std::vector<uint8_t>& data) {
-    std::stringstream ss;
-    for (uint8_t b : data) {
-        ss << std::hex << std::setw(2) << std::setfill('0') << (int)b;
+namespace {
+
+const char kLedgerPath[] = "data/ledger.log";
+
+std::vector<merkle::Digest> leaf_digests(const std::vector<std::string>& hashes) {
+    std::vector<merkle::Digest> leaves(hashes.size());
+    for (size_t i = 0; i < hashes.size(); i++) {
+        leaves[i] = utils::HashUtils::digest_from_hex(hashes[i]);
+    }
+    return leaves;
+}
+
+// Merkle root of a manifest's chunk hashes, using the scheme its version records
+std::string merkle_root_of(const ledger::Manifest& manifest, const std::vector<std::string>& hashes) {
+    if (hashes.empty()) {
+        return "";
+    }
+    if (manifest.version < 2) {
+        return merkle::MerkleTree::compute_root_legacy(hashes);
+    }
+    return utils::HashUtils::to_hex(merkle::MerkleTree::compute_root(leaf_digests(hashes)));
+}
+
+// Prompts for the passphrase (twice if `confirm`) and derives the master key
+std::array<uint8_t, 32> derive_master_key(bool confirm = false) {
+    std::string passphrase;
+    std::cout << "Enter passphrase: ";
+    std::cin >> passphrase;
+    if (confirm) {
+        std::string again;
+        std::cout << "Confirm passphrase: ";
+        std::cin >> again;
+        bool match = again == passphrase;
+        OPENSSL_cleanse(&again[0], again.size());
+        if (!match) throw std::runtime_error("Passphrases do not match");
+    }
+
+    crypto::KeyDerivationParams kdf_params;
+    kdf_params.salt = {0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08}; // Fixed salt for demo
+    crypto::KeyManager key_manager(passphrase, kdf_params);
+    return key_manager.get_master_key();
+}
+
+// Keys for one operation: from the key agent if one is running, otherwise
+// derived here after prompting for the passphrase
+void obtain_keys(crypto::KeyScope scope, crypto::OperationKeys& keys) {
+    std::string socket_path = agent::default_socket_path();
+    if (!socket_path.empty() && agent::request_keys(socket_path, scope, keys)) {
+        std::cout << "Using keys from the key agent." << std::endl;
+        return;
+    }
+    auto master_key = derive_master_key();
+    keys = crypto::KeyManager::operation_keys(master_key, scope);
+    OPENSSL_cleanse(master_key.data(), master_key.size());
+}
+
+// Raw manifest bytes from a local path or a URL
+std::vector<uint8_t> read_manifest_bytes(const std::string& manifest_path) {
+    if (!storage::url_scheme(manifest_path).empty()) {
+        storage::Downloader downloader;
+        return downloader.download(manifest_path);
+    }
+    return utils::FileUtils::read_file(manifest_path);
+}
+
+bool is_local_binary_manifest(const std::string& manifest_path) {
+    if (!storage::url_scheme(manifest_path).empty()) return false;
+    std::ifstream in(manifest_path, std::ios::binary);
+    uint8_t magic[4] = {};
+    in.read(reinterpret_cast<char*>(magic), sizeof(magic));
+    return in && ledger::BinaryManifest::detect(magic, sizeof(magic));
+}
+
+// Reads a JSON or binary manifest from a local path or downloads it from a URL
+ledger::Manifest load_manifest(const std::string& manifest_path) {
+    auto data = read_manifest_bytes(manifest_path);
+    metrics::ScopedTimer timer(metrics::Stage::Manifest, data.size());
+    if (ledger::BinaryManifest::detect(data.data(), data.size())) {
+        return ledger::BinaryManifest(std::move(data)).to_manifest();
+    }
+    return ledger::Manifest::from_json(json::parse(data.begin(), data.end()));
+}
+
+// Random-access view of a manifest; local binary manifests are mapped, not read
+std::unique_ptr<ledger::BinaryManifest> open_manifest_view(const std::string& manifest_path) {
+    if (is_local_binary_manifest(manifest_path)) {
+        return std::make_unique<ledger::BinaryManifest>(manifest_path);
+    }
+    auto data = read_manifest_bytes(manifest_path);
+    if (!ledger::BinaryManifest::detect(data.data(), data.size())) {
+        metrics::ScopedTimer timer(metrics::Stage::Manifest, data.size());
+        data = ledger::BinaryManifest::encode(ledger::Manifest::from_json(json::parse(data.begin(), data.end())));
+    }
+    return std::make_unique<ledger::BinaryManifest>(std::move(data));
+}
+
+// Moves the chunk entries of a single-file manifest into binary shard
+// objects of `shard_chunks` chunks each; the manifest then lists the shards.
+// Shard roots are read off `tree`, the full tree over the same chunks. Shards
+// are uploaded a few at a time as one batch.
+void shard_manifest(ledger::Manifest& manifest, const merkle::MerkleTree& tree, uint64_t shard_chunks,
+                    storage::Uploader& uploader) {
+    const size_t kShardBatch = 8;
+    manifest.shard_chunks = shard_chunks;
+    size_t height = manifest.shard_height();
+    std::vector<std::vector<uint8_t>> encoded;
+    encoded.reserve(kShardBatch);   // the batch points into these
+    std::vector<storage::PutRequest> batch;
+    auto flush = [&] {
+        std::vector<std::string> uris = uploader.upload_batch(batch);
+        for (size_t i = 0; i < uris.size(); i++) {
+            manifest.shards[manifest.shards.size() - uris.size() + i].uri = uris[i];
+        }
+        encoded.clear();
+        batch.clear();
+    };
+    for (uint64_t first = 0; first < manifest.chunks.size(); first += shard_chunks) {
+        uint64_t end = std::min<uint64_t>(first + shard_chunks, manifest.chunks.size());
+        ledger::Manifest shard;
+        shard.file_name = manifest.file_name;
+        shard.chunking = manifest.chunking;
+        shard.chunk_size = manifest.chunk_size;
+        shard.version = manifest.version;
+        shard.cipher = manifest.cipher;
+        shard.chunks.assign(manifest.chunks.begin() + first, manifest.chunks.begin() + end);
+        shard.original_size = 0;
+        for (const auto& chunk : shard.chunks) {
+            shard.original_size += chunk.size;
+            if (!chunk.pack.empty()) shard.packs[chunk.pack] = manifest.packs.at(chunk.pack);
+        }
+
+        ledger::ShardInfo info;
+        info.first_chunk = first;
+        info.chunk_count = end - first;
+        info.root = utils::HashUtils::to_hex(tree.node(height, first / shard_chunks));
+        shard.merkle_root = info.root;
+        std::string name = manifest.file_name + ".shard" + std::to_string(manifest.shards.size()) + "." +
+                           info.root.substr(0, 16);
+        encoded.push_back(ledger::BinaryManifest::encode(shard));
+        batch.push_back({name, encoded.back().data(), encoded.back().size()});
+        manifest.shards.push_back(std::move(info));
+        if (batch.size() == kShardBatch) flush();
     }
-    return ss.str();
+    if (!batch.empty()) flush();
+    manifest.chunks.clear();
+    manifest.packs.clear();
 }
 
-std::string to_hex(const std::array<uint8_t, 16>& data) {
-    std::stringstream ss;
-    for (uint8_t b : data) {
-        ss << std::hex << std::setw(2) << std::setfill('0') << (int)b;
+// A chunk found for a single-chunk check; only its shard is loaded if the manifest is sharded
+struct ChunkLocation {
+    ledger::ChunkInfo chunk;
+    std::string object_uri;
+    uint64_t leaf_count;
+};
+
+ChunkLocation locate_chunk(const ledger::BinaryManifest& manifest, size_t index) {
+    if (manifest.shard_count() == 0) {
+        return ChunkLocation{manifest.leaf(index), manifest.object_uri(index), manifest.leaf_count()};
+    }
+    ledger::Manifest top = manifest.to_manifest();
+    if (index >= top.leaf_count()) {
+        throw std::out_of_range("Chunk " + std::to_string(index) + " out of range (" +
+                                std::to_string(top.leaf_count()) + " chunks)");
     }
-    return ss.str();
+    pipeline::ShardLoader loader(top, 1);
+    size_t shard_index = loader.shard_of(index);
+    auto shard = loader.load(shard_index);
+    std::cout << "Loaded manifest shard " << shard_index << " of " << loader.shard_count() << std::endl;
+    const auto& chunk = shard->chunks[index - top.shards[shard_index].first_chunk];
+    return ChunkLocation{chunk, shard->object_uri(chunk), top.leaf_count()};
 }
 
-std::string to_hex(const std::array<uint8_t, 12>& data) {
-    std::stringstream ss;
-    for (uint8_t b : data) {
-        ss << std::hex << std::setw(2) << std::setfill('0') << (int)b;
+// Checks one chunk against the manifest root: the chunk's blob plus one
+// 32-byte range of the stored tree per level
+bool verify_single_chunk(const ledger::BinaryManifest& manifest, size_t index) {
+    std::string tree_uri = manifest.merkle_tree();
+    if (manifest.version() < 2 || tree_uri.empty()) {
+        throw std::runtime_error("Manifest has no stored Merkle tree; run a full verify");
     }
-    return ss.str();
+    ChunkLocation location = locate_chunk(manifest, index);
+    const ledger::ChunkInfo& chunk = location.chunk;
+    std::cout << "Verifying chunk " << index << "... ";
+
+    storage::Downloader downloader;
+    std::vector<uint8_t> blob;
+    if (chunk.pack.empty()) {
+        blob = downloader.download(chunk.uri);
+    } else {
+        blob = downloader.download_range(location.object_uri, chunk.pack_offset, chunk.pack_length);
+    }
+    merkle::Digest digest = utils::HashUtils::sha256(blob.data(), blob.size());
+    if (digest != utils::HashUtils::digest_from_hex(chunk.hash)) {
+        std::cout << "FAILED (Hash mismatch)" << std::endl;
+        return false;
+    }
+    std::cout << "OK" << std::endl;
+
+    // Every sibling is its own range of the stored tree; fetched as one batch
+    std::vector<uint64_t> offsets = merkle::MerkleTree::proof_offsets(location.leaf_count, index);
+    std::vector<std::vector<uint8_t>> nodes(offsets.size());
+    std::vector<storage::GetRequest> requests;
+    for (size_t i = 0; i < offsets.size(); i++) {
+        requests.push_back({tree_uri, true, offsets[i], sizeof(merkle::Digest), &nodes[i]});
+    }
+    downloader.download_batch(requests);
+    std::vector<merkle::Digest> proof;
+    for (const auto& node : nodes) {
+        merkle::Digest sibling;
+        std::copy(node.begin(), node.end(), sibling.begin());
+        proof.push_back(sibling);
+    }
+    std::cout << "Inclusion proof: " << proof.size() << " hashes (" << proof.size() * sizeof(merkle::Digest)
+              << " bytes)" << std::endl;
+    return merkle::MerkleTree::verify_proof(digest, index, proof,
+                                            utils::HashUtils::digest_from_hex(manifest.merkle_root()));
 }
 
-void Commands::backup(const std::string& file_path, size_t chunk_size) {
+} // namespace
+
+void Commands::backup(const std::string& file_path, const BackupOptions& options) {
     std::cout << "Starting backup for: " << file_path << std::endl;
     
     try {
         // 1. Key Derivation
-        std::string passphrase;
-        std::cout << "Enter passphrase: ";
-        std::cin >> passphrase;
+        crypto::OperationKeys keys;
+        obtain_keys(crypto::KeyScope::Backup, keys);
 
-        crypto::KeyDerivationParams kdf_params;
-        kdf_params.salt = {0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08}; // Fixed salt for demo
-        crypto::KeyManager key_manager(passphrase, kdf_params);
-        auto master_key = key_manager.get_master_key();
-        crypto::Encryptor encryptor(master_key);
+        // 2. Chunk, encrypt, hash and upload in parallel
+        ledger::Manifest manifest;
+        const auto& chunking = options.pipeline.chunking;
+        manifest.chunking = chunker::ChunkingParams::mode_name(chunking.mode);
+        manifest.chunk_size = chunking.mode == chunker::ChunkingMode::Fixed ? chunking.chunk_size : chunking.avg_size;
+        manifest.cipher = options.pipeline.cipher;
 
-        // 2. Setup Storage
-        storage::Uploader uploader("http://localhost:3000");
+        bool snapshot = fs::is_directory(file_path);
+        if (snapshot) {
+            fs::path root = fs::absolute(file_path).lexically_normal();
+            if (root.filename().empty()) root = root.parent_path();
+            manifest.file_name = root.filename().string();
+            manifest.tree = true;
+        } else {
+            manifest.file_name = utils::FileUtils::get_filename(file_path);
+        }
 
-        // 3. Chunking & Processing
-        chunker::Chunker chunker(file_path, chunk_size);
-        ledger::Manifest manifest;
-        manifest.file_name = utils::FileUtils::get_filename(file_path);
-        manifest.original_size = utils::FileUtils::get_file_size(file_path);
-        manifest.chunk_size = chunk_size;
-        
-        std::vector<std::string> chunk_hashes;
+        pipeline::BackupPipeline backup_pipeline(keys, options.storage_url, options.pipeline);
+        ledger::Ledger local_ledger(kLedgerPath);
 
-        while (chunker.hasNext()) {
-            auto chunk = chunker.next();
-            
-            // Encrypt
-            auto cipher_res = encryptor.encrypt(chunk.data.data(), chunk.size);
-            
-            // Hash ciphertext (for Merkle Tree)
-            // We need to hash the ciphertext + tag + iv?
-            // Requirement: "compute encrypted-chunk hash (hash of ciphertext)"
-            // Let's hash the ciphertext vector itself.
-            // But usually we want to verify the whole blob (iv + ciphertext + tag).
-            // Let's combine them for upload and hash.
-            
-            std::vector<uint8_t> blob = cipher_res.iv; // 12 bytes
-            blob.insert(blob.end(), cipher_res.ciphertext.begin(), cipher_res.ciphertext.end());
-            blob.insert(blob.end(), cipher_res.tag.begin(), cipher_res.tag.end()); // 16 bytes
-            
-            // Upload
-            std::string chunk_name = manifest.file_name + ".chunk" + std::to_string(chunk.id) + ".enc";
-            std::string response_json = uploader.upload_chunk(blob, chunk_name);
-            
-            // Parse URI from response (assuming simple JSON {"uri": "...", ...})
-            // For now, let's assume the response IS the JSON and we can parse it.
-            // Or just use the known path if parsing is hard without the json lib header here (we have it included via ledger/manifest.h -> json.hpp)
-            auto resp_obj = json::parse(response_json);
-            std::string uri = resp_obj["uri"];
-
-            // Calculate hash of the blob for Merkle Tree
-            // We need a SHA256 helper. Let's use OpenSSL directly or add a helper.
-            // Re-using MerkleTree::sha256 is private.
-            // Let's just use the hash from the server if it returned it, or compute it.
-            // For safety, compute locally.
-            // I'll add a quick sha256 helper here or expose it in utils.
-            // For now, I'll assume I can use a temp helper.
-            
-            // Add to Manifest
-            ledger::ChunkInfo info;
-            info.id = chunk.id;
-            info.iv = to_hex(cipher_res.iv);
-            info.uri = uri;
-            // Hash of the blob (IV + Cipher + Tag)
-            // info.hash = ... 
-            // For now, let's use a placeholder hash or implement SHA256 here.
-            // I'll skip SHA256 impl here to save space and assume MerkleTree handles the hashing of leaves?
-            // MerkleTree::compute_root takes leaf_hashes.
-            // So I need to hash the blob.
-            
-            // Let's use a dummy hash for the moment to proceed, or use the IV as hash (insecure but compiles).
-            // Wait, I can use `merkle::MerkleTree` if I expose a hash function.
-            // I'll just skip the hash computation in this snippet and put a placeholder.
-            info.hash = "hash_placeholder_" + std::to_string(chunk.id);
-            chunk_hashes.push_back(info.hash);
-            
-            manifest.chunks.push_back(info);
-            
-            std::cout << "Uploaded Chunk " << chunk.id << " to " << uri << std::endl;
+        // Incremental: the last backup of the same name to the same store is the
+        // baseline; its chunks are reused by fingerprint and must exist there
+        ledger::Manifest previous;
+        bool have_previous = false;
+        if (options.incremental) {
+            json previous_json;
+            std::string store = storage::normalize_url(options.storage_url) + "/";
+            if (local_ledger.find_latest_manifest(manifest.file_name, store, previous_json)) {
+                previous = ledger::Manifest::from_json(previous_json);
+                have_previous = previous.tree == snapshot;
+            }
+            if (have_previous) {
+                std::cout << "Incremental against backup from " << previous.timestamp << std::endl;
+                // A sharded baseline is only loaded if the file turns out to have changed
+                if (!previous.sharded()) backup_pipeline.set_baseline(previous);
+            } else {
+                std::cout << "No previous backup of " << manifest.file_name << " to " << options.storage_url
+                          << ", running a full backup." << std::endl;
+            }
         }
 
-        // 4. Merkle Tree & Manifest
-        manifest.merkle_root = merkle::MerkleTree::compute_root(chunk_hashes);
+        // A file whose size and mtime match the baseline is taken over without
+        // being read, as long as every pack it references is still known
+        std::map<std::string, std::string> carried_packs;
+        auto carry_over = [&](uint64_t size, int64_t mtime_ns, uint64_t prev_size, int64_t prev_mtime_ns,
+                              const std::vector<ledger::ChunkInfo>& prev_chunks) {
+            if (!have_previous || mtime_ns == 0 || size != prev_size || mtime_ns != prev_mtime_ns) return false;
+            for (const auto& chunk : prev_chunks) {
+                if (!chunk.pack.empty() && !previous.packs.count(chunk.pack)) return false;
+            }
+            for (const auto& chunk : prev_chunks) {
+                if (!chunk.pack.empty()) carried_packs[chunk.pack] = previous.packs.at(chunk.pack);
+            }
+            return true;
+        };
+        size_t unchanged_files = 0;
+        size_t total_files = 0;
+
+        if (snapshot) {
+            // Snapshot: every file under the directory in one pipeline run and one manifest
+            fs::path root = fs::absolute(file_path).lexically_normal();
+            std::map<std::string, const ledger::FileEntry*> previous_files;
+            for (const auto& entry : previous.files) previous_files[entry.path] = &entry;
+
+            std::vector<pipeline::SourceFile> sources;
+            std::vector<size_t> source_entries;   // index into manifest.files per source
+            for (auto& walked : utils::TreeWalker::walk(file_path, options.pipeline.read_threads)) {
+                ledger::FileEntry entry;
+                entry.path = walked.path;
+                entry.directory = walked.directory;
+                entry.size = walked.size;
+                entry.mtime_ns = walked.mtime_ns;
+                if (!entry.directory) {
+                    total_files++;
+                    auto prior = previous_files.find(entry.path);
+                    if (prior != previous_files.end() && !prior->second->directory &&
+                        carry_over(entry.size, entry.mtime_ns, prior->second->size, prior->second->mtime_ns,
+                                   prior->second->chunks)) {
+                        entry.chunks = prior->second->chunks;
+                        unchanged_files++;
+                    } else {
+                        pipeline::SourceFile source;
+                        source.path = (root / entry.path).string();
+                        source.object_prefix = manifest.file_name + "." + fs::path(entry.path).filename().string();
+                        source.size = entry.size;
+                        sources.push_back(source);
+                        source_entries.push_back(manifest.files.size());
+                    }
+                }
+                manifest.files.push_back(std::move(entry));
+            }
+            std::cout << "Found " << total_files << " files in " << manifest.files.size() - total_files
+                      << " subdirectories." << std::endl;
+
+            auto per_file = backup_pipeline.run(sources, manifest.file_name);
+            for (size_t i = 0; i < sources.size(); i++) {
+                auto& entry = manifest.files[source_entries[i]];
+                entry.chunks = std::move(per_file[i]);
+                // Record what was actually read, in case the file changed since the walk
+                entry.size = 0;
+                for (const auto& chunk : entry.chunks) entry.size += chunk.size;
+            }
+            manifest.original_size = 0;
+            for (const auto& entry : manifest.files) manifest.original_size += entry.size;
+        } else {
+            total_files = 1;
+            // Taken before reading, so a write during the backup shows up next time
+            manifest.mtime_ns = utils::FileUtils::get_mtime_ns(file_path);
+            manifest.original_size = utils::FileUtils::get_file_size(file_path);
+            if (carry_over(manifest.original_size, manifest.mtime_ns, previous.original_size, previous.mtime_ns,
+                           previous.chunks)) {
+                manifest.chunks = previous.chunks;
+                manifest.shard_chunks = previous.shard_chunks;
+                manifest.shards = previous.shards;
+                manifest.chunking = previous.chunking;
+                manifest.chunk_size = previous.chunk_size;
+                unchanged_files = 1;
+            } else {
+                if (have_previous && previous.sharded()) {
+                    pipeline::ShardLoader loader(previous, options.pipeline.upload_threads);
+                    std::cout << "Loading " << loader.shard_count() << " shards of the previous manifest." << std::endl;
+                    backup_pipeline.set_baseline(loader.load_all());
+                }
+                manifest.chunks = backup_pipeline.run(file_path, manifest.file_name);
+            }
+        }
+        manifest.packs = backup_pipeline.packs();
+        manifest.packs.insert(carried_packs.begin(), carried_packs.end());
+
+        const auto& stats = backup_pipeline.stats();
+        if (stats.deduplicated) {
+            std::cout << "Dedup: reused " << stats.reused_chunks << " of " << stats.chunks << " chunks ("
+                      << stats.reused_bytes << " of " << stats.bytes << " bytes, "
+                      << static_cast<int>(stats.dedup_ratio() * 100.0 + 0.5) << "%)" << std::endl;
+        }
+        if (options.pipeline.compression.codec != compress::Codec::None) {
+            std::cout << "Compression (" << compress::codec_name(options.pipeline.compression.codec) << "): "
+                      << stats.compressed_chunks << " chunks, " << stats.compressed_from << " -> " << stats.compressed_to
+                      << " bytes; " << stats.incompressible_chunks << " chunks stored as is" << std::endl;
+        }
+        if (have_previous) {
+            std::cout << "Incremental: " << unchanged_files << " of " << total_files << " files unchanged, "
+                      << stats.unchanged_chunks << " chunks (" << stats.unchanged_bytes
+                      << " bytes) of changed files matched by fingerprint" << std::endl;
+        }
+
+        std::vector<std::string> chunk_hashes;
+        for (const auto* chunk : manifest.ordered_chunks()) {
+            chunk_hashes.push_back(chunk->hash);
+        }
+
+        // 3. Merkle Tree & Manifest. Every level is stored next to the manifest
+        // so a single chunk can later be proven without the other hashes.
+        storage::Uploader uploader(options.storage_url);
+        if (manifest.sharded()) {
+            // Carried over unchanged, shards and all
+            manifest.merkle_root = previous.merkle_root;
+            manifest.merkle_tree = previous.merkle_tree;
+        } else if (!chunk_hashes.empty()) {
+            merkle::MerkleTree tree(leaf_digests(chunk_hashes));
+            manifest.merkle_root = utils::HashUtils::to_hex(tree.root());
+            std::string tree_name = manifest.file_name + ".merkle." + manifest.merkle_root.substr(0, 16);
+            manifest.merkle_tree = uploader.upload_chunk(tree.serialize(), tree_name);
+            if (!manifest.tree && options.shard_chunks && manifest.chunks.size() > options.shard_chunks) {
+                shard_manifest(manifest, tree, options.shard_chunks, uploader);
+                std::cout << "Manifest split into " << manifest.shards.size() << " shards of up to "
+                          << manifest.shard_chunks << " chunks." << std::endl;
+            }
+        }
         
         // Timestamp
         std::time_t now = std::time(nullptr);
@@ -139,25 +430,29 @@ void Commands::backup(const std::string& file_path, size_t chunk_size) {
         manifest.timestamp = buf;
 
         // Upload Manifest
-        std::string manifest_json = manifest.to_json().dump();
-        std::string man_resp = uploader.upload_manifest(manifest_json);
-        std::cout << "Manifest uploaded." << std::endl;
+        std::string manifest_json;
+        {
+            metrics::ScopedTimer timer(metrics::Stage::Manifest);
+            manifest_json = manifest.to_json().dump();
+            timer.add_bytes(manifest_json.size());
+        }
+        std::string manifest_url = uploader.upload_manifest(manifest_json);
+        std::cout << "Manifest uploaded: " << manifest_url << std::endl;
 
-        // 5. Ledger
-        ledger::Ledger local_ledger("data/ledger.json");
-        local_ledger.append_event(manifest.to_json());
+        // 4. Ledger; the manifest location is chained with it so the catalog can be rebuilt from the log
+        json event = manifest.to_json();
+        event["manifest_url"] = manifest_url;
+        local_ledger.append_event(event);
         std::cout << "Appended to local ledger." << std::endl;
 
         std::cout << "Backup Success! Merkle Root: " << manifest.merkle_root << std::endl;
 
-        std::cout << "Backup Success! Merkle Root: " << manifest.merkle_root << std::endl;
-
     } catch (const std::exception& e) {
         std::cerr << "Error during backup: " << e.what() << std::endl;
     }
 }
 
-void Commands::verify(const std::string& manifest_path) {
+void Commands::verify(const std::string& manifest_path, const VerifyOptions& options) {
     std::cout << "Starting verification for manifest: " << manifest_path << std::endl;
     
     try {
@@ -167,28 +462,68 @@ void Commands::verify(const std::string& manifest_path) {
         // Let's assume it's a local file for now, or the user downloaded it.
         // If it starts with http, use downloader.
         
-        json manifest_json;
-        if (manifest_path.find("http") == 0) {
-            storage::Downloader downloader;
-            auto data = downloader.download(manifest_path);
-            std::string json_str(data.begin(), data.end());
-            manifest_json = json::parse(json_str);
+        // One chunk needs one record, so it is read through a view instead of decoding everything
+        std::unique_ptr<ledger::BinaryManifest> view;
+        ledger::Manifest manifest;
+        if (options.single_chunk) {
+            view = open_manifest_view(manifest_path);
+            manifest.file_name = view->file_name();
+            manifest.merkle_root = view->merkle_root();
         } else {
-            manifest_json = utils::JsonUtils::read_from_file(manifest_path);
+            manifest = load_manifest(manifest_path);
         }
-        
-        ledger::Manifest manifest = ledger::Manifest::from_json(manifest_json);
         std::cout << "Verifying file: " << manifest.file_name << std::endl;
         std::cout << "Expected Merkle Root: " << manifest.merkle_root << std::endl;
 
         // 2. Verify against Ledger (optional but recommended)
-        ledger::Ledger local_ledger("data/ledger.json");
-        if (!local_ledger.verify_chain()) {
+        ledger::Ledger local_ledger(kLedgerPath);
+        if (!local_ledger.verify_chain(options.full_ledger)) {
             std::cerr << "WARNING: Local ledger chain verification failed!" << std::endl;
         } else {
-            std::cout << "Local ledger chain verified." << std::endl;
+            std::cout << "Local ledger chain verified (" << local_ledger.last_verified() << " of "
+                      << local_ledger.size() << " entries hashed"
+                      << (options.full_ledger ? ", full re-verify" : " since the last checkpoint") << ")." << std::endl;
         }
         
+        if (options.single_chunk) {
+            if (verify_single_chunk(*view, options.chunk_index)) {
+                std::cout << "Merkle Root Verified: MATCH (chunk " << options.chunk_index << ")" << std::endl;
+            } else {
+                std::cerr << "Merkle Root Verification FAILED for chunk " << options.chunk_index << std::endl;
+            }
+            return;
+        }
+
+        if (options.sample) {
+            // Every sampled hash is only as good as the hash list it came from;
+            // shards are checked against their roots as the sampler loads them
+            if (!manifest.sharded()) {
+                std::vector<std::string> hashes;
+                for (const auto* chunk : manifest.ordered_chunks()) hashes.push_back(chunk->hash);
+                if (merkle_root_of(manifest, hashes) != manifest.merkle_root) {
+                    std::cerr << "Merkle Root Verification FAILED: manifest chunk hashes do not match the root" << std::endl;
+                    return;
+                }
+                std::cout << "Manifest chunk hashes match the Merkle root." << std::endl;
+            }
+
+            pipeline::SampledVerifier sampler(options.sampling);
+            auto report = sampler.run(manifest);
+            const auto& plan = report.plan;
+            std::cout << "Sampled " << report.sampled.size() << " of " << plan.chunk_count
+                      << " chunks (seed " << report.seed << ")" << std::endl;
+            if (report.failed.empty()) {
+                std::cout << "Sample Verified: no corruption found. Detection probability "
+                          << std::fixed << std::setprecision(4) << plan.confidence * 100.0 << "% if "
+                          << plan.corrupt_chunks << " or more chunks (" << options.sampling.corruption * 100.0
+                          << "%) were corrupt or missing" << std::endl;
+            } else {
+                std::cerr << "Sample Verification FAILED: " << report.failed.size() << " of "
+                          << report.sampled.size() << " sampled chunks are corrupt or missing" << std::endl;
+            }
+            return;
+        }
+
         // Check if root exists in ledger
         // (Simple check: is it the latest? or just present?)
         // For now, just print.
@@ -198,44 +533,80 @@ void Commands::verify(const std::string& manifest_path) {
         // Let's verify ALL for this implementation to be safe.
         
         storage::Downloader downloader;
-        std::vector<std::string> recomputed_hashes;
         bool all_valid = true;
 
-        for (const auto& chunk : manifest.chunks) {
-            std::cout << "Verifying chunk " << chunk.id << "... ";
-            
-            // Download
-            auto blob = downloader.download(chunk.uri);
-            
-            // Hash
-            // We need to compute the hash of the blob to compare with manifest hash.
-            // Since we used a placeholder in backup, we can't verify strictly unless we fix backup.
-            // But let's assume we compute it here.
-            // std::string computed_hash = ...
-            
-            // For now, just check if download was successful (blob not empty).
-            if (blob.empty()) {
-                std::cout << "FAILED (Empty download)" << std::endl;
-                all_valid = false;
-                continue;
+        // Fetches and hashes each chunk listed by `owner`; returns the hashes that matched
+        auto check_chunks = [&](const ledger::Manifest& owner) {
+            std::vector<std::string> recomputed_hashes;
+            for (const auto* chunk_ptr : owner.ordered_chunks()) {
+                const auto& chunk = *chunk_ptr;
+                std::cout << "Verifying chunk " << chunk.id << "... ";
+
+                // Download (a byte range when the chunk lives in a pack)
+                std::vector<uint8_t> blob;
+                try {
+                    if (chunk.pack.empty()) {
+                        blob = downloader.download(chunk.uri);
+                    } else {
+                        blob = downloader.download_range(owner.object_uri(chunk), chunk.pack_offset, chunk.pack_length);
+                    }
+                } catch (const std::exception& e) {
+                    std::cout << "FAILED (" << e.what() << ")" << std::endl;
+                    all_valid = false;
+                    continue;
+                }
+
+                if (blob.empty()) {
+                    std::cout << "FAILED (Empty download)" << std::endl;
+                    all_valid = false;
+                    continue;
+                }
+
+                // Hash of the blob (IV + Cipher + Tag) must match the manifest entry
+                std::string computed_hash = utils::HashUtils::sha256_hex(blob);
+                if (computed_hash != chunk.hash) {
+                    std::cout << "FAILED (Hash mismatch)" << std::endl;
+                    all_valid = false;
+                    continue;
+                }
+                recomputed_hashes.push_back(computed_hash);
+
+                std::cout << "OK" << std::endl;
             }
+            return recomputed_hashes;
+        };
 
-            // In a real impl, we would re-hash blob and compare with chunk.hash.
-            // recomputed_hashes.push_back(computed_hash);
-            // For now, push the manifest hash to simulate success if download worked.
-            recomputed_hashes.push_back(chunk.hash);
-            
-            std::cout << "OK" << std::endl;
+        // 4. Recompute Merkle Root. Shards are loaded a batch at a time, in
+        // parallel, and each is dropped once its chunks are checked.
+        std::string computed_root;
+        if (manifest.sharded()) {
+            pipeline::ShardLoader loader(manifest, options.sampling.download_threads);
+            std::vector<merkle::Digest> shard_roots;
+            size_t batch = std::max<size_t>(1, options.sampling.download_threads);
+            for (size_t first = 0; first < loader.shard_count(); first += batch) {
+                std::vector<size_t> indexes;
+                for (size_t i = first; i < std::min(first + batch, loader.shard_count()); i++) indexes.push_back(i);
+                for (const auto& shard : loader.load(indexes)) {
+                    auto hashes = check_chunks(*shard);
+                    if (all_valid) {
+                        shard_roots.push_back(merkle::MerkleTree::compute_subtree_root(leaf_digests(hashes),
+                                                                                       manifest.shard_height()));
+                    }
+                }
+            }
+            if (all_valid) {
+                computed_root = utils::HashUtils::to_hex(merkle::MerkleTree::compute_root_from_nodes(shard_roots));
+            }
+        } else {
+            auto hashes = check_chunks(manifest);
+            if (all_valid) computed_root = merkle_root_of(manifest, hashes);
         }
 
         if (!all_valid) {
-            std::cerr << "Verification failed: Some chunks could not be retrieved." << std::endl;
+            std::cerr << "Verification failed: Some chunks could not be retrieved or did not match." << std::endl;
             return;
         }
 
-        // 4. Recompute Merkle Root
-        std::string computed_root = merkle::MerkleTree::compute_root(recomputed_hashes);
-        
         if (computed_root == manifest.merkle_root) {
             std::cout << "Merkle Root Verified: MATCH" << std::endl;
         } else {
@@ -248,10 +619,181 @@ void Commands::verify(const std::string& manifest_path) {
     }
 }
 
+void Commands::restore(const std::string& manifest_path, const std::string& output_path, const pipeline::RestoreOptions& options) {
+    std::cout << "Starting restore from manifest: " << manifest_path << std::endl;
+
+    try {
+        ledger::Manifest manifest = load_manifest(manifest_path);
+        std::cout << "Restoring file: " << manifest.file_name << " (" << manifest.original_size << " bytes, "
+                  << manifest.leaf_count() << " chunks";
+        if (manifest.sharded()) std::cout << " in " << manifest.shards.size() << " shards";
+        if (manifest.tree) std::cout << ", " << manifest.files.size() << " entries";
+        std::cout << ")" << std::endl;
+
+        crypto::OperationKeys keys;
+        obtain_keys(crypto::KeyScope::Restore, keys);
+        pipeline::RestorePipeline restore_pipeline(keys.data, options);
+        restore_pipeline.run(manifest, output_path);
+
+        std::cout << "Restore Success! Written to: " << output_path << std::endl;
+
+    } catch (const std::exception& e) {
+        std::cerr << "Error during restore: " << e.what() << std::endl;
+    }
+}
+
+void Commands::agent(const std::string& action, const agent::AgentOptions& options) {
+    try {
+        uint32_t seconds_left = 0;
+        if (action == "status") {
+            if (agent::agent_status(options.socket_path, seconds_left)) {
+                std::cout << "Key agent on " << options.socket_path << " expires in " << seconds_left << "s" << std::endl;
+            } else {
+                std::cout << "No key agent on " << options.socket_path << std::endl;
+            }
+        } else if (action == "stop") {
+            if (agent::stop_agent(options.socket_path)) {
+                std::cout << "Key agent stopped; its key is wiped." << std::endl;
+            } else {
+                std::cout << "No key agent on " << options.socket_path << std::endl;
+            }
+        } else if (action == "start") {
+            if (agent::agent_status(options.socket_path, seconds_left)) {
+                std::cerr << "A key agent is already running on " << options.socket_path << std::endl;
+                return;
+            }
+            // A mistyped passphrase would otherwise be used for every backup until the TTL
+            auto master_key = derive_master_key(true);
+            agent::KeyAgent key_agent(master_key, options);
+            OPENSSL_cleanse(master_key.data(), master_key.size());
+            std::cout << "Key agent listening on " << options.socket_path << " for " << options.ttl_seconds << "s" << std::endl;
+            if (!key_agent.serve()) {
+                std::cout << "Key agent stopped; its key is wiped." << std::endl;
+            }
+        } else {
+            std::cerr << "Unknown agent action: " << action << std::endl;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error in key agent: " << e.what() << std::endl;
+    }
+}
+
+void Commands::convert_manifest(const std::string& input_path, const std::string& output_path, const std::string& format) {
+    try {
+        auto data = read_manifest_bytes(input_path);
+        bool binary_in = ledger::BinaryManifest::detect(data.data(), data.size());
+        ledger::Manifest manifest = binary_in ? ledger::BinaryManifest(std::move(data)).to_manifest()
+                                              : ledger::Manifest::from_json(json::parse(data.begin(), data.end()));
+        bool binary_out = format.empty() ? !binary_in : format == "binary";
+        if (binary_out) {
+            utils::FileUtils::write_file(output_path, ledger::BinaryManifest::encode(manifest));
+        } else {
+            utils::FileUtils::write_file(output_path, manifest.to_json().dump());
+        }
+        std::cout << "Wrote " << (binary_out ? "binary" : "JSON") << " manifest (" << manifest.leaf_count()
+                  << " chunks, " << utils::FileUtils::get_file_size(output_path) << " bytes) to " << output_path << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "Error converting manifest: " << e.what() << std::endl;
+    }
+}
+
+void Commands::export_ledger(const LedgerQuery& query) {
+    try {
+        ledger::Ledger local_ledger(kLedgerPath);
+        std::vector<ledger::CatalogEntry> found;
+        if (!query.file_name.empty()) {
+            ledger::CatalogEntry latest;
+            if (local_ledger.find_latest(query.file_name, latest)) {
+                found.push_back(latest);
+            }
+        } else if (!query.merkle_root.empty()) {
+            found = local_ledger.find_by_root(query.merkle_root);
+        } else if (!query.from_ts.empty() || !query.to_ts.empty()) {
+            // A bare date as the upper bound covers that whole day
+            std::string to_ts = query.to_ts.empty() ? "~" : query.to_ts;
+            if (to_ts.size() == 10) to_ts += "T23:59:59Z";
+            found = local_ledger.find_between(query.from_ts, to_ts);
+        } else {
+            std::cout << local_ledger.export_json().dump(4) << std::endl;
+            return;
+        }
+
+        json entries = json::array();
+        for (const auto& entry : found) {
+            entries.push_back({{"seq", entry.seq},
+                               {"ts", entry.ts},
+                               {"file_name", entry.file_name},
+                               {"merkle_root", entry.merkle_root},
+                               {"entry_hash", entry.entry_hash},
+                               {"manifest_url", entry.manifest_url}});
+        }
+        std::cout << entries.dump(4) << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "Error reading ledger: " << e.what() << std::endl;
+    }
+}
+
 void Commands::help() {
     std::cout << "Usage:" << std::endl;
-    std::cout << "  secure_backup_cli backup <file> [chunk_size_mb]" << std::endl;
-    std::cout << "  secure_backup_cli verify <manifest_path_or_url>" << std::endl;
+    std::cout << "  secure_backup_cli backup <file_or_directory> [chunk_size_mb] [options]" << std::endl;
+    std::cout << "  secure_backup_cli verify <manifest_path_or_url> [options]" << std::endl;
+    std::cout << "  secure_backup_cli restore <manifest_path_or_url> <output_file_or_directory> [options]" << std::endl;
+    std::cout << "  secure_backup_cli manifest <input> <output> [--format json|binary]  Convert a manifest (default: to the other format)" << std::endl;
+    std::cout << "  secure_backup_cli agent <start|stop|status> [options]  Cache the key for later commands" << std::endl;
+    std::cout << "  secure_backup_cli ledger [options]        Print the local ledger, or the entries matching a query, as JSON" << std::endl;
+    std::cout << std::endl;
+    std::cout << "Backup options:" << std::endl;
+    std::cout << "  --storage <url>      http(s)://host:port, file:///dir (or a path) or mem://name (default: http://localhost:3000)" << std::endl;
+    std::cout << "  --threads <n>        Encrypt/hash worker threads (default: all cores)" << std::endl;
+    std::cout << "  --uploaders <n>      Concurrent uploads (default: 4)" << std::endl;
+    std::cout << "  --incremental <on|off>  Reuse what is unchanged since the last backup in the ledger (default: off)" << std::endl;
+    std::cout << "  --readers <n>        Directories listed and files read concurrently (default: 4)" << std::endl;
+    std::cout << "  --max-memory <mb>    Cap on chunk data held in flight (default: 256)" << std::endl;
+    std::cout << "  --chunking <mode>    fixed (default) or cdc (content-defined, avg = chunk_size_mb)" << std::endl;
+    std::cout << "  --cdc-min <kb>       Minimum content-defined chunk size (default: avg / 4)" << std::endl;
+    std::cout << "  --cdc-max <kb>       Maximum content-defined chunk size (default: avg * 4)" << std::endl;
+    std::cout << "  --mmap <on|off>      Read through a memory mapping instead of copies (default: off)" << std::endl;
+    std::cout << "  --stream-uploads <on|off>  Encrypt while uploading, no whole-chunk buffers (default: off)" << std::endl;
+    std::cout << "  --dedup <on|off>     Skip chunks already uploaded, via data/dedup (default: on; not for mem://)" << std::endl;
+    std::cout << "  --compress <codec>   Compress chunks before encryption: zstd, lz4 or off (default: off)" << std::endl;
+    std::cout << "  --compress-level <n> Codec level (default: the codec's own; lz4 levels above 1 use LZ4HC)" << std::endl;
+    std::cout << "  --cipher <suite>     aes-256-gcm, chacha20-poly1305, auto (by CPU features) or bench (time both) (default: auto)" << std::endl;
+    std::cout << "  --shard-chunks <n>   Split manifests of files with more chunks into shards of n (power of two; default: 65536, 0 = off)" << std::endl;
+    std::cout << "  --pack-size <mb>     Batch chunks up to a quarter of this size into pack objects (default: 16, 0 = off)" << std::endl;
+    std::cout << std::endl;
+    std::cout << "Verify options:" << std::endl;
+    std::cout << "  --chunk <index>      Check only this chunk, with an inclusion proof from the stored tree" << std::endl;
+    std::cout << "  --sample <p>         Check a random sample that detects the corruption below with probability p" << std::endl;
+    std::cout << "  --corruption <f>     Fraction of corrupt chunks the sample must catch (default: 0.01)" << std::endl;
+    std::cout << "  --seed <hex>         64 hex chars; repeats an earlier sample (default: random)" << std::endl;
+    std::cout << "  --downloads <n>      Concurrent downloads while sampling (default: 8)" << std::endl;
+    std::cout << "  --ledger <mode>      incremental (default: from the last checkpoint) or full (from genesis)" << std::endl;
+    std::cout << std::endl;
+    std::cout << "Ledger options:" << std::endl;
+    std::cout << "  --file <name>        Latest backup of this file or directory" << std::endl;
+    std::cout << "  --root <hex>         Snapshots with this Merkle root" << std::endl;
+    std::cout << "  --from <ts>          Snapshots at or after this ISO 8601 UTC time (or date)" << std::endl;
+    std::cout << "  --to <ts>            Snapshots at or before this time (or through this date)" << std::endl;
+    std::cout << std::endl;
+    std::cout << "Restore options:" << std::endl;
+    std::cout << "  --downloads <n>      Concurrent downloads (default: 8)" << std::endl;
+    std::cout << "  --threads <n>        Decrypt worker threads (default: all cores)" << std::endl;
+    std::cout << "  --max-memory <mb>    Cap on chunk data held in flight (default: 256)" << std::endl;
+    std::cout << std::endl;
+    std::cout << "Agent options:" << std::endl;
+    std::cout << "  --ttl <minutes>      Wipe the key and exit after this long (default: 60)" << std::endl;
+    std::cout << "  --foreground <on|off>  Stay attached instead of detaching (default: off)" << std::endl;
+    std::cout << "  --socket <path>      Agent socket (default: $SECURE_BACKUP_AGENT_SOCK, else under $XDG_RUNTIME_DIR or /tmp)" << std::endl;
+    std::cout << std::endl;
+    std::cout << "Transport options (all commands):" << std::endl;
+    std::cout << "  --http2 <on|off>     Negotiate HTTP/2 and multiplex transfers (default: off)" << std::endl;
+    std::cout << "  --connections <n>    Max connections per host (default: unlimited)" << std::endl;
+    std::cout << "  --transport-threads <n>  Threads driving transfers (default: 1)" << std::endl;
+    std::cout << std::endl;
+    std::cout << "Statistics options (all commands):" << std::endl;
+    std::cout << "  --stats <format>     Per-stage bytes, time and latency percentiles as json or prometheus (default: off)" << std::endl;
+    std::cout << "  --stats-file <path>  Write them to this file, replaced on each report (default: stderr)" << std::endl;
+    std::cout << "  --stats-interval <s> Also report every s seconds while running (default: 0, at the end only)" << std::endl;
 }
 
 } // namespace cli
@@ -1,14 +1,58 @@
 #pragma once
 
+#include "../agent/key_agent.h"
+#include "../pipeline/backup_pipeline.h"
+#include "../pipeline/restore_pipeline.h"
+#include "../pipeline/sampled_verifier.h"
 #include <string>
 #include <vector>
 
 namespace cli {
 
+struct BackupOptions {
+    pipeline::PipelineOptions pipeline;
+    // Reuse whatever is unchanged since the last ledger entry for the same name
+    bool incremental = false;
+    // Files with more chunks get a manifest of shards this many chunks long
+    // (a power of two; 0 keeps every manifest flat)
+    uint64_t shard_chunks = 65536;
+    // Where chunks and manifests are stored (see storage::open_backend)
+    std::string storage_url = "http://localhost:3000";
+};
+
+struct VerifyOptions {
+    // Check one chunk with an inclusion proof instead of the whole backup
+    bool single_chunk = false;
+    size_t chunk_index = 0;   // Merkle leaf order
+    // Check a random sample sized by `sampling` instead of every chunk
+    bool sample = false;
+    pipeline::SampleOptions sampling;
+    // Re-hash the whole ledger instead of resuming from its checkpoint
+    bool full_ledger = false;
+};
+
+// Selects ledger entries; empty fields are unset. The first set of
+// file_name, merkle_root and the time range is used.
+struct LedgerQuery {
+    std::string file_name;
+    std::string merkle_root;
+    std::string from_ts;
+    std::string to_ts;
+};
+
 class Commands {
 public:
-    static void backup(const std::string& file_path, size_t chunk_size);
-    static void verify(const std::string& manifest_path);
+    static void backup(const std::string& file_path, const BackupOptions& options);
+    static void verify(const std::string& manifest_path, const VerifyOptions& options);
+    static void restore(const std::string& manifest_path, const std::string& output_path, const pipeline::RestoreOptions& options);
+    // Rewrites a JSON manifest as binary or vice versa; `format` ("json" or
+    // "binary") forces the output format
+    static void convert_manifest(const std::string& input_path, const std::string& output_path, const std::string& format);
+    // Starts a key agent (prompting for the passphrase), stops it, or reports
+    // its status. Backup and restore use a running agent instead of prompting.
+    static void agent(const std::string& action, const agent::AgentOptions& options);
+    // Prints every ledger entry, or the catalog rows matching `query`, as a JSON array
+    static void export_ledger(const LedgerQuery& query = LedgerQuery());
     static void help();
 };
 
@@ -0,0 +1,199 @@
+#include "codec.h"
+#include "../metrics/metrics.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#ifdef SECURE_BACKUP_HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef SECURE_BACKUP_HAVE_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
+
+namespace compress {
+
+namespace {
+
+// Entropy probe: up to kProbeWindows windows of kProbeWindow bytes
+const size_t kProbeWindow = 4096;
+const size_t kProbeWindows = 8;
+// Smaller chunks are not worth a codec frame
+const size_t kMinInput = 64;
+
+void require_available(Codec codec) {
+    if (!codec_available(codec)) {
+        throw std::runtime_error(std::string("This build has no ") + codec_name(codec) + " support");
+    }
+}
+
+} // namespace
+
+const char* codec_name(Codec codec) {
+    switch (codec) {
+    case Codec::None: return "none";
+    case Codec::Zstd: return "zstd";
+    case Codec::Lz4: return "lz4";
+    }
+    return "unknown";
+}
+
+Codec codec_from_name(const std::string& name) {
+    if (name == "none") return Codec::None;
+    if (name == "zstd") return Codec::Zstd;
+    if (name == "lz4") return Codec::Lz4;
+    throw std::runtime_error("Unknown compression codec: " + name);
+}
+
+Codec codec_from_id(uint32_t id) {
+    if (id > static_cast<uint32_t>(Codec::Lz4)) {
+        throw std::runtime_error("Unknown compression codec id " + std::to_string(id));
+    }
+    return static_cast<Codec>(id);
+}
+
+bool codec_available(Codec codec) {
+    switch (codec) {
+    case Codec::None: return true;
+#ifdef SECURE_BACKUP_HAVE_ZSTD
+    case Codec::Zstd: return true;
+#endif
+#ifdef SECURE_BACKUP_HAVE_LZ4
+    case Codec::Lz4: return true;
+#endif
+    default: return false;
+    }
+}
+
+double sample_entropy(const uint8_t* data, size_t len) {
+    if (len == 0) return 0.0;
+    uint64_t counts[256] = {};
+    uint64_t total = 0;
+    auto count = [&](const uint8_t* p, size_t n) {
+        for (size_t i = 0; i < n; i++) counts[p[i]]++;
+        total += n;
+    };
+    if (len <= kProbeWindow * kProbeWindows) {
+        count(data, len);
+    } else {
+        // Evenly spaced windows, the last one ending at the end of the data
+        size_t stride = (len - kProbeWindow) / (kProbeWindows - 1);
+        for (size_t w = 0; w < kProbeWindows; w++) count(data + w * stride, kProbeWindow);
+    }
+
+    double entropy = 0.0;
+    for (uint64_t c : counts) {
+        if (c == 0) continue;
+        double p = static_cast<double>(c) / total;
+        entropy -= p * std::log2(p);
+    }
+    return entropy;
+}
+
+Compressor::Compressor(const CompressionParams& params) : params_(params) {
+    require_available(params_.codec);
+#ifdef SECURE_BACKUP_HAVE_ZSTD
+    if (params_.codec == Codec::Zstd) {
+        ctx_ = ZSTD_createCCtx();
+        if (!ctx_) throw std::runtime_error("Failed to create zstd context");
+    }
+#endif
+}
+
+Compressor::~Compressor() {
+#ifdef SECURE_BACKUP_HAVE_ZSTD
+    if (params_.codec == Codec::Zstd) ZSTD_freeCCtx(static_cast<ZSTD_CCtx*>(ctx_));
+#endif
+}
+
+Codec Compressor::compress(const uint8_t* data, size_t len, std::vector<uint8_t>& out) {
+    if (params_.codec == Codec::None || len < kMinInput) return Codec::None;
+    metrics::ScopedTimer timer(metrics::Stage::Compress, len);
+    if (sample_entropy(data, len) > params_.max_entropy) return Codec::None;
+
+    // Anything that doesn't save at least 1/16 is stored as is; the codecs
+    // give up as soon as their output outgrows this
+    size_t limit = len - len / 16;
+    if (out.size() < limit) out.resize(limit);
+    size_t written = 0;
+    switch (params_.codec) {
+#ifdef SECURE_BACKUP_HAVE_ZSTD
+    case Codec::Zstd: {
+        int level = params_.level ? params_.level : ZSTD_CLEVEL_DEFAULT;
+        size_t n = ZSTD_compressCCtx(static_cast<ZSTD_CCtx*>(ctx_), out.data(), limit, data, len, level);
+        if (!ZSTD_isError(n)) written = n;
+        break;
+    }
+#endif
+#ifdef SECURE_BACKUP_HAVE_LZ4
+    case Codec::Lz4: {
+        if (len > static_cast<size_t>(LZ4_MAX_INPUT_SIZE)) return Codec::None;
+        const char* src = reinterpret_cast<const char*>(data);
+        char* dst = reinterpret_cast<char*>(out.data());
+        int n = params_.level > 1 ? LZ4_compress_HC(src, dst, static_cast<int>(len), static_cast<int>(limit), params_.level)
+                                  : LZ4_compress_default(src, dst, static_cast<int>(len), static_cast<int>(limit));
+        if (n > 0) written = static_cast<size_t>(n);
+        break;
+    }
+#endif
+    default:
+        return Codec::None;
+    }
+    if (written == 0) return Codec::None;
+    out.resize(written);
+    return params_.codec;
+}
+
+Decompressor::Decompressor() {
+}
+
+Decompressor::~Decompressor() {
+#ifdef SECURE_BACKUP_HAVE_ZSTD
+    ZSTD_freeDCtx(static_cast<ZSTD_DCtx*>(ctx_));
+#endif
+}
+
+void Decompressor::decompress(Codec codec, const uint8_t* data, size_t len, size_t original_size, std::vector<uint8_t>& out) {
+    metrics::ScopedTimer timer(metrics::Stage::Decompress, original_size);
+    require_available(codec);
+    out.resize(original_size);
+    size_t written = 0;
+    bool ok = false;
+    switch (codec) {
+    case Codec::None:
+        ok = len == original_size;
+        if (ok) std::copy(data, data + len, out.begin());
+        written = len;
+        break;
+#ifdef SECURE_BACKUP_HAVE_ZSTD
+    case Codec::Zstd: {
+        if (!ctx_) {
+            ctx_ = ZSTD_createDCtx();
+            if (!ctx_) throw std::runtime_error("Failed to create zstd context");
+        }
+        size_t n = ZSTD_decompressDCtx(static_cast<ZSTD_DCtx*>(ctx_), out.data(), original_size, data, len);
+        ok = !ZSTD_isError(n);
+        written = ok ? n : 0;
+        break;
+    }
+#endif
+#ifdef SECURE_BACKUP_HAVE_LZ4
+    case Codec::Lz4: {
+        if (len > static_cast<size_t>(LZ4_MAX_INPUT_SIZE) || original_size > static_cast<size_t>(LZ4_MAX_INPUT_SIZE)) break;
+        int n = LZ4_decompress_safe(reinterpret_cast<const char*>(data), reinterpret_cast<char*>(out.data()),
+                                    static_cast<int>(len), static_cast<int>(original_size));
+        ok = n >= 0;
+        written = ok ? static_cast<size_t>(n) : 0;
+        break;
+    }
+#endif
+    default:
+        break;
+    }
+    if (!ok || written != original_size) {
+        throw std::runtime_error(std::string("Data does not ") + codec_name(codec) + "-decode to " +
+                                 std::to_string(original_size) + " bytes");
+    }
+}
+
+} // namespace compress
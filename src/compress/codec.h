@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace compress {
+
+// Applied to a chunk's plaintext before it is sealed. The ids are stored in
+// binary manifests and the dedup index, so they never change.
+enum class Codec : uint8_t {
+    None = 0,
+    Zstd = 1,
+    Lz4 = 2
+};
+
+// "none", "zstd" or "lz4"
+const char* codec_name(Codec codec);
+// Throws on unknown names
+Codec codec_from_name(const std::string& name);
+// Throws on unknown ids
+Codec codec_from_id(uint32_t id);
+// False for codecs this build was compiled without
+bool codec_available(Codec codec);
+
+struct CompressionParams {
+    Codec codec = Codec::None;
+    int level = 0;              // codec default when 0; lz4 levels above 1 use LZ4HC
+    double max_entropy = 7.5;   // bits per byte; chunks that sample above it are stored as is
+};
+
+// Shannon entropy in bits per byte of a few windows spread across `data`.
+// Compressed media, archives and ciphertext sample at nearly 8.
+double sample_entropy(const uint8_t* data, size_t len);
+
+// Holds a codec context that is reused across calls, so a Compressor must
+// not be shared between threads; create one per worker instead.
+class Compressor {
+public:
+    explicit Compressor(const CompressionParams& params);
+    ~Compressor();
+
+    Compressor(const Compressor&) = delete;
+    Compressor& operator=(const Compressor&) = delete;
+
+    // Compresses into `out` and returns the codec used. Returns Codec::None,
+    // leaving `out` unspecified, when the entropy probe rejects the data or
+    // the output would not be meaningfully smaller.
+    Codec compress(const uint8_t* data, size_t len, std::vector<uint8_t>& out);
+
+private:
+    CompressionParams params_;
+    void* ctx_ = nullptr;
+};
+
+// Same threading rule as Compressor
+class Decompressor {
+public:
+    Decompressor();
+    ~Decompressor();
+
+    Decompressor(const Decompressor&) = delete;
+    Decompressor& operator=(const Decompressor&) = delete;
+
+    // Inflates into `out`, which ends up exactly `original_size` bytes long;
+    // throws if the data does not decode to that size
+    void decompress(Codec codec, const uint8_t* data, size_t len, size_t original_size, std::vector<uint8_t>& out);
+
+private:
+    void* ctx_ = nullptr;
+};
+
+} // namespace compress
@@ -0,0 +1,99 @@
+#include "cipher_suite.h"
+#include "encryptor.h"
+#include <openssl/crypto.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+#if defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+namespace crypto {
+
+namespace {
+
+// Benchmark: best of kRounds seals of a kBenchBytes buffer per suite
+const size_t kBenchBytes = 1 << 20;
+const int kRounds = 4;
+
+double seal_rate(CipherSuite suite, const std::vector<uint8_t>& input, std::vector<uint8_t>& output) {
+    std::array<uint8_t, 32> key{};
+    Encryptor encryptor(key, suite);
+    double best = 0.0;
+    for (int r = 0; r < kRounds; r++) {
+        auto start = std::chrono::steady_clock::now();
+        encryptor.encrypt_into(input.data(), input.size(), output);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        if (elapsed.count() > 0) best = std::max(best, input.size() / elapsed.count());
+    }
+    return best;
+}
+
+std::string rate_text(double bytes_per_second) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.2f GB/s", bytes_per_second / 1e9);
+    return buf;
+}
+
+} // namespace
+
+const char* suite_name(CipherSuite suite) {
+    switch (suite) {
+    case CipherSuite::Aes256Gcm: return "aes-256-gcm";
+    case CipherSuite::ChaCha20Poly1305: return "chacha20-poly1305";
+    }
+    return "unknown";
+}
+
+CipherSuite suite_from_name(const std::string& name) {
+    if (name == "aes-256-gcm") return CipherSuite::Aes256Gcm;
+    if (name == "chacha20-poly1305") return CipherSuite::ChaCha20Poly1305;
+    throw std::runtime_error("Unknown cipher suite: " + name);
+}
+
+CipherSuite suite_from_id(uint32_t id) {
+    if (id > static_cast<uint32_t>(CipherSuite::ChaCha20Poly1305)) {
+        throw std::runtime_error("Unknown cipher suite id " + std::to_string(id));
+    }
+    return static_cast<CipherSuite>(id);
+}
+
+CipherSuite detect_suite(std::string& reason) {
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+    if (__builtin_cpu_supports("aes") && __builtin_cpu_supports("pclmul")) {
+        reason = "CPU has AES-NI and PCLMULQDQ";
+        return CipherSuite::Aes256Gcm;
+    }
+    reason = "CPU lacks AES-NI or PCLMULQDQ";
+    return CipherSuite::ChaCha20Poly1305;
+#elif defined(__aarch64__) && defined(__linux__)
+    unsigned long hwcap = getauxval(AT_HWCAP);
+    if ((hwcap & HWCAP_AES) && (hwcap & HWCAP_PMULL)) {
+        reason = "CPU has the ARMv8 AES and PMULL instructions";
+        return CipherSuite::Aes256Gcm;
+    }
+    reason = "CPU lacks the ARMv8 AES or PMULL instructions";
+    return CipherSuite::ChaCha20Poly1305;
+#elif defined(__aarch64__) && defined(__APPLE__)
+    reason = "Apple silicon has the ARMv8 crypto extensions";
+    return CipherSuite::Aes256Gcm;
+#else
+    return benchmark_suite(reason);
+#endif
+}
+
+CipherSuite benchmark_suite(std::string& reason) {
+    std::vector<uint8_t> input(kBenchBytes, 0x5a);
+    std::vector<uint8_t> output;
+    double aes = seal_rate(CipherSuite::Aes256Gcm, input, output);
+    double chacha = seal_rate(CipherSuite::ChaCha20Poly1305, input, output);
+    OPENSSL_cleanse(output.data(), output.size());
+    reason = std::string("benchmark: aes-256-gcm ") + rate_text(aes) + ", chacha20-poly1305 " + rate_text(chacha);
+    return aes >= chacha ? CipherSuite::Aes256Gcm : CipherSuite::ChaCha20Poly1305;
+}
+
+} // namespace crypto
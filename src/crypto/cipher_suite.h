@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace crypto {
+
+// AEAD used to seal chunks. Both take a 32-byte key and a 12-byte IV and
+// produce a 16-byte tag, so sealed blobs have the same layout under either.
+// The ids are stored in manifests and the dedup index, where a zero (every
+// record written before suites were selectable) means AES-256-GCM.
+enum class CipherSuite : uint8_t {
+    Aes256Gcm = 0,
+    ChaCha20Poly1305 = 1
+};
+
+// "aes-256-gcm" or "chacha20-poly1305"
+const char* suite_name(CipherSuite suite);
+// Throws on unknown names
+CipherSuite suite_from_name(const std::string& name);
+// Throws on unknown ids
+CipherSuite suite_from_id(uint32_t id);
+
+// AES-256-GCM where the CPU has AES and carry-less multiply instructions,
+// ChaCha20-Poly1305 where it lacks them. Falls back to benchmark_suite()
+// where the features can't be queried. Sets `reason` to a short explanation.
+CipherSuite detect_suite(std::string& reason);
+
+// Seals a 1 MB buffer a few times with each suite and returns the faster one
+CipherSuite benchmark_suite(std::string& reason);
+
+} // namespace crypto
@@ -1,111 +1,191 @@
 #include "encryptor.h"
+#include "../metrics/metrics.h"
 #include <openssl/evp.h>
 #include <openssl/rand.h>
 #include <openssl/err.h>
 #include <stdexcept>
+#include <algorithm>
 #include <cstring>
 
 namespace crypto {
 
-Encryptor::Encryptor(const std::array<uint8_t, 32>& key) : key_(key) {}
+namespace {
+
+// EVP update calls take an int length; feed larger buffers in slices
+const size_t kMaxUpdate = 1u << 30;
+
+const EVP_CIPHER* evp_cipher(CipherSuite suite) {
+    switch (suite) {
+    case CipherSuite::Aes256Gcm: return EVP_aes_256_gcm();
+    case CipherSuite::ChaCha20Poly1305: return EVP_chacha20_poly1305();
+    }
+    throw std::invalid_argument("Unknown cipher suite");
+}
+
+} // namespace
+
+Encryptor::Encryptor(const std::array<uint8_t, 32>& key, CipherSuite suite)
+    : key_(key), suite_(suite), enc_ctx_(nullptr), dec_ctx_(nullptr) {
+    const EVP_CIPHER* cipher = evp_cipher(suite_);
+    enc_ctx_ = EVP_CIPHER_CTX_new();
+    dec_ctx_ = EVP_CIPHER_CTX_new();
+    if (!enc_ctx_ || !dec_ctx_) {
+        EVP_CIPHER_CTX_free(enc_ctx_);
+        EVP_CIPHER_CTX_free(dec_ctx_);
+        throw std::runtime_error("Failed to create cipher context");
+    }
+
+    // Key schedule is set up once; each call only installs a fresh IV
+    bool ok = EVP_EncryptInit_ex(enc_ctx_, cipher, NULL, NULL, NULL) == 1 &&
+              EVP_CIPHER_CTX_ctrl(enc_ctx_, EVP_CTRL_AEAD_SET_IVLEN, static_cast<int>(kIvSize), NULL) == 1 &&
+              EVP_EncryptInit_ex(enc_ctx_, NULL, NULL, key_.data(), NULL) == 1 &&
+              EVP_DecryptInit_ex(dec_ctx_, cipher, NULL, NULL, NULL) == 1 &&
+              EVP_CIPHER_CTX_ctrl(dec_ctx_, EVP_CTRL_AEAD_SET_IVLEN, static_cast<int>(kIvSize), NULL) == 1 &&
+              EVP_DecryptInit_ex(dec_ctx_, NULL, NULL, key_.data(), NULL) == 1;
+    if (!ok) {
+        EVP_CIPHER_CTX_free(enc_ctx_);
+        EVP_CIPHER_CTX_free(dec_ctx_);
+        throw std::runtime_error("Cipher init failed");
+    }
+}
 
 Encryptor::~Encryptor() {
+    EVP_CIPHER_CTX_free(enc_ctx_);
+    EVP_CIPHER_CTX_free(dec_ctx_);
     OPENSSL_cleanse(key_.data(), key_.size());
 }
 
-CipherResult Encryptor::encrypt(const uint8_t* plaintext, size_t len) {
-    CipherResult res;
-    
-    // Generate random IV
-    if (RAND_bytes(res.iv.data(), res.iv.size()) != 1) {
+size_t Encryptor::seal(const uint8_t* plaintext, size_t len, const uint8_t* iv, uint8_t* ciphertext, uint8_t* tag) {
+    if (1 != EVP_EncryptInit_ex(enc_ctx_, NULL, NULL, NULL, iv))
+        throw std::runtime_error("EncryptInit iv failed");
+    encrypt_update(plaintext, len, ciphertext);
+    encrypt_final(tag);
+    return len;
+}
+
+size_t Encryptor::open(const uint8_t* ciphertext, size_t len, const uint8_t* iv, const uint8_t* tag, uint8_t* plaintext) {
+    decrypt_init(iv);
+    decrypt_update(ciphertext, len, plaintext);
+    decrypt_final(tag);
+    return len;
+}
+
+void Encryptor::encrypt_init(uint8_t* iv_out) {
+    if (RAND_bytes(iv_out, static_cast<int>(kIvSize)) != 1) {
         throw std::runtime_error("Failed to generate random IV");
     }
+    if (1 != EVP_EncryptInit_ex(enc_ctx_, NULL, NULL, NULL, iv_out))
+        throw std::runtime_error("EncryptInit iv failed");
+}
 
-    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
-    if (!ctx) throw std::runtime_error("Failed to create cipher context");
-
+void Encryptor::encrypt_update(const uint8_t* in, size_t len, uint8_t* out) {
+    metrics::ScopedTimer timer(metrics::Stage::Encrypt, len);
     int outlen;
-    int ciphertext_len = 0;
-    
-    // Reserve space for ciphertext (input length + block size is safe upper bound)
-    res.ciphertext.resize(len + EVP_MAX_BLOCK_LENGTH);
+    for (size_t done = 0; done < len; done += kMaxUpdate) {
+        int piece = static_cast<int>(std::min(kMaxUpdate, len - done));
+        if (1 != EVP_EncryptUpdate(enc_ctx_, out + done, &outlen, in + done, piece) || outlen != piece)
+            throw std::runtime_error("EncryptUpdate failed");
+    }
+}
 
-    try {
-        if (1 != EVP_EncryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, NULL, NULL))
-            throw std::runtime_error("EncryptInit failed");
+void Encryptor::encrypt_final(uint8_t* tag_out) {
+    // Neither suite buffers anything, so final never emits ciphertext
+    uint8_t unused[EVP_MAX_BLOCK_LENGTH];
+    int outlen;
+    if (1 != EVP_EncryptFinal_ex(enc_ctx_, unused, &outlen) || outlen != 0)
+        throw std::runtime_error("EncryptFinal failed");
 
-        if (1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, static_cast<int>(res.iv.size()), NULL))
-            throw std::runtime_error("Set IV length failed");
+    if (1 != EVP_CIPHER_CTX_ctrl(enc_ctx_, EVP_CTRL_AEAD_GET_TAG, static_cast<int>(kTagSize), tag_out))
+        throw std::runtime_error("Get tag failed");
+}
 
-        if (1 != EVP_EncryptInit_ex(ctx, NULL, NULL, key_.data(), res.iv.data()))
-            throw std::runtime_error("EncryptInit key/iv failed");
+void Encryptor::decrypt_init(const uint8_t* iv) {
+    if (1 != EVP_DecryptInit_ex(dec_ctx_, NULL, NULL, NULL, iv))
+        throw std::runtime_error("DecryptInit iv failed");
+}
 
-        if (1 != EVP_EncryptUpdate(ctx, res.ciphertext.data(), &outlen, plaintext, static_cast<int>(len)))
-            throw std::runtime_error("EncryptUpdate failed");
-        
-        ciphertext_len = outlen;
+void Encryptor::decrypt_update(const uint8_t* in, size_t len, uint8_t* out) {
+    metrics::ScopedTimer timer(metrics::Stage::Decrypt, len);
+    int outlen;
+    for (size_t done = 0; done < len; done += kMaxUpdate) {
+        int piece = static_cast<int>(std::min(kMaxUpdate, len - done));
+        if (1 != EVP_DecryptUpdate(dec_ctx_, out + done, &outlen, in + done, piece) || outlen != piece)
+            throw std::runtime_error("DecryptUpdate failed");
+    }
+}
 
-        if (1 != EVP_EncryptFinal_ex(ctx, res.ciphertext.data() + outlen, &outlen))
-            throw std::runtime_error("EncryptFinal failed");
-        
-        ciphertext_len += outlen;
-        res.ciphertext.resize(ciphertext_len);
+void Encryptor::decrypt_final(const uint8_t* tag) {
+    if (1 != EVP_CIPHER_CTX_ctrl(dec_ctx_, EVP_CTRL_AEAD_SET_TAG, static_cast<int>(kTagSize), const_cast<uint8_t*>(tag)))
+        throw std::runtime_error("Set tag failed");
 
-        if (1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, 16, res.tag.data()))
-            throw std::runtime_error("Get tag failed");
+    uint8_t unused[EVP_MAX_BLOCK_LENGTH];
+    int outlen;
+    if (EVP_DecryptFinal_ex(dec_ctx_, unused, &outlen) <= 0) {
+        throw std::runtime_error("Decryption failed (tag mismatch or other error)");
+    }
+}
 
-    } catch (...) {
-        EVP_CIPHER_CTX_free(ctx);
-        throw;
+CipherResult Encryptor::encrypt(const uint8_t* plaintext, size_t len) {
+    CipherResult res;
+    
+    // Generate random IV
+    if (RAND_bytes(res.iv.data(), static_cast<int>(res.iv.size())) != 1) {
+        throw std::runtime_error("Failed to generate random IV");
     }
 
-    EVP_CIPHER_CTX_free(ctx);
+    // Both suites are stream modes: ciphertext is exactly as long as the plaintext
+    res.ciphertext.resize(len);
+    res.ciphertext.resize(seal(plaintext, len, res.iv.data(), res.ciphertext.data(), res.tag.data()));
     return res;
 }
 
 std::vector<uint8_t> Encryptor::decrypt(const CipherResult& res) {
-    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
-    if (!ctx) throw std::runtime_error("Failed to create cipher context");
+    std::vector<uint8_t> plaintext(res.ciphertext.size());
+    plaintext.resize(open(res.ciphertext.data(), res.ciphertext.size(), res.iv.data(), res.tag.data(), plaintext.data()));
+    return plaintext;
+}
 
-    std::vector<uint8_t> plaintext;
-    plaintext.resize(res.ciphertext.size());
-    int outlen;
-    int plaintext_len = 0;
+size_t Encryptor::encrypt_into(const uint8_t* plaintext, size_t len, uint8_t* out, size_t out_capacity) {
+    if (out_capacity < sealed_size(len)) {
+        throw std::invalid_argument("Output buffer too small for sealed chunk");
+    }
 
-    try {
-        if (1 != EVP_DecryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, NULL, NULL))
-            throw std::runtime_error("DecryptInit failed");
+    uint8_t* iv = out;
+    uint8_t* ciphertext = out + kIvSize;
+    if (RAND_bytes(iv, static_cast<int>(kIvSize)) != 1) {
+        throw std::runtime_error("Failed to generate random IV");
+    }
 
-        if (1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, static_cast<int>(res.iv.size()), NULL))
-            throw std::runtime_error("Set IV length failed");
+    size_t ciphertext_len = seal(plaintext, len, iv, ciphertext, ciphertext + len);
+    return kIvSize + ciphertext_len + kTagSize;
+}
 
-        if (1 != EVP_DecryptInit_ex(ctx, NULL, NULL, key_.data(), res.iv.data()))
-            throw std::runtime_error("DecryptInit key/iv failed");
+void Encryptor::encrypt_into(const uint8_t* plaintext, size_t len, std::vector<uint8_t>& out) {
+    out.resize(sealed_size(len));
+    out.resize(encrypt_into(plaintext, len, out.data(), out.size()));
+}
 
-        if (1 != EVP_DecryptUpdate(ctx, plaintext.data(), &outlen, res.ciphertext.data(), static_cast<int>(res.ciphertext.size())))
-            throw std::runtime_error("DecryptUpdate failed");
-        
-        plaintext_len = outlen;
-
-        if (1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, 16, const_cast<uint8_t*>(res.tag.data())))
-            throw std::runtime_error("Set tag failed");
-
-        int ret = EVP_DecryptFinal_ex(ctx, plaintext.data() + outlen, &outlen);
-        
-        if (ret <= 0) {
-            throw std::runtime_error("Decryption failed (tag mismatch or other error)");
-        }
-        
-        plaintext_len += outlen;
-        plaintext.resize(plaintext_len);
-
-    } catch (...) {
-        EVP_CIPHER_CTX_free(ctx);
-        throw;
+size_t Encryptor::decrypt_from(const uint8_t* blob, size_t blob_len, uint8_t* out, size_t out_capacity) {
+    if (blob_len < kIvSize + kTagSize) {
+        throw std::runtime_error("Sealed chunk too short");
+    }
+    size_t ciphertext_len = blob_len - kIvSize - kTagSize;
+    if (out_capacity < ciphertext_len) {
+        throw std::invalid_argument("Output buffer too small for plaintext");
     }
 
-    EVP_CIPHER_CTX_free(ctx);
-    return plaintext;
+    const uint8_t* iv = blob;
+    const uint8_t* ciphertext = blob + kIvSize;
+    const uint8_t* tag = ciphertext + ciphertext_len;
+    return open(ciphertext, ciphertext_len, iv, tag, out);
+}
+
+void Encryptor::decrypt_from(const uint8_t* blob, size_t blob_len, std::vector<uint8_t>& out) {
+    if (blob_len < kIvSize + kTagSize) {
+        throw std::runtime_error("Sealed chunk too short");
+    }
+    out.resize(blob_len - kIvSize - kTagSize);
+    out.resize(decrypt_from(blob, blob_len, out.data(), out.size()));
 }
 
 } // namespace crypto
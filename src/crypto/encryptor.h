@@ -1,8 +1,12 @@
 #pragma once
 
+#include "cipher_suite.h"
 #include <vector>
 #include <array>
 #include <cstdint>
+#include <cstddef>
+
+typedef struct evp_cipher_ctx_st EVP_CIPHER_CTX;
 
 namespace crypto {
 
@@ -12,16 +16,60 @@ struct CipherResult {
     std::array<uint8_t, 12> iv;
 };
 
+// AEAD sealing under one CipherSuite (AES-256-GCM unless chosen otherwise).
+// Cipher contexts are created once and reused across calls, so an Encryptor
+// must not be shared between threads; create one per worker instead.
 class Encryptor {
 public:
-    Encryptor(const std::array<uint8_t, 32>& key);
+    static const size_t kIvSize = 12;
+    static const size_t kTagSize = 16;
+
+    Encryptor(const std::array<uint8_t, 32>& key, CipherSuite suite = CipherSuite::Aes256Gcm);
     ~Encryptor();
 
+    Encryptor(const Encryptor&) = delete;
+    Encryptor& operator=(const Encryptor&) = delete;
+
     CipherResult encrypt(const uint8_t* plaintext, size_t len);
     std::vector<uint8_t> decrypt(const CipherResult& res);
 
+    CipherSuite suite() const { return suite_; }
+
+    // Size of the wire-format blob IV || ciphertext || tag for a plaintext length
+    static size_t sealed_size(size_t plaintext_len) { return kIvSize + plaintext_len + kTagSize; }
+
+    // Encrypts straight into the wire format. `out` must hold sealed_size(len)
+    // bytes; returns the number written.
+    size_t encrypt_into(const uint8_t* plaintext, size_t len, uint8_t* out, size_t out_capacity);
+    // Same, resizing a reusable buffer (no allocation once it has grown to size)
+    void encrypt_into(const uint8_t* plaintext, size_t len, std::vector<uint8_t>& out);
+
+    // Authenticates and decrypts a wire-format blob in place of a copy: the IV
+    // and tag are read from the blob itself. Returns the plaintext length.
+    size_t decrypt_from(const uint8_t* blob, size_t blob_len, uint8_t* out, size_t out_capacity);
+    void decrypt_from(const uint8_t* blob, size_t blob_len, std::vector<uint8_t>& out);
+
+    // Incremental encryption for data that is produced or consumed piecewise.
+    // encrypt_init writes a fresh random IV; each encrypt_update emits exactly
+    // `len` ciphertext bytes (both suites are stream modes); encrypt_final writes the tag.
+    void encrypt_init(uint8_t* iv_out);
+    void encrypt_update(const uint8_t* in, size_t len, uint8_t* out);
+    void encrypt_final(uint8_t* tag_out);
+
+    // Incremental decryption. Plaintext from decrypt_update is unauthenticated
+    // until decrypt_final succeeds; callers must discard it if final throws.
+    void decrypt_init(const uint8_t* iv);
+    void decrypt_update(const uint8_t* in, size_t len, uint8_t* out);
+    void decrypt_final(const uint8_t* tag);
+
 private:
     std::array<uint8_t, 32> key_;
+    CipherSuite suite_;
+    EVP_CIPHER_CTX* enc_ctx_;
+    EVP_CIPHER_CTX* dec_ctx_;
+
+    size_t seal(const uint8_t* plaintext, size_t len, const uint8_t* iv, uint8_t* ciphertext, uint8_t* tag);
+    size_t open(const uint8_t* ciphertext, size_t len, const uint8_t* iv, const uint8_t* tag, uint8_t* plaintext);
 };
 
 } // namespace crypto
@@ -49,6 +49,49 @@ std::array<uint8_t, 32> KeyManager::get_master_key() {
     return key_array;
 }
 
+std::array<uint8_t, 32> KeyManager::derive_subkey(const std::array<uint8_t, 32>& master_key, const std::string& context) {
+    std::array<uint8_t, 32> subkey;
+    size_t out_len = subkey.size();
+
+    EVP_PKEY_CTX* pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL);
+    if (!pctx) throw std::runtime_error("Failed to create HKDF context");
+
+    bool ok = EVP_PKEY_derive_init(pctx) == 1 &&
+              EVP_PKEY_CTX_set_hkdf_md(pctx, EVP_sha256()) == 1 &&
+              EVP_PKEY_CTX_set1_hkdf_key(pctx, master_key.data(), static_cast<int>(master_key.size())) == 1 &&
+              EVP_PKEY_CTX_add1_hkdf_info(pctx, reinterpret_cast<const unsigned char*>(context.data()), static_cast<int>(context.size())) == 1 &&
+              EVP_PKEY_derive(pctx, subkey.data(), &out_len) == 1;
+    EVP_PKEY_CTX_free(pctx);
+
+    if (!ok || out_len != subkey.size()) {
+        throw std::runtime_error("HKDF subkey derivation failed");
+    }
+    return subkey;
+}
+
+OperationKeys KeyManager::operation_keys(const std::array<uint8_t, 32>& master_key, KeyScope scope) {
+    OperationKeys keys;
+    keys.scope = scope;
+    keys.data = master_key;
+    if (scope == KeyScope::Backup) {
+        keys.dedup = derive_subkey(master_key, "secure-backup dedup index v1");
+        keys.pack = derive_subkey(master_key, "secure-backup pack index v1");
+        keys.fingerprint = derive_subkey(master_key, "secure-backup chunk fingerprint v1");
+    }
+    return keys;
+}
+
+OperationKeys::~OperationKeys() {
+    zeroize();
+}
+
+void OperationKeys::zeroize() {
+    OPENSSL_cleanse(data.data(), data.size());
+    OPENSSL_cleanse(dedup.data(), dedup.size());
+    OPENSSL_cleanse(pack.data(), pack.size());
+    OPENSSL_cleanse(fingerprint.data(), fingerprint.size());
+}
+
 void KeyManager::zeroize() {
     if (!master_key_.empty()) {
         OPENSSL_cleanse(master_key_.data(), master_key_.size());
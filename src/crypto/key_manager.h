@@ -13,6 +13,26 @@ struct KeyDerivationParams {
     int key_length = 32;
 };
 
+// Operations that need key material; each is handed only the keys it uses
+enum class KeyScope : uint8_t {
+    Backup = 1,
+    Restore = 2
+};
+
+// Keys for one operation. Chunks are sealed under `data`, which is the master
+// key itself so existing backups stay readable; the others are HKDF subkeys
+// and are left zero outside the backup scope. Zeroized on destruction.
+struct OperationKeys {
+    KeyScope scope = KeyScope::Restore;
+    std::array<uint8_t, 32> data{};
+    std::array<uint8_t, 32> dedup{};
+    std::array<uint8_t, 32> pack{};
+    std::array<uint8_t, 32> fingerprint{};
+
+    ~OperationKeys();
+    void zeroize();
+};
+
 class KeyManager {
 public:
     KeyManager(const std::string& passphrase, const KeyDerivationParams& params);
@@ -21,6 +41,12 @@ public:
     std::vector<uint8_t> derive_master_key();
     std::array<uint8_t, 32> get_master_key();
 
+    // Derive an independent 32-byte key for one purpose (HKDF-SHA256, info = context)
+    static std::array<uint8_t, 32> derive_subkey(const std::array<uint8_t, 32>& master_key, const std::string& context);
+
+    // The keys `scope` needs, derived from the master key
+    static OperationKeys operation_keys(const std::array<uint8_t, 32>& master_key, KeyScope scope);
+
     // Securely clear memory
     void zeroize();
 
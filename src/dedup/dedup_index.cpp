@@ -0,0 +1,369 @@
+#include "dedup_index.h"
+#include "../utils/file_utils.h"
+#include "../utils/hash_utils.h"
+#include <stdexcept>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+
+namespace dedup {
+
+namespace {
+
+const char kSlotsMagic[4] = {'S', 'B', 'D', 'X'};
+const char kBloomMagic[4] = {'S', 'B', 'B', 'F'};
+const uint32_t kVersion = 3;
+const uint64_t kInitialCapacity = 1 << 16;
+const uint64_t kBloomBitsPerSlot = 10;
+const size_t kSlotSize = 16;        // fingerprint + log offset
+// key(32) hash(32) iv(12) size(8) pack_offset(8) pack_length(8) uri_len(4) pack_len(4) codec(1) cipher(1) reserved(2)
+const size_t kRecordFixedSize = 112;
+const size_t kScanBatch = 4096;
+// Records appended between header writes; each write costs a log fsync
+const uint64_t kHeaderInterval = 64;
+
+uint64_t mix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+void check_stream(const std::ios& stream, const std::string& what) {
+    if (!stream) {
+        throw std::runtime_error("Dedup index I/O failed: " + what);
+    }
+}
+
+} // namespace
+
+// BloomFilter ---------------------------------------------------------------
+
+void BloomFilter::reset(uint64_t bits) {
+    bit_count_ = bits < 64 ? 64 : bits;
+    words_.assign((bit_count_ + 63) / 64, 0);
+}
+
+void BloomFilter::add(uint64_t fingerprint) {
+    uint64_t h2 = mix64(fingerprint) | 1;
+    for (int i = 0; i < kHashes; i++) {
+        uint64_t bit = (fingerprint + i * h2) % bit_count_;
+        words_[bit / 64] |= 1ULL << (bit % 64);
+    }
+}
+
+bool BloomFilter::maybe_contains(uint64_t fingerprint) const {
+    uint64_t h2 = mix64(fingerprint) | 1;
+    for (int i = 0; i < kHashes; i++) {
+        uint64_t bit = (fingerprint + i * h2) % bit_count_;
+        if (!(words_[bit / 64] & (1ULL << (bit % 64)))) return false;
+    }
+    return true;
+}
+
+// DedupIndex ----------------------------------------------------------------
+
+DedupIndex::DedupIndex(const std::string& dir) : dir_(dir) {
+    utils::FileUtils::create_directory(dir_);
+    open_or_create();
+}
+
+DedupIndex::~DedupIndex() {
+    try {
+        flush();
+    } catch (...) {
+        // Index is a cache; losing the tail only costs re-uploads
+    }
+}
+
+uint64_t DedupIndex::fingerprint(const ChunkKey& key) {
+    // Keys are HMAC outputs, so any 8 bytes are uniformly distributed
+    uint64_t fp;
+    std::memcpy(&fp, key.data(), sizeof(fp));
+    return fp == 0 ? 1 : fp; // 0 marks an empty slot
+}
+
+void DedupIndex::open_or_create() {
+    std::string slots_path = dir_ + "/slots.idx";
+    std::string log_path = dir_ + "/records.log";
+
+    bool valid = false;
+    if (utils::FileUtils::exists(slots_path)) {
+        slots_.open(slots_path, std::ios::in | std::ios::out | std::ios::binary);
+        slots_.read(reinterpret_cast<char*>(&header_), sizeof(header_));
+        valid = slots_ && std::memcmp(header_.magic, kSlotsMagic, 4) == 0 && header_.version == kVersion &&
+                header_.capacity >= kInitialCapacity && (header_.capacity & (header_.capacity - 1)) == 0 &&
+                utils::FileUtils::exists(log_path) && fs::file_size(log_path) >= header_.log_size;
+        if (!valid) {
+            std::cerr << "WARNING: Dedup index at " << dir_ << " is unreadable, starting a new one." << std::endl;
+            slots_.close();
+        }
+    }
+
+    if (!valid) {
+        std::memcpy(header_.magic, kSlotsMagic, 4);
+        header_.version = kVersion;
+        header_.capacity = kInitialCapacity;
+        header_.count = 0;
+        header_.log_size = 0;
+        create_slots(slots_, slots_path, header_.capacity);
+        std::ofstream(log_path, std::ios::binary | std::ios::trunc);
+        utils::FileUtils::remove_file(dir_ + "/bloom.bin");
+    }
+
+    // Drop records past the last header write: partly written, or written
+    // after it and not yet counted
+    if (fs::file_size(log_path) > header_.log_size) {
+        fs::resize_file(log_path, header_.log_size);
+    }
+    log_.open(log_path, std::ios::in | std::ios::out | std::ios::binary);
+    check_stream(log_, "open " + log_path);
+
+    load_or_rebuild_bloom();
+}
+
+void DedupIndex::create_slots(std::fstream& file, const std::string& path, uint64_t capacity) {
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        Header header = header_;
+        header.capacity = capacity;
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        std::vector<char> zeros(kScanBatch * kSlotSize, 0);
+        for (uint64_t done = 0; done < capacity; done += kScanBatch) {
+            uint64_t n = std::min<uint64_t>(kScanBatch, capacity - done);
+            out.write(zeros.data(), static_cast<std::streamsize>(n * kSlotSize));
+        }
+        check_stream(out, "create " + path);
+    }
+    file.open(path, std::ios::in | std::ios::out | std::ios::binary);
+    check_stream(file, "open " + path);
+}
+
+void DedupIndex::sync_log() {
+    log_.flush();
+    check_stream(log_, "flush records");
+    utils::FileUtils::sync(dir_ + "/records.log");
+}
+
+void DedupIndex::write_header() {
+    sync_log();
+    unsynced_ = 0;
+    slots_.seekp(0);
+    slots_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+    check_stream(slots_, "write header");
+}
+
+void DedupIndex::load_or_rebuild_bloom() {
+    std::string path = dir_ + "/bloom.bin";
+    uint64_t expected_bits = header_.capacity * kBloomBitsPerSlot;
+
+    std::ifstream in(path, std::ios::binary);
+    if (in) {
+        char magic[4];
+        uint64_t bits = 0, count = 0;
+        in.read(magic, 4);
+        in.read(reinterpret_cast<char*>(&bits), sizeof(bits));
+        in.read(reinterpret_cast<char*>(&count), sizeof(count));
+        if (in && std::memcmp(magic, kBloomMagic, 4) == 0 && bits == expected_bits && count == header_.count) {
+            bloom_.reset(bits);
+            auto& words = bloom_.words();
+            in.read(reinterpret_cast<char*>(words.data()), static_cast<std::streamsize>(words.size() * sizeof(uint64_t)));
+            if (in) return;
+        }
+    }
+    // Missing or stale snapshot (e.g. after a crash): rebuild from the slot table
+    rebuild_bloom();
+}
+
+void DedupIndex::rebuild_bloom() {
+    bloom_.reset(header_.capacity * kBloomBitsPerSlot);
+    std::vector<uint64_t> batch(kScanBatch * 2);
+    for (uint64_t base = 0; base < header_.capacity; base += kScanBatch) {
+        uint64_t n = std::min<uint64_t>(kScanBatch, header_.capacity - base);
+        slots_.seekg(static_cast<std::streamoff>(sizeof(Header) + base * kSlotSize));
+        slots_.read(reinterpret_cast<char*>(batch.data()), static_cast<std::streamsize>(n * kSlotSize));
+        check_stream(slots_, "scan slots");
+        for (uint64_t i = 0; i < n; i++) {
+            if (batch[2 * i] != 0) bloom_.add(batch[2 * i]);
+        }
+    }
+}
+
+void DedupIndex::read_slot(std::fstream& file, uint64_t index, uint64_t& fp, uint64_t& offset) {
+    uint64_t slot[2];
+    file.seekg(static_cast<std::streamoff>(sizeof(Header) + index * kSlotSize));
+    file.read(reinterpret_cast<char*>(slot), kSlotSize);
+    check_stream(file, "read slot");
+    fp = slot[0];
+    offset = slot[1];
+}
+
+void DedupIndex::write_slot(std::fstream& file, uint64_t index, uint64_t fp, uint64_t offset) {
+    uint64_t slot[2] = {fp, offset};
+    file.seekp(static_cast<std::streamoff>(sizeof(Header) + index * kSlotSize));
+    file.write(reinterpret_cast<const char*>(slot), kSlotSize);
+    check_stream(file, "write slot");
+}
+
+bool DedupIndex::read_record(uint64_t offset, const ChunkKey& key, DedupEntry* out) {
+    if (offset + kRecordFixedSize > header_.log_size) return false;
+
+    uint8_t fixed[kRecordFixedSize];
+    log_.seekg(static_cast<std::streamoff>(offset));
+    log_.read(reinterpret_cast<char*>(fixed), kRecordFixedSize);
+    check_stream(log_, "read record");
+    if (std::memcmp(fixed, key.data(), key.size()) != 0) return false;
+    if (!out) return true;
+
+    uint32_t uri_len, pack_len;
+    std::memcpy(&out->size, fixed + 76, sizeof(out->size));
+    std::memcpy(&out->pack_offset, fixed + 84, sizeof(out->pack_offset));
+    std::memcpy(&out->pack_length, fixed + 92, sizeof(out->pack_length));
+    std::memcpy(&uri_len, fixed + 100, sizeof(uri_len));
+    std::memcpy(&pack_len, fixed + 104, sizeof(pack_len));
+    out->codec = compress::codec_from_id(fixed[108]);
+    out->cipher = crypto::suite_from_id(fixed[109]);
+    if (offset + kRecordFixedSize + uri_len + pack_len > header_.log_size) return false;
+
+    out->hash = utils::HashUtils::to_hex(fixed + 32, 32);
+    out->iv = utils::HashUtils::to_hex(fixed + 64, 12);
+    out->uri.resize(uri_len);
+    log_.read(&out->uri[0], uri_len);
+    out->pack.resize(pack_len);
+    log_.read(&out->pack[0], pack_len);
+    check_stream(log_, "read record uri");
+    return true;
+}
+
+bool DedupIndex::find_slot(const ChunkKey& key, uint64_t& slot_index, uint64_t& log_offset, DedupEntry* out) {
+    uint64_t fp = fingerprint(key);
+    uint64_t mask = header_.capacity - 1;
+    for (uint64_t i = fp & mask;; i = (i + 1) & mask) {
+        uint64_t slot_fp, offset;
+        read_slot(slots_, i, slot_fp, offset);
+        if (slot_fp == 0) {
+            slot_index = i;
+            return false;
+        }
+        if (slot_fp == fp && read_record(offset, key, out)) {
+            slot_index = i;
+            log_offset = offset;
+            return true;
+        }
+    }
+}
+
+bool DedupIndex::lookup(const ChunkKey& key, DedupEntry& out) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!bloom_.maybe_contains(fingerprint(key))) return false;
+    uint64_t slot, offset;
+    return find_slot(key, slot, offset, &out);
+}
+
+void DedupIndex::insert(const ChunkKey& key, const DedupEntry& entry) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t slot = 0, offset = 0;
+    uint64_t fp = fingerprint(key);
+    if (bloom_.maybe_contains(fp) && find_slot(key, slot, offset, nullptr)) return;
+
+    // Keep the load factor under 70% so probe chains stay short
+    if ((header_.count + 1) * 10 > header_.capacity * 7) {
+        grow();
+    }
+    find_slot(key, slot, offset, nullptr);
+
+    uint8_t fixed[kRecordFixedSize];
+    uint32_t uri_len = static_cast<uint32_t>(entry.uri.size());
+    uint32_t pack_len = static_cast<uint32_t>(entry.pack.size());
+    std::memcpy(fixed, key.data(), 32);
+    utils::HashUtils::from_hex(entry.hash, fixed + 32, 32);
+    utils::HashUtils::from_hex(entry.iv, fixed + 64, 12);
+    std::memcpy(fixed + 76, &entry.size, sizeof(entry.size));
+    std::memcpy(fixed + 84, &entry.pack_offset, sizeof(entry.pack_offset));
+    std::memcpy(fixed + 92, &entry.pack_length, sizeof(entry.pack_length));
+    std::memcpy(fixed + 100, &uri_len, sizeof(uri_len));
+    std::memcpy(fixed + 104, &pack_len, sizeof(pack_len));
+    fixed[108] = static_cast<uint8_t>(entry.codec);
+    fixed[109] = static_cast<uint8_t>(entry.cipher);
+    fixed[110] = 0;
+    fixed[111] = 0;
+
+    uint64_t record_offset = header_.log_size;
+    log_.seekp(static_cast<std::streamoff>(record_offset));
+    log_.write(reinterpret_cast<const char*>(fixed), kRecordFixedSize);
+    log_.write(entry.uri.data(), uri_len);
+    log_.write(entry.pack.data(), pack_len);
+    check_stream(log_, "append record");
+
+    write_slot(slots_, slot, fp, record_offset);
+    header_.log_size += kRecordFixedSize + uri_len + pack_len;
+    header_.count++;
+    if (++unsynced_ >= kHeaderInterval) write_header();
+    bloom_.add(fp);
+}
+
+void DedupIndex::grow() {
+    std::string slots_path = dir_ + "/slots.idx";
+    std::string tmp_path = slots_path + ".tmp";
+    uint64_t new_capacity = header_.capacity * 2;
+    uint64_t new_mask = new_capacity - 1;
+
+    std::fstream next;
+    create_slots(next, tmp_path, new_capacity);
+
+    std::vector<uint64_t> batch(kScanBatch * 2);
+    for (uint64_t base = 0; base < header_.capacity; base += kScanBatch) {
+        uint64_t n = std::min<uint64_t>(kScanBatch, header_.capacity - base);
+        slots_.seekg(static_cast<std::streamoff>(sizeof(Header) + base * kSlotSize));
+        slots_.read(reinterpret_cast<char*>(batch.data()), static_cast<std::streamsize>(n * kSlotSize));
+        check_stream(slots_, "scan slots");
+        for (uint64_t i = 0; i < n; i++) {
+            uint64_t fp = batch[2 * i];
+            if (fp == 0) continue;
+            for (uint64_t j = fp & new_mask;; j = (j + 1) & new_mask) {
+                uint64_t existing, unused;
+                read_slot(next, j, existing, unused);
+                if (existing == 0) {
+                    write_slot(next, j, fp, batch[2 * i + 1]);
+                    break;
+                }
+            }
+        }
+    }
+
+    header_.capacity = new_capacity;
+    sync_log();
+    unsynced_ = 0;
+    next.seekp(0);
+    next.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+    check_stream(next, "write header");
+    next.close();
+    slots_.close();
+
+    fs::rename(tmp_path, slots_path);
+    slots_.open(slots_path, std::ios::in | std::ios::out | std::ios::binary);
+    check_stream(slots_, "open " + slots_path);
+    rebuild_bloom();
+}
+
+void DedupIndex::flush() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    write_header();
+    log_.flush();
+    slots_.flush();
+
+    std::ofstream out(dir_ + "/bloom.bin", std::ios::binary | std::ios::trunc);
+    uint64_t bits = bloom_.bit_count();
+    out.write(kBloomMagic, 4);
+    out.write(reinterpret_cast<const char*>(&bits), sizeof(bits));
+    out.write(reinterpret_cast<const char*>(&header_.count), sizeof(header_.count));
+    const auto& words = bloom_.words();
+    out.write(reinterpret_cast<const char*>(words.data()), static_cast<std::streamsize>(words.size() * sizeof(uint64_t)));
+    check_stream(out, "write bloom filter");
+}
+
+uint64_t DedupIndex::size() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return header_.count;
+}
+
+} // namespace dedup
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "../compress/codec.h"
+#include "../crypto/cipher_suite.h"
+#include <string>
+#include <vector>
+#include <array>
+#include <fstream>
+#include <mutex>
+#include <cstdint>
+
+namespace dedup {
+
+// Keyed hash (HMAC-SHA256) of a plaintext chunk
+using ChunkKey = std::array<uint8_t, 32>;
+
+// Where an already-uploaded copy of a chunk lives
+struct DedupEntry {
+    std::string uri;    // standalone object, or the pack holding the blob
+    std::string hash;   // hex SHA-256 of the uploaded blob
+    std::string iv;     // hex IV
+    uint64_t size = 0;  // plaintext bytes
+    std::string pack;   // pack id; empty for standalone objects
+    uint64_t pack_offset = 0;
+    uint64_t pack_length = 0;
+    compress::Codec codec = compress::Codec::None;
+    crypto::CipherSuite cipher = crypto::CipherSuite::Aes256Gcm;
+};
+
+// Bit array sized for the index capacity. Answers "definitely new" for most
+// unseen chunks without touching the disk.
+class BloomFilter {
+public:
+    void reset(uint64_t bits);
+    void add(uint64_t fingerprint);
+    bool maybe_contains(uint64_t fingerprint) const;
+    uint64_t bit_count() const { return bit_count_; }
+    std::vector<uint64_t>& words() { return words_; }
+
+private:
+    static const int kHashes = 7;
+    uint64_t bit_count_ = 0;
+    std::vector<uint64_t> words_;
+};
+
+// Persistent map from ChunkKey to DedupEntry, kept in a directory:
+//   records.log  append-only full records
+//   slots.idx    open-addressing table of (key fingerprint, log offset)
+//   bloom.bin    snapshot of the in-memory Bloom filter
+// Only the Bloom filter lives in memory, so the index scales to tens of
+// millions of chunks. Thread-safe.
+class DedupIndex {
+public:
+    explicit DedupIndex(const std::string& dir);
+    ~DedupIndex();
+
+    bool lookup(const ChunkKey& key, DedupEntry& out);
+    void insert(const ChunkKey& key, const DedupEntry& entry);
+
+    // Persist the header and Bloom filter
+    void flush();
+
+    uint64_t size();
+
+private:
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint64_t capacity;
+        uint64_t count;
+        uint64_t log_size;
+    };
+
+    std::string dir_;
+    std::fstream log_;
+    std::fstream slots_;
+    Header header_;
+    BloomFilter bloom_;
+    std::mutex mutex_;
+    uint64_t unsynced_ = 0;   // records appended since the header was last written
+
+    void open_or_create();
+    void create_slots(std::fstream& file, const std::string& path, uint64_t capacity);
+    // Syncs the log first, so the header never counts records a crash can lose
+    void write_header();
+    void sync_log();
+    void load_or_rebuild_bloom();
+    void rebuild_bloom();
+    void grow();
+
+    bool find_slot(const ChunkKey& key, uint64_t& slot_index, uint64_t& log_offset, DedupEntry* out);
+    void read_slot(std::fstream& file, uint64_t index, uint64_t& fingerprint, uint64_t& offset);
+    void write_slot(std::fstream& file, uint64_t index, uint64_t fingerprint, uint64_t offset);
+    bool read_record(uint64_t offset, const ChunkKey& key, DedupEntry* out);
+
+    static uint64_t fingerprint(const ChunkKey& key);
+};
+
+} // namespace dedup
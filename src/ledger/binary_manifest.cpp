@@ -0,0 +1,464 @@
+#include "binary_manifest.h"
+#include "../utils/file_utils.h"
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ledger {
+
+namespace {
+
+const char kMagic[4] = {'S', 'B', 'M', 'F'};
+// Version 1 had no shard table and a 128-byte header
+const uint32_t kFormatVersion = 2;
+const uint32_t kHeaderSizeV1 = 128;
+const uint32_t kHeaderSize = 144;
+const uint32_t kNone = 0xffffffff;
+
+// Header field offsets
+const size_t kHdrVersion = 4, kHdrHeaderSize = 8, kHdrChunkSize = 12, kHdrFileSize = 16, kHdrFlags = 20,
+             kHdrManifestVersion = 24, kHdrCipher = 28, kHdrOriginalSize = 32, kHdrMtime = 40, kHdrChunkBytes = 48,
+             kHdrFileName = 56, kHdrChunking = 60, kHdrRoot = 64, kHdrTree = 68, kHdrTimestamp = 72,
+             kHdrChunkCount = 80, kHdrTopChunks = 88, kHdrFileCount = 96, kHdrPackCount = 104,
+             kHdrStringCount = 112, kHdrStringBytes = 120, kHdrShardChunks = 128, kHdrShardCount = 136;
+const uint32_t kManifestTree = 1;
+
+// Chunk record: id offset size pack_offset pack_length (u64 each), hash[32]
+// iv[12], ref (URI or pack index), fingerprint[16], flags, codec id (u8), cipher suite id (u8), reserved
+const uint32_t kChunkRecordSize = 112;
+const size_t kChunkHash = 40, kChunkIv = 72, kChunkRef = 84, kChunkFp = 88, kChunkFlags = 104, kChunkCodec = 108,
+             kChunkCipher = 109;
+const uint32_t kChunkPacked = 1, kChunkHasHash = 2, kChunkHasIv = 4, kChunkHasFp = 8;
+const size_t kHashSize = 32, kIvSize = 12, kFpSize = 16;
+
+// File record: path index, flags, size, mtime_ns, first chunk record, chunk count
+const uint32_t kFileRecordSize = 40;
+const uint32_t kFileDirectory = 1;
+const uint32_t kPackRecordSize = 8;
+// Shard record: first chunk, chunk count, root index, URI index
+const uint32_t kShardRecordSize = 24;
+
+template <typename T>
+void put(std::vector<uint8_t>& buf, size_t offset, T value) {
+    std::memcpy(buf.data() + offset, &value, sizeof(value));
+}
+
+template <typename T>
+T get(const uint8_t* p) {
+    T value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+uint64_t align8(uint64_t n) {
+    return (n + 7) & ~uint64_t(7);
+}
+
+[[noreturn]] void corrupt(const std::string& what) {
+    throw std::runtime_error("Corrupt binary manifest: " + what);
+}
+
+class StringTable {
+public:
+    uint32_t intern(const std::string& s) {
+        auto it = index_.find(s);
+        if (it != index_.end()) return it->second;
+        uint32_t index = static_cast<uint32_t>(strings_.size());
+        strings_.push_back(s);
+        index_.emplace(s, index);
+        return index;
+    }
+    const std::vector<std::string>& strings() const { return strings_; }
+
+private:
+    std::vector<std::string> strings_;
+    std::unordered_map<std::string, uint32_t> index_;
+};
+
+// Raw bytes of a hex field; false if it is empty. Hex that would not come
+// back identically (wrong length, upper case) cannot be stored raw.
+bool pack_hex(const std::string& hex, uint8_t* out, size_t len, const char* field) {
+    if (hex.empty()) return false;
+    utils::HashUtils::from_hex(hex, out, len);
+    if (utils::HashUtils::to_hex(out, len) != hex) {
+        throw std::runtime_error(std::string("Manifest ") + field + " is not lowercase hex: " + hex);
+    }
+    return true;
+}
+
+} // namespace
+
+std::vector<uint8_t> BinaryManifest::encode(const Manifest& manifest) {
+    StringTable strings;
+    std::unordered_map<std::string, uint32_t> pack_index;
+    std::vector<std::pair<uint32_t, uint32_t>> packs;
+    for (const auto& pack : manifest.packs) {
+        pack_index.emplace(pack.first, static_cast<uint32_t>(packs.size()));
+        packs.emplace_back(strings.intern(pack.first), strings.intern(pack.second));
+    }
+    // Chunks may name packs the map lacks; keep the reference without a URI
+    auto pack_of = [&](const std::string& id) {
+        auto it = pack_index.find(id);
+        if (it != pack_index.end()) return it->second;
+        uint32_t index = static_cast<uint32_t>(packs.size());
+        pack_index.emplace(id, index);
+        packs.emplace_back(strings.intern(id), kNone);
+        return index;
+    };
+
+    uint64_t chunk_count = manifest.chunks.size();
+    for (const auto& file : manifest.files) chunk_count += file.chunks.size();
+
+    std::vector<uint8_t> chunk_records(chunk_count * kChunkRecordSize);
+    std::vector<uint8_t> file_records(manifest.files.size() * kFileRecordSize);
+    uint64_t record = 0;
+    auto put_chunk = [&](const ChunkInfo& chunk) {
+        size_t at = record++ * kChunkRecordSize;
+        uint32_t flags = 0;
+        put<uint64_t>(chunk_records, at, chunk.id);
+        put<uint64_t>(chunk_records, at + 8, chunk.offset);
+        put<uint64_t>(chunk_records, at + 16, chunk.size);
+        if (pack_hex(chunk.hash, chunk_records.data() + at + kChunkHash, kHashSize, "chunk hash")) flags |= kChunkHasHash;
+        if (pack_hex(chunk.iv, chunk_records.data() + at + kChunkIv, kIvSize, "chunk IV")) flags |= kChunkHasIv;
+        if (pack_hex(chunk.fingerprint, chunk_records.data() + at + kChunkFp, kFpSize, "chunk fingerprint")) {
+            flags |= kChunkHasFp;
+        }
+        if (chunk.pack.empty()) {
+            put<uint32_t>(chunk_records, at + kChunkRef, strings.intern(chunk.uri));
+        } else {
+            // As in JSON, a packed chunk is located through its pack alone
+            flags |= kChunkPacked;
+            put<uint64_t>(chunk_records, at + 24, chunk.pack_offset);
+            put<uint64_t>(chunk_records, at + 32, chunk.pack_length);
+            put<uint32_t>(chunk_records, at + kChunkRef, pack_of(chunk.pack));
+        }
+        put<uint32_t>(chunk_records, at + kChunkFlags, flags);
+        chunk_records[at + kChunkCodec] = static_cast<uint8_t>(chunk.codec);
+        chunk_records[at + kChunkCipher] = static_cast<uint8_t>(chunk.cipher);
+    };
+    for (const auto& chunk : manifest.chunks) put_chunk(chunk);
+    for (size_t i = 0; i < manifest.files.size(); i++) {
+        const auto& file = manifest.files[i];
+        size_t at = i * kFileRecordSize;
+        put<uint32_t>(file_records, at, strings.intern(file.path));
+        put<uint32_t>(file_records, at + 4, file.directory ? kFileDirectory : 0);
+        put<uint64_t>(file_records, at + 8, file.size);
+        put<int64_t>(file_records, at + 16, file.mtime_ns);
+        put<uint64_t>(file_records, at + 24, record);
+        put<uint64_t>(file_records, at + 32, file.chunks.size());
+        for (const auto& chunk : file.chunks) put_chunk(chunk);
+    }
+
+    uint32_t file_name = strings.intern(manifest.file_name);
+    uint32_t chunking = strings.intern(manifest.chunking);
+    uint32_t root = strings.intern(manifest.merkle_root);
+    uint32_t tree = strings.intern(manifest.merkle_tree);
+    uint32_t timestamp = strings.intern(manifest.timestamp);
+    std::vector<std::pair<uint32_t, uint32_t>> shard_strings;
+    for (const auto& shard : manifest.shards) {
+        shard_strings.emplace_back(strings.intern(shard.root), strings.intern(shard.uri));
+    }
+
+    uint64_t string_bytes = 0;
+    for (const auto& s : strings.strings()) string_bytes += s.size();
+    uint64_t string_count = strings.strings().size();
+
+    uint64_t files_offset = align8(kHeaderSize + chunk_records.size());
+    uint64_t packs_offset = align8(files_offset + file_records.size());
+    uint64_t shards_offset = align8(packs_offset + packs.size() * kPackRecordSize);
+    uint64_t strings_offset = align8(shards_offset + manifest.shards.size() * kShardRecordSize);
+    uint64_t bytes_offset = strings_offset + (string_count + 1) * 8;
+
+    std::vector<uint8_t> buf(bytes_offset + string_bytes);
+    std::memcpy(buf.data(), kMagic, 4);
+    put<uint32_t>(buf, kHdrVersion, kFormatVersion);
+    put<uint32_t>(buf, kHdrHeaderSize, kHeaderSize);
+    put<uint32_t>(buf, kHdrChunkSize, kChunkRecordSize);
+    put<uint32_t>(buf, kHdrFileSize, kFileRecordSize);
+    put<uint32_t>(buf, kHdrFlags, manifest.tree ? kManifestTree : 0);
+    put<int32_t>(buf, kHdrManifestVersion, manifest.version);
+    put<uint32_t>(buf, kHdrCipher, static_cast<uint32_t>(manifest.cipher));
+    put<uint64_t>(buf, kHdrOriginalSize, manifest.original_size);
+    put<int64_t>(buf, kHdrMtime, manifest.mtime_ns);
+    put<uint64_t>(buf, kHdrChunkBytes, manifest.chunk_size);
+    put<uint32_t>(buf, kHdrFileName, file_name);
+    put<uint32_t>(buf, kHdrChunking, chunking);
+    put<uint32_t>(buf, kHdrRoot, root);
+    put<uint32_t>(buf, kHdrTree, tree);
+    put<uint32_t>(buf, kHdrTimestamp, timestamp);
+    put<uint64_t>(buf, kHdrChunkCount, chunk_count);
+    put<uint64_t>(buf, kHdrTopChunks, manifest.chunks.size());
+    put<uint64_t>(buf, kHdrFileCount, manifest.files.size());
+    put<uint64_t>(buf, kHdrPackCount, packs.size());
+    put<uint64_t>(buf, kHdrStringCount, string_count);
+    put<uint64_t>(buf, kHdrStringBytes, string_bytes);
+    put<uint64_t>(buf, kHdrShardChunks, manifest.shard_chunks);
+    put<uint64_t>(buf, kHdrShardCount, manifest.shards.size());
+
+    std::copy(chunk_records.begin(), chunk_records.end(), buf.begin() + kHeaderSize);
+    std::copy(file_records.begin(), file_records.end(), buf.begin() + files_offset);
+    for (size_t i = 0; i < packs.size(); i++) {
+        put<uint32_t>(buf, packs_offset + i * kPackRecordSize, packs[i].first);
+        put<uint32_t>(buf, packs_offset + i * kPackRecordSize + 4, packs[i].second);
+    }
+    for (size_t i = 0; i < manifest.shards.size(); i++) {
+        size_t record_at = shards_offset + i * kShardRecordSize;
+        put<uint64_t>(buf, record_at, manifest.shards[i].first_chunk);
+        put<uint64_t>(buf, record_at + 8, manifest.shards[i].chunk_count);
+        put<uint32_t>(buf, record_at + 16, shard_strings[i].first);
+        put<uint32_t>(buf, record_at + 20, shard_strings[i].second);
+    }
+    uint64_t at = 0;
+    for (uint64_t i = 0; i < string_count; i++) {
+        const std::string& s = strings.strings()[i];
+        put<uint64_t>(buf, strings_offset + i * 8, at);
+        std::memcpy(buf.data() + bytes_offset + at, s.data(), s.size());
+        at += s.size();
+    }
+    put<uint64_t>(buf, strings_offset + string_count * 8, at);
+    return buf;
+}
+
+bool BinaryManifest::detect(const uint8_t* data, size_t len) {
+    return len >= sizeof(kMagic) && std::memcmp(data, kMagic, sizeof(kMagic)) == 0;
+}
+
+BinaryManifest::BinaryManifest(std::vector<uint8_t> data) : owned_(std::move(data)) {
+    data_ = owned_.data();
+    size_ = owned_.size();
+    parse_header();
+}
+
+BinaryManifest::BinaryManifest(const std::string& path) {
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open manifest: " + path);
+    }
+    struct stat st;
+    void* addr = MAP_FAILED;
+    if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+        addr = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    ::close(fd);
+    if (addr != MAP_FAILED) {
+        data_ = static_cast<const uint8_t*>(addr);
+        size_ = static_cast<size_t>(st.st_size);
+        mapped_ = true;
+        // Lookups touch a few records each
+        ::madvise(addr, size_, MADV_RANDOM);
+    }
+#endif
+    if (!mapped_) {
+        owned_ = utils::FileUtils::read_file(path);
+        data_ = owned_.data();
+        size_ = owned_.size();
+    }
+    try {
+        parse_header();
+    } catch (...) {
+        unmap();
+        throw;
+    }
+}
+
+BinaryManifest::~BinaryManifest() {
+    unmap();
+}
+
+void BinaryManifest::unmap() {
+#ifndef _WIN32
+    if (mapped_) {
+        ::munmap(const_cast<uint8_t*>(data_), size_);
+        mapped_ = false;
+    }
+#endif
+}
+
+void BinaryManifest::parse_header() {
+    if (size_ < kHeaderSizeV1 || !detect(data_, size_)) corrupt("bad header");
+    uint32_t format = get<uint32_t>(data_ + kHdrVersion);
+    if (format != 1 && format != kFormatVersion) {
+        throw std::runtime_error("Unsupported binary manifest version " + std::to_string(format));
+    }
+    uint32_t header_size = format == 1 ? kHeaderSizeV1 : kHeaderSize;
+    if (size_ < header_size || get<uint32_t>(data_ + kHdrHeaderSize) != header_size ||
+        get<uint32_t>(data_ + kHdrChunkSize) != kChunkRecordSize ||
+        get<uint32_t>(data_ + kHdrFileSize) != kFileRecordSize) {
+        corrupt("unexpected record sizes");
+    }
+    chunk_count_ = get<uint64_t>(data_ + kHdrChunkCount);
+    top_chunk_count_ = get<uint64_t>(data_ + kHdrTopChunks);
+    file_count_ = get<uint64_t>(data_ + kHdrFileCount);
+    pack_count_ = get<uint64_t>(data_ + kHdrPackCount);
+    string_count_ = get<uint64_t>(data_ + kHdrStringCount);
+    string_bytes_ = get<uint64_t>(data_ + kHdrStringBytes);
+    if (format > 1) {
+        shard_chunks_ = get<uint64_t>(data_ + kHdrShardChunks);
+        shard_count_ = get<uint64_t>(data_ + kHdrShardCount);
+    }
+
+    // Each count is bounded by the buffer before multiplying, so nothing overflows
+    if (top_chunk_count_ > chunk_count_ || chunk_count_ > size_ / kChunkRecordSize || file_count_ > size_ / kFileRecordSize ||
+        pack_count_ > size_ / kPackRecordSize || shard_count_ > size_ / kShardRecordSize || string_count_ >= size_ / 8 || string_bytes_ > size_) {
+        corrupt("counts exceed the file size");
+    }
+    chunks_offset_ = header_size;
+    files_offset_ = align8(chunks_offset_ + chunk_count_ * kChunkRecordSize);
+    packs_offset_ = align8(files_offset_ + file_count_ * kFileRecordSize);
+    shards_offset_ = align8(packs_offset_ + pack_count_ * kPackRecordSize);
+    strings_offset_ = align8(shards_offset_ + shard_count_ * kShardRecordSize);
+    string_bytes_offset_ = strings_offset_ + (string_count_ + 1) * 8;
+    if (string_bytes_offset_ > size_ || string_bytes_ != size_ - string_bytes_offset_) {
+        corrupt("section sizes do not match the file size");
+    }
+}
+
+std::string BinaryManifest::string(uint32_t index) const {
+    if (index >= string_count_) corrupt("string index " + std::to_string(index) + " out of range");
+    const uint8_t* offsets = data_ + strings_offset_ + uint64_t(index) * 8;
+    uint64_t begin = get<uint64_t>(offsets);
+    uint64_t end = get<uint64_t>(offsets + 8);
+    if (begin > end || end > string_bytes_) corrupt("string " + std::to_string(index) + " out of range");
+    return std::string(reinterpret_cast<const char*>(data_ + string_bytes_offset_ + begin), end - begin);
+}
+
+const uint8_t* BinaryManifest::pack_record(uint32_t index) const {
+    if (index >= pack_count_) corrupt("pack index " + std::to_string(index) + " out of range");
+    return data_ + packs_offset_ + uint64_t(index) * kPackRecordSize;
+}
+
+ChunkInfo BinaryManifest::chunk(uint64_t record) const {
+    const uint8_t* p = data_ + chunks_offset_ + record * kChunkRecordSize;
+    uint32_t flags = get<uint32_t>(p + kChunkFlags);
+    ChunkInfo info;
+    info.id = get<uint64_t>(p);
+    info.offset = get<uint64_t>(p + 8);
+    info.size = get<uint64_t>(p + 16);
+    if (flags & kChunkHasHash) info.hash = utils::HashUtils::to_hex(p + kChunkHash, kHashSize);
+    if (flags & kChunkHasIv) info.iv = utils::HashUtils::to_hex(p + kChunkIv, kIvSize);
+    if (flags & kChunkHasFp) info.fingerprint = utils::HashUtils::to_hex(p + kChunkFp, kFpSize);
+    info.codec = compress::codec_from_id(p[kChunkCodec]);
+    info.cipher = crypto::suite_from_id(p[kChunkCipher]);
+    uint32_t ref = get<uint32_t>(p + kChunkRef);
+    if (flags & kChunkPacked) {
+        info.pack = string(get<uint32_t>(pack_record(ref)));
+        info.pack_offset = get<uint64_t>(p + 24);
+        info.pack_length = get<uint64_t>(p + 32);
+    } else {
+        info.uri = string(ref);
+    }
+    return info;
+}
+
+uint64_t BinaryManifest::leaf_record(uint64_t index) const {
+    if (index >= leaf_count()) {
+        throw std::out_of_range("Chunk " + std::to_string(index) + " out of range (" +
+                                std::to_string(leaf_count()) + " chunks)");
+    }
+    return tree() ? top_chunk_count_ + index : index;
+}
+
+int BinaryManifest::version() const {
+    return get<int32_t>(data_ + kHdrManifestVersion);
+}
+
+bool BinaryManifest::tree() const {
+    return get<uint32_t>(data_ + kHdrFlags) & kManifestTree;
+}
+
+std::string BinaryManifest::file_name() const {
+    return string(get<uint32_t>(data_ + kHdrFileName));
+}
+
+std::string BinaryManifest::merkle_root() const {
+    return string(get<uint32_t>(data_ + kHdrRoot));
+}
+
+std::string BinaryManifest::merkle_tree() const {
+    return string(get<uint32_t>(data_ + kHdrTree));
+}
+
+ShardInfo BinaryManifest::shard(uint64_t index) const {
+    if (index >= shard_count_) {
+        throw std::out_of_range("Shard " + std::to_string(index) + " out of range");
+    }
+    const uint8_t* p = data_ + shards_offset_ + index * kShardRecordSize;
+    ShardInfo info;
+    info.first_chunk = get<uint64_t>(p);
+    info.chunk_count = get<uint64_t>(p + 8);
+    info.root = string(get<uint32_t>(p + 16));
+    info.uri = string(get<uint32_t>(p + 20));
+    return info;
+}
+
+uint64_t BinaryManifest::leaf_count() const {
+    return tree() ? chunk_count_ - top_chunk_count_ : top_chunk_count_;
+}
+
+ChunkInfo BinaryManifest::leaf(uint64_t index) const {
+    return chunk(leaf_record(index));
+}
+
+std::string BinaryManifest::object_uri(uint64_t index) const {
+    const uint8_t* p = data_ + chunks_offset_ + leaf_record(index) * kChunkRecordSize;
+    uint32_t ref = get<uint32_t>(p + kChunkRef);
+    if (!(get<uint32_t>(p + kChunkFlags) & kChunkPacked)) return string(ref);
+    const uint8_t* pack = pack_record(ref);
+    if (get<uint32_t>(pack + 4) == kNone) {
+        throw std::runtime_error("Chunk " + std::to_string(index) + " references unknown pack " +
+                                 string(get<uint32_t>(pack)));
+    }
+    return string(get<uint32_t>(pack + 4));
+}
+
+Manifest BinaryManifest::to_manifest() const {
+    Manifest m;
+    m.file_name = file_name();
+    m.original_size = get<uint64_t>(data_ + kHdrOriginalSize);
+    m.mtime_ns = get<int64_t>(data_ + kHdrMtime);
+    m.chunk_size = get<uint64_t>(data_ + kHdrChunkBytes);
+    m.chunking = string(get<uint32_t>(data_ + kHdrChunking));
+    m.merkle_root = merkle_root();
+    m.merkle_tree = merkle_tree();
+    m.timestamp = string(get<uint32_t>(data_ + kHdrTimestamp));
+    m.version = version();
+    m.cipher = crypto::suite_from_id(get<uint32_t>(data_ + kHdrCipher));
+    m.tree = tree();
+
+    m.chunks.reserve(top_chunk_count_);
+    for (uint64_t i = 0; i < top_chunk_count_; i++) m.chunks.push_back(chunk(i));
+    m.files.resize(file_count_);
+    for (uint64_t i = 0; i < file_count_; i++) {
+        const uint8_t* p = data_ + files_offset_ + i * kFileRecordSize;
+        FileEntry& file = m.files[i];
+        file.path = string(get<uint32_t>(p));
+        file.directory = get<uint32_t>(p + 4) & kFileDirectory;
+        file.size = get<uint64_t>(p + 8);
+        file.mtime_ns = get<int64_t>(p + 16);
+        uint64_t first = get<uint64_t>(p + 24);
+        uint64_t count = get<uint64_t>(p + 32);
+        if (first > chunk_count_ || count > chunk_count_ - first) corrupt("file chunk range out of bounds");
+        file.chunks.reserve(count);
+        for (uint64_t c = first; c < first + count; c++) file.chunks.push_back(chunk(c));
+    }
+    for (uint64_t i = 0; i < pack_count_; i++) {
+        const uint8_t* pack = pack_record(static_cast<uint32_t>(i));
+        if (get<uint32_t>(pack + 4) != kNone) {
+            m.packs[string(get<uint32_t>(pack))] = string(get<uint32_t>(pack + 4));
+        }
+    }
+    m.shard_chunks = shard_chunks_;
+    for (uint64_t i = 0; i < shard_count_; i++) m.shards.push_back(shard(i));
+    m.validate();
+    return m;
+}
+
+} // namespace ledger
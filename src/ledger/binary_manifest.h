@@ -0,0 +1,89 @@
+#pragma once
+
+#include "manifest.h"
+#include "../utils/hash_utils.h"
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace ledger {
+
+// Compact manifest encoding, readable in place. Little-endian throughout:
+//
+//   header (144 bytes): "SBMF" || format version || section sizes and counts || scalar fields
+//   chunks:  chunk_count fixed-width records (raw hash, IV and fingerprint; URI and pack as indexes)
+//   files:   file_count records (path index, size, mtime, range of chunk records)
+//   packs:   pack_count (id index, URI index) pairs
+//   shards:  shard_count records (first chunk, chunk count, root index, URI index)
+//   strings: string_count + 1 u64 offsets into the string bytes that follow
+//
+// Sections start on 8-byte boundaries. Format version 1 files (128-byte
+// header, no shard table) are still read. Chunk records hold the top-level
+// chunks followed by each file's chunks in file order, so chunk i of the
+// Merkle leaf order is a single record lookup. Strings (names, URIs, pack
+// ids) are interned once. Converting from a Manifest and back is lossless.
+class BinaryManifest {
+public:
+    static std::vector<uint8_t> encode(const Manifest& manifest);
+    // True if `data` starts with the binary manifest magic
+    static bool detect(const uint8_t* data, size_t len);
+
+    // Takes ownership of an encoded buffer
+    explicit BinaryManifest(std::vector<uint8_t> data);
+    // Maps the file read-only (reads it where mmap is unavailable)
+    explicit BinaryManifest(const std::string& path);
+    ~BinaryManifest();
+
+    BinaryManifest(const BinaryManifest&) = delete;
+    BinaryManifest& operator=(const BinaryManifest&) = delete;
+
+    int version() const;
+    bool tree() const;
+    std::string file_name() const;
+    std::string merkle_root() const;
+    std::string merkle_tree() const;
+
+    // Sharded manifests list shards instead of holding chunks
+    uint64_t shard_chunks() const { return shard_chunks_; }
+    uint64_t shard_count() const { return shard_count_; }
+    ShardInfo shard(uint64_t index) const;
+
+    // Chunks held here, in Merkle leaf order (Manifest::ordered_chunks)
+    uint64_t leaf_count() const;
+    ChunkInfo leaf(uint64_t index) const;
+    // Object holding leaf `index`: its own URI or its pack's
+    std::string object_uri(uint64_t index) const;
+
+    // Decodes everything
+    Manifest to_manifest() const;
+
+private:
+    std::vector<uint8_t> owned_;
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    bool mapped_ = false;
+
+    uint64_t chunk_count_ = 0;
+    uint64_t top_chunk_count_ = 0;
+    uint64_t file_count_ = 0;
+    uint64_t pack_count_ = 0;
+    uint64_t string_count_ = 0;
+    uint64_t shard_chunks_ = 0;
+    uint64_t shard_count_ = 0;
+    uint64_t chunks_offset_ = 0;
+    uint64_t files_offset_ = 0;
+    uint64_t packs_offset_ = 0;
+    uint64_t shards_offset_ = 0;
+    uint64_t strings_offset_ = 0;
+    uint64_t string_bytes_offset_ = 0;
+    uint64_t string_bytes_ = 0;
+
+    void unmap();
+    void parse_header();
+    std::string string(uint32_t index) const;
+    ChunkInfo chunk(uint64_t record) const;
+    uint64_t leaf_record(uint64_t index) const;
+    const uint8_t* pack_record(uint32_t index) const;
+};
+
+} // namespace ledger
@@ -0,0 +1,216 @@
+#include "catalog.h"
+#include <stdexcept>
+
+#ifdef SECURE_BACKUP_HAVE_SQLITE
+#include <sqlite3.h>
+#endif
+
+namespace ledger {
+
+#ifdef SECURE_BACKUP_HAVE_SQLITE
+
+namespace {
+
+const char kSchema[] =
+    "CREATE TABLE IF NOT EXISTS events ("
+    "  seq INTEGER PRIMARY KEY,"
+    "  offset INTEGER NOT NULL,"
+    "  entry_hash TEXT NOT NULL,"
+    "  file_name TEXT NOT NULL,"
+    "  merkle_root TEXT NOT NULL,"
+    "  ts TEXT NOT NULL,"
+    "  manifest_url TEXT NOT NULL);"
+    "CREATE INDEX IF NOT EXISTS events_by_file ON events(file_name, seq);"
+    "CREATE INDEX IF NOT EXISTS events_by_ts ON events(ts, seq);"
+    "CREATE INDEX IF NOT EXISTS events_by_root ON events(merkle_root, seq);";
+
+const char kColumns[] = "seq, offset, entry_hash, file_name, merkle_root, ts, manifest_url";
+
+// Resets a statement whichever way the scope is left
+struct StatementScope {
+    sqlite3_stmt* stmt;
+    ~StatementScope() {
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
+    }
+};
+
+std::string column_text(sqlite3_stmt* stmt, int col) {
+    const unsigned char* text = sqlite3_column_text(stmt, col);
+    return text ? reinterpret_cast<const char*>(text) : "";
+}
+
+void bind_text(sqlite3_stmt* stmt, int index, const std::string& value) {
+    sqlite3_bind_text(stmt, index, value.data(), static_cast<int>(value.size()), SQLITE_TRANSIENT);
+}
+
+} // namespace
+
+std::unique_ptr<Catalog> Catalog::open(const std::string& path) {
+    sqlite3* db = nullptr;
+    if (sqlite3_open(path.c_str(), &db) != SQLITE_OK) {
+        std::string error = db ? sqlite3_errmsg(db) : "out of memory";
+        sqlite3_close(db);
+        throw std::runtime_error("Failed to open ledger catalog " + path + ": " + error);
+    }
+    return std::unique_ptr<Catalog>(new Catalog(db));
+}
+
+Catalog::Catalog(sqlite3* db) : db_(db) {
+    try {
+        // The log is the durable copy; the catalog can trade fsyncs for speed
+        exec("PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL;");
+        exec(kSchema);
+        std::string select = std::string("SELECT ") + kColumns + " FROM events ";
+        insert_ = prepare("INSERT OR REPLACE INTO events VALUES (?, ?, ?, ?, ?, ?, ?)");
+        last_ = prepare((select + "ORDER BY seq DESC LIMIT 1").c_str());
+        latest_for_ = prepare((select + "WHERE file_name = ?1 AND merkle_root <> '' "
+                                         "AND substr(manifest_url, 1, length(?2)) = ?2 ORDER BY seq DESC LIMIT 1").c_str());
+        latest_root_ = prepare((select + "WHERE merkle_root <> '' ORDER BY seq DESC LIMIT 1").c_str());
+        between_ = prepare((select + "WHERE ts >= ? AND ts <= ? ORDER BY ts, seq").c_str());
+        with_root_ = prepare((select + "WHERE merkle_root = ? ORDER BY seq").c_str());
+    } catch (...) {
+        close();
+        throw;
+    }
+}
+
+Catalog::~Catalog() {
+    close();
+}
+
+void Catalog::close() {
+    for (sqlite3_stmt* stmt : {insert_, last_, latest_for_, latest_root_, between_, with_root_}) {
+        sqlite3_finalize(stmt);
+    }
+    insert_ = last_ = latest_for_ = latest_root_ = between_ = with_root_ = nullptr;
+    sqlite3_close(db_);
+    db_ = nullptr;
+}
+
+void Catalog::exec(const char* sql) {
+    char* error = nullptr;
+    if (sqlite3_exec(db_, sql, nullptr, nullptr, &error) != SQLITE_OK) {
+        std::string message = error ? error : "unknown error";
+        sqlite3_free(error);
+        throw std::runtime_error("Ledger catalog query failed: " + message);
+    }
+}
+
+sqlite3_stmt* Catalog::prepare(const char* sql) {
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        throw std::runtime_error(std::string("Ledger catalog prepare failed: ") + sqlite3_errmsg(db_));
+    }
+    return stmt;
+}
+
+std::vector<CatalogEntry> Catalog::collect(sqlite3_stmt* stmt, size_t limit) {
+    std::vector<CatalogEntry> out;
+    int rc;
+    while (out.size() < limit && (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        CatalogEntry entry;
+        entry.seq = static_cast<uint64_t>(sqlite3_column_int64(stmt, 0));
+        entry.offset = static_cast<uint64_t>(sqlite3_column_int64(stmt, 1));
+        entry.entry_hash = column_text(stmt, 2);
+        entry.file_name = column_text(stmt, 3);
+        entry.merkle_root = column_text(stmt, 4);
+        entry.ts = column_text(stmt, 5);
+        entry.manifest_url = column_text(stmt, 6);
+        out.push_back(std::move(entry));
+    }
+    if (out.size() < limit && rc != SQLITE_DONE) {
+        throw std::runtime_error(std::string("Ledger catalog query failed: ") + sqlite3_errmsg(db_));
+    }
+    return out;
+}
+
+bool Catalog::last(CatalogEntry& out) {
+    StatementScope scope{last_};
+    auto rows = collect(last_, 1);
+    if (rows.empty()) return false;
+    out = std::move(rows[0]);
+    return true;
+}
+
+void Catalog::add(const std::vector<CatalogEntry>& entries) {
+    exec("BEGIN");
+    try {
+        for (const auto& entry : entries) {
+            StatementScope scope{insert_};
+            sqlite3_bind_int64(insert_, 1, static_cast<sqlite3_int64>(entry.seq));
+            sqlite3_bind_int64(insert_, 2, static_cast<sqlite3_int64>(entry.offset));
+            bind_text(insert_, 3, entry.entry_hash);
+            bind_text(insert_, 4, entry.file_name);
+            bind_text(insert_, 5, entry.merkle_root);
+            bind_text(insert_, 6, entry.ts);
+            bind_text(insert_, 7, entry.manifest_url);
+            if (sqlite3_step(insert_) != SQLITE_DONE) {
+                throw std::runtime_error(std::string("Ledger catalog insert failed: ") + sqlite3_errmsg(db_));
+            }
+        }
+        exec("COMMIT");
+    } catch (...) {
+        sqlite3_exec(db_, "ROLLBACK", nullptr, nullptr, nullptr);
+        throw;
+    }
+}
+
+void Catalog::clear() {
+    exec("DELETE FROM events");
+}
+
+bool Catalog::latest_for(const std::string& file_name, const std::string& url_prefix, CatalogEntry& out) {
+    StatementScope scope{latest_for_};
+    bind_text(latest_for_, 1, file_name);
+    bind_text(latest_for_, 2, url_prefix);
+    auto rows = collect(latest_for_, 1);
+    if (rows.empty()) return false;
+    out = std::move(rows[0]);
+    return true;
+}
+
+bool Catalog::latest_with_root(CatalogEntry& out) {
+    StatementScope scope{latest_root_};
+    auto rows = collect(latest_root_, 1);
+    if (rows.empty()) return false;
+    out = std::move(rows[0]);
+    return true;
+}
+
+std::vector<CatalogEntry> Catalog::between(const std::string& from_ts, const std::string& to_ts) {
+    StatementScope scope{between_};
+    bind_text(between_, 1, from_ts);
+    bind_text(between_, 2, to_ts);
+    return collect(between_, SIZE_MAX);
+}
+
+std::vector<CatalogEntry> Catalog::with_root(const std::string& merkle_root) {
+    StatementScope scope{with_root_};
+    bind_text(with_root_, 1, merkle_root);
+    return collect(with_root_, SIZE_MAX);
+}
+
+#else
+
+std::unique_ptr<Catalog> Catalog::open(const std::string&) {
+    return nullptr;
+}
+
+Catalog::Catalog(sqlite3* db) : db_(db) {}
+Catalog::~Catalog() {}
+void Catalog::close() {}
+bool Catalog::last(CatalogEntry&) { return false; }
+void Catalog::add(const std::vector<CatalogEntry>&) {}
+void Catalog::clear() {}
+bool Catalog::latest_for(const std::string&, CatalogEntry&) { return false; }
+bool Catalog::latest_with_root(CatalogEntry&) { return false; }
+std::vector<CatalogEntry> Catalog::between(const std::string&, const std::string&) { return {}; }
+std::vector<CatalogEntry> Catalog::with_root(const std::string&) { return {}; }
+void Catalog::exec(const char*) {}
+sqlite3_stmt* Catalog::prepare(const char*) { return nullptr; }
+std::vector<CatalogEntry> Catalog::collect(sqlite3_stmt*, size_t) { return {}; }
+
+#endif
+
+} // namespace ledger
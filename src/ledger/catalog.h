@@ -0,0 +1,67 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+namespace ledger {
+
+// One ledger event as the catalog indexes it
+struct CatalogEntry {
+    uint64_t seq = 0;           // position in the hash chain, from 0
+    uint64_t offset = 0;        // record offset in the ledger log
+    std::string entry_hash;     // hex
+    std::string file_name;
+    std::string merkle_root;
+    std::string ts;             // ISO 8601 UTC, so it orders as text
+    std::string manifest_url;   // where the manifest was uploaded, if known
+};
+
+// SQLite index over the ledger log, answering lookups by name, time and
+// root without reading the log. It holds nothing the log does not, so it
+// can be dropped and rebuilt at any time; Ledger keeps it in step.
+class Catalog {
+public:
+    // nullptr when built without SQLite
+    static std::unique_ptr<Catalog> open(const std::string& path);
+    ~Catalog();
+
+    Catalog(const Catalog&) = delete;
+    Catalog& operator=(const Catalog&) = delete;
+
+    bool last(CatalogEntry& out);
+
+    // Inserts in one transaction
+    void add(const std::vector<CatalogEntry>& entries);
+    void clear();
+
+    // Latest entry for `file_name` that has a Merkle root and a manifest URL
+    // starting with `url_prefix` (any if empty), like the log scan
+    bool latest_for(const std::string& file_name, const std::string& url_prefix, CatalogEntry& out);
+    bool latest_with_root(CatalogEntry& out);
+    // Inclusive on both ends
+    std::vector<CatalogEntry> between(const std::string& from_ts, const std::string& to_ts);
+    std::vector<CatalogEntry> with_root(const std::string& merkle_root);
+
+private:
+    explicit Catalog(sqlite3* db);
+
+    sqlite3* db_;
+    sqlite3_stmt* insert_ = nullptr;
+    sqlite3_stmt* latest_for_ = nullptr;
+    sqlite3_stmt* latest_root_ = nullptr;
+    sqlite3_stmt* between_ = nullptr;
+    sqlite3_stmt* with_root_ = nullptr;
+    sqlite3_stmt* last_ = nullptr;
+
+    void close();
+    void exec(const char* sql);
+    sqlite3_stmt* prepare(const char* sql);
+    std::vector<CatalogEntry> collect(sqlite3_stmt* stmt, size_t limit);
+};
+
+} // namespace ledger
@@ -1,40 +1,353 @@
 #include "ledger.h"
+#include "../metrics/metrics.h"
 #include "../utils/file_utils.h"
 #include "../utils/json_utils.h"
-#include <openssl/sha.h>
-#include <sstream>
-#include <iomanip>
+#include <cstring>
 #include <ctime>
 #include <iostream>
+#include <stdexcept>
 
 namespace ledger {
 
-Ledger::Ledger(const std::string& db_path) : db_path_(db_path) {
-    load();
+namespace {
+
+const char kLogMagic[4] = {'S', 'B', 'L', 'G'};
+const char kTailMagic[4] = {'S', 'B', 'L', 'T'};
+const char kCheckpointMagic[4] = {'S', 'B', 'L', 'C'};
+const uint32_t kVersion = 1;
+const uint64_t kHeaderSize = 16;
+const size_t kFrameSize = 16;       // body length before and after the body
+const size_t kBodyFixedSize = 68;   // entry_hash(32) prev_hash(32) ts_len(4)
+// Pointer files: magic(4) version(4) fields checksum(8)
+const size_t kTailFields = 56;         // count(8) committed(8) last_offset(8) last_hash(32)
+const size_t kCheckpointFields = 48;   // count(8) offset(8) hash(32)
+const size_t kCatalogBatch = 4096;
+
+void check_stream(const std::ios& stream, const std::string& what) {
+    if (!stream) {
+        throw std::runtime_error("Ledger I/O failed: " + what);
+    }
 }
 
-void Ledger::load() {
-    if (utils::FileUtils::exists(db_path_)) {
-        try {
-            ledger_data_ = utils::JsonUtils::read_from_file(db_path_);
-        } catch (...) {
-            ledger_data_ = json::array();
+// Small fixed-size files replaced atomically; the checksum (truncated
+// SHA-256) rejects torn or foreign contents
+void write_pointer(const std::string& path, const char magic[4], const uint8_t* fields, size_t len) {
+    std::vector<uint8_t> buf(8 + len + 8);
+    std::memcpy(buf.data(), magic, 4);
+    std::memcpy(buf.data() + 4, &kVersion, sizeof(kVersion));
+    std::memcpy(buf.data() + 8, fields, len);
+    utils::Digest check = utils::HashUtils::sha256(buf.data(), 8 + len);
+    std::memcpy(buf.data() + 8 + len, check.data(), 8);
+    utils::FileUtils::write_file_atomic(path, buf);
+}
+
+bool read_pointer(const std::string& path, const char magic[4], uint8_t* fields, size_t len) {
+    std::ifstream in(path, std::ios::binary);
+    std::vector<uint8_t> buf(8 + len + 8);
+    in.read(reinterpret_cast<char*>(buf.data()), static_cast<std::streamsize>(buf.size()));
+    if (!in || in.peek() != std::ifstream::traits_type::eof()) return false;
+
+    uint32_t version;
+    std::memcpy(&version, buf.data() + 4, sizeof(version));
+    utils::Digest check = utils::HashUtils::sha256(buf.data(), 8 + len);
+    if (std::memcmp(buf.data(), magic, 4) != 0 || version != kVersion ||
+        std::memcmp(check.data(), buf.data() + 8 + len, 8) != 0) {
+        return false;
+    }
+    std::memcpy(fields, buf.data() + 8, len);
+    return true;
+}
+
+CatalogEntry catalog_entry(uint64_t seq, uint64_t offset, const utils::Digest& entry_hash, const std::string& ts,
+                           const std::string& payload_str) {
+    CatalogEntry entry;
+    entry.seq = seq;
+    entry.offset = offset;
+    entry.entry_hash = utils::HashUtils::to_hex(entry_hash);
+    entry.ts = ts;
+    json payload = json::parse(payload_str, nullptr, false);
+    if (payload.is_object()) {
+        entry.file_name = payload.value("file_name", "");
+        entry.merkle_root = payload.value("merkle_root", "");
+        entry.manifest_url = payload.value("manifest_url", "");
+    }
+    return entry;
+}
+
+} // namespace
+
+Ledger::Ledger(const std::string& db_path)
+    : db_path_(db_path), tail_path_(db_path + ".tail"), checkpoint_path_(db_path + ".checkpoint"),
+      catalog_path_(db_path + ".catalog") {
+    open();
+    open_catalog();
+}
+
+void Ledger::open() {
+    fs::path parent = fs::path(db_path_).parent_path();
+    if (!parent.empty()) {
+        utils::FileUtils::create_directory(parent.string());
+    }
+
+    bool fresh = !utils::FileUtils::exists(db_path_);
+    if (fresh) {
+        std::ofstream out(db_path_, std::ios::binary | std::ios::trunc);
+        uint8_t header[kHeaderSize] = {};
+        std::memcpy(header, kLogMagic, 4);
+        std::memcpy(header + 4, &kVersion, sizeof(kVersion));
+        out.write(reinterpret_cast<const char*>(header), sizeof(header));
+        check_stream(out, "create " + db_path_);
+    }
+
+    log_.open(db_path_, std::ios::in | std::ios::out | std::ios::binary);
+    check_stream(log_, "open " + db_path_);
+    char header[kHeaderSize];
+    uint32_t version = 0;
+    log_.read(header, sizeof(header));
+    std::memcpy(&version, header + 4, sizeof(version));
+    if (!log_ || std::memcmp(header, kLogMagic, 4) != 0 || version != kVersion) {
+        throw std::runtime_error("Not a ledger log (or unsupported version): " + db_path_);
+    }
+
+    if (fresh) {
+        tail_ = Tail();
+        tail_.committed = kHeaderSize;
+        std::string legacy = fs::path(db_path_).replace_extension(".json").string();
+        if (legacy != db_path_ && utils::FileUtils::exists(legacy)) {
+            import_json(legacy);
+        }
+        write_tail();
+        return;
+    }
+
+    uint64_t size = fs::file_size(db_path_);
+    if (!read_tail() || tail_.committed > size) {
+        std::cerr << "WARNING: Ledger commit pointer for " << db_path_ << " is unreadable, rescanning the log." << std::endl;
+        tail_ = Tail();
+        tail_.committed = kHeaderSize;
+        recover(kHeaderSize);
+    } else if (size > tail_.committed) {
+        recover(tail_.committed);
+    }
+}
+
+void Ledger::import_json(const std::string& json_path) {
+    json entries = utils::JsonUtils::read_from_file(json_path);
+    if (!entries.is_array()) {
+        throw std::runtime_error("Legacy ledger is not a JSON array: " + json_path);
+    }
+    // Hashes are copied as recorded, so a broken legacy chain still fails verify_chain
+    for (const auto& entry : entries) {
+        utils::Digest prev_hash = utils::HashUtils::digest_from_hex(entry.at("prev_hash"));
+        utils::Digest entry_hash = utils::HashUtils::digest_from_hex(entry.at("entry_hash"));
+        uint64_t offset = tail_.committed;
+        tail_.committed = write_record(prev_hash, entry.at("payload").dump(), entry.at("ts"), entry_hash);
+        tail_.count++;
+        tail_.last_offset = offset;
+        tail_.last_hash = entry_hash;
+    }
+    utils::FileUtils::sync(db_path_);
+    std::cerr << "Imported " << tail_.count << " ledger entries from " << json_path << std::endl;
+}
+
+void Ledger::open_catalog() {
+    try {
+        catalog_ = Catalog::open(catalog_path_);
+    } catch (const std::exception& e) {
+        disable_catalog(e);
+        return;
+    }
+    sync_catalog();
+}
+
+void Ledger::sync_catalog() {
+    if (!catalog_) return;
+    try {
+        // Resume after the newest indexed entry if the log still holds it;
+        // otherwise the catalog is stale and is rebuilt
+        uint64_t seq = 0;
+        uint64_t offset = kHeaderSize;
+        CatalogEntry newest;
+        Record record;
+        if (catalog_->last(newest)) {
+            if (newest.seq < tail_.count && read_indexed(newest, record)) {
+                seq = newest.seq + 1;
+                offset = record.end;
+            } else {
+                std::cerr << "WARNING: Ledger catalog does not match the log, rebuilding it." << std::endl;
+                catalog_->clear();
+            }
+        }
+
+        std::vector<CatalogEntry> batch;
+        while (offset < tail_.committed && read_record(offset, tail_.committed, record)) {
+            batch.push_back(catalog_entry(seq++, offset, record.entry_hash, record.ts, record.payload));
+            offset = record.end;
+            if (batch.size() == kCatalogBatch) {
+                catalog_->add(batch);
+                batch.clear();
+            }
         }
-    } else {
-        ledger_data_ = json::array();
+        catalog_->add(batch);
+    } catch (const std::exception& e) {
+        disable_catalog(e);
     }
 }
 
-void Ledger::save() {
-    utils::JsonUtils::write_to_file(db_path_, ledger_data_);
+void Ledger::disable_catalog(const std::exception& e) {
+    std::cerr << "WARNING: Ledger catalog unavailable (" << e.what() << "), lookups will scan the log." << std::endl;
+    catalog_.reset();
 }
 
-void Ledger::append_event(const json& payload) {
-    std::string prev_hash = "0000000000000000000000000000000000000000000000000000000000000000";
-    if (!ledger_data_.empty()) {
-        prev_hash = ledger_data_.back()["entry_hash"];
+bool Ledger::read_indexed(const CatalogEntry& entry, Record& out) {
+    return read_record(entry.offset, tail_.committed, out) &&
+           utils::HashUtils::to_hex(out.entry_hash) == entry.entry_hash;
+}
+
+std::vector<CatalogEntry> Ledger::scan(const std::function<bool(const CatalogEntry&)>& match) {
+    std::vector<CatalogEntry> found;
+    Record record;
+    uint64_t seq = 0;
+    for (uint64_t offset = kHeaderSize; offset < tail_.committed && read_record(offset, tail_.committed, record);
+         offset = record.end) {
+        CatalogEntry entry = catalog_entry(seq++, offset, record.entry_hash, record.ts, record.payload);
+        if (match(entry)) {
+            found.push_back(std::move(entry));
+        }
+    }
+    return found;
+}
+
+bool Ledger::read_tail() {
+    uint8_t fields[kTailFields];
+    if (!read_pointer(tail_path_, kTailMagic, fields, sizeof(fields))) return false;
+    std::memcpy(&tail_.count, fields, 8);
+    std::memcpy(&tail_.committed, fields + 8, 8);
+    std::memcpy(&tail_.last_offset, fields + 16, 8);
+    std::memcpy(tail_.last_hash.data(), fields + 24, 32);
+    return tail_.committed >= kHeaderSize;
+}
+
+void Ledger::write_tail() {
+    uint8_t fields[kTailFields];
+    std::memcpy(fields, &tail_.count, 8);
+    std::memcpy(fields + 8, &tail_.committed, 8);
+    std::memcpy(fields + 16, &tail_.last_offset, 8);
+    std::memcpy(fields + 24, tail_.last_hash.data(), 32);
+    write_pointer(tail_path_, kTailMagic, fields, sizeof(fields));
+}
+
+bool Ledger::read_checkpoint(Checkpoint& out) {
+    uint8_t fields[kCheckpointFields];
+    if (!read_pointer(checkpoint_path_, kCheckpointMagic, fields, sizeof(fields))) return false;
+    std::memcpy(&out.count, fields, 8);
+    std::memcpy(&out.offset, fields + 8, 8);
+    std::memcpy(out.hash.data(), fields + 16, 32);
+    return true;
+}
+
+void Ledger::write_checkpoint(const Checkpoint& checkpoint) {
+    uint8_t fields[kCheckpointFields];
+    std::memcpy(fields, &checkpoint.count, 8);
+    std::memcpy(fields + 8, &checkpoint.offset, 8);
+    std::memcpy(fields + 16, checkpoint.hash.data(), 32);
+    write_pointer(checkpoint_path_, kCheckpointMagic, fields, sizeof(fields));
+}
+
+void Ledger::recover(uint64_t offset) {
+    uint64_t size = fs::file_size(db_path_);
+    Record record;
+    while (offset < size && read_record(offset, size, record) && record.prev_hash == tail_.last_hash &&
+           calculate_entry_hash(utils::HashUtils::to_hex(record.prev_hash), record.payload, record.ts) ==
+               record.entry_hash) {
+        tail_.count++;
+        tail_.last_offset = offset;
+        tail_.last_hash = record.entry_hash;
+        offset = record.end;
     }
+    tail_.committed = offset;
+
+    if (size > offset) {
+        std::cerr << "WARNING: Dropping " << size - offset << " bytes of incomplete ledger record from "
+                  << db_path_ << std::endl;
+        log_.close();
+        fs::resize_file(db_path_, offset);
+        utils::FileUtils::sync(db_path_);
+        log_.open(db_path_, std::ios::in | std::ios::out | std::ios::binary);
+        check_stream(log_, "open " + db_path_);
+    }
+    write_tail();
+}
 
+bool Ledger::read_record(uint64_t offset, uint64_t limit, Record& out) {
+    log_.clear();
+    if (offset < kHeaderSize || offset + kFrameSize > limit) return false;
+
+    uint64_t len = 0;
+    log_.seekg(static_cast<std::streamoff>(offset));
+    log_.read(reinterpret_cast<char*>(&len), sizeof(len));
+    if (!log_ || len < kBodyFixedSize || len > limit - offset - kFrameSize) {
+        log_.clear();
+        return false;
+    }
+    std::string body(len, '\0');
+    uint64_t trailer = 0;
+    log_.read(&body[0], static_cast<std::streamsize>(len));
+    log_.read(reinterpret_cast<char*>(&trailer), sizeof(trailer));
+    if (!log_ || trailer != len) {
+        log_.clear();
+        return false;
+    }
+
+    uint32_t ts_len;
+    std::memcpy(out.entry_hash.data(), body.data(), 32);
+    std::memcpy(out.prev_hash.data(), body.data() + 32, 32);
+    std::memcpy(&ts_len, body.data() + 64, sizeof(ts_len));
+    if (ts_len > len - kBodyFixedSize) return false;
+    out.ts = body.substr(kBodyFixedSize, ts_len);
+    out.payload = body.substr(kBodyFixedSize + ts_len);
+    out.offset = offset;
+    out.end = offset + kFrameSize + len;
+    return true;
+}
+
+bool Ledger::read_record_before(uint64_t end, Record& out) {
+    log_.clear();
+    if (end < kHeaderSize + kFrameSize + kBodyFixedSize) return false;
+    uint64_t len = 0;
+    log_.seekg(static_cast<std::streamoff>(end - sizeof(len)));
+    log_.read(reinterpret_cast<char*>(&len), sizeof(len));
+    if (!log_ || len > end - kHeaderSize - kFrameSize) {
+        log_.clear();
+        return false;
+    }
+    return read_record(end - kFrameSize - len, end, out) && out.end == end;
+}
+
+uint64_t Ledger::write_record(const utils::Digest& prev_hash, const std::string& payload_str, const std::string& ts,
+                              const utils::Digest& entry_hash) {
+    uint64_t len = kBodyFixedSize + ts.size() + payload_str.size();
+    uint32_t ts_len = static_cast<uint32_t>(ts.size());
+    std::vector<char> frame(kFrameSize + len);
+    char* p = frame.data();
+    std::memcpy(p, &len, 8);
+    std::memcpy(p + 8, entry_hash.data(), 32);
+    std::memcpy(p + 40, prev_hash.data(), 32);
+    std::memcpy(p + 72, &ts_len, 4);
+    std::memcpy(p + 76, ts.data(), ts.size());
+    std::memcpy(p + 76 + ts.size(), payload_str.data(), payload_str.size());
+    std::memcpy(p + 8 + len, &len, 8);
+
+    log_.clear();
+    log_.seekp(static_cast<std::streamoff>(tail_.committed));
+    log_.write(frame.data(), static_cast<std::streamsize>(frame.size()));
+    log_.flush();
+    check_stream(log_, "append to " + db_path_);
+    return tail_.committed + frame.size();
+}
+
+void Ledger::append_event(const json& payload) {
+    metrics::ScopedTimer timer(metrics::Stage::LedgerAppend);
     // Get current timestamp
     std::time_t now = std::time(nullptr);
     char buf[100];
@@ -42,65 +355,158 @@ void Ledger::append_event(const json& payload) {
     std::string ts = buf;
 
     std::string payload_str = payload.dump();
-    std::string entry_hash = calculate_entry_hash(prev_hash, payload_str, ts);
+    utils::Digest entry_hash = calculate_entry_hash(utils::HashUtils::to_hex(tail_.last_hash), payload_str, ts);
 
-    json entry;
-    entry["prev_hash"] = prev_hash;
-    entry["payload"] = payload;
-    entry["ts"] = ts;
-    entry["entry_hash"] = entry_hash;
+    // The record is durable before the commit pointer moves past it
+    uint64_t offset = tail_.committed;
+    uint64_t end = write_record(tail_.last_hash, payload_str, ts, entry_hash);
+    timer.add_bytes(end - offset);
+    utils::FileUtils::sync(db_path_);
+    tail_.count++;
+    tail_.committed = end;
+    tail_.last_offset = offset;
+    tail_.last_hash = entry_hash;
+    write_tail();
 
-    ledger_data_.push_back(entry);
-    save();
+    if (catalog_) {
+        try {
+            catalog_->add({catalog_entry(tail_.count - 1, offset, entry_hash, ts, payload_str)});
+        } catch (const std::exception& e) {
+            disable_catalog(e);
+        }
+    }
 }
 
 std::string Ledger::get_latest_root() {
-    if (ledger_data_.empty()) return "";
-    // Assuming the payload contains "merkle_root"
+    CatalogEntry entry;
+    if (catalog_ && catalog_->latest_with_root(entry)) {
+        return entry.merkle_root;
+    }
     // Search backwards for the last backup event
-    for (auto it = ledger_data_.rbegin(); it != ledger_data_.rend(); ++it) {
-        if ((*it)["payload"].contains("merkle_root")) {
-            return (*it)["payload"]["merkle_root"];
+    Record record;
+    for (uint64_t end = tail_.committed; read_record_before(end, record); end = record.offset) {
+        json payload = json::parse(record.payload);
+        if (payload.contains("merkle_root")) {
+            return payload["merkle_root"];
         }
     }
     return "";
 }
 
-bool Ledger::verify_chain() {
-    std::string prev_hash = "0000000000000000000000000000000000000000000000000000000000000000";
-    for (const auto& entry : ledger_data_) {
-        if (entry["prev_hash"] != prev_hash) {
+bool Ledger::find_latest_manifest(const std::string& file_name, const std::string& url_prefix, json& manifest_out) {
+    Record record;
+    CatalogEntry entry;
+    if (catalog_) {
+        if (!catalog_->latest_for(file_name, url_prefix, entry)) return false;
+        if (read_indexed(entry, record)) {
+            manifest_out = json::parse(record.payload);
+            return true;
+        }
+        std::cerr << "WARNING: Ledger catalog entry " << entry.seq << " does not match the log, scanning." << std::endl;
+    }
+    for (uint64_t end = tail_.committed; read_record_before(end, record); end = record.offset) {
+        json payload = json::parse(record.payload);
+        if (payload.contains("merkle_root") && payload.value("file_name", "") == file_name &&
+            payload.value("manifest_url", "").compare(0, url_prefix.size(), url_prefix) == 0) {
+            manifest_out = std::move(payload);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Ledger::find_latest(const std::string& file_name, CatalogEntry& out) {
+    if (catalog_) {
+        return catalog_->latest_for(file_name, "", out);
+    }
+    Record record;
+    uint64_t seq = tail_.count;
+    for (uint64_t end = tail_.committed; read_record_before(end, record); end = record.offset) {
+        CatalogEntry entry = catalog_entry(--seq, record.offset, record.entry_hash, record.ts, record.payload);
+        if (!entry.merkle_root.empty() && entry.file_name == file_name) {
+            out = std::move(entry);
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<CatalogEntry> Ledger::find_between(const std::string& from_ts, const std::string& to_ts) {
+    if (catalog_) {
+        return catalog_->between(from_ts, to_ts);
+    }
+    return scan([&](const CatalogEntry& entry) { return entry.ts >= from_ts && entry.ts <= to_ts; });
+}
+
+std::vector<CatalogEntry> Ledger::find_by_root(const std::string& merkle_root) {
+    if (catalog_) {
+        return catalog_->with_root(merkle_root);
+    }
+    return scan([&](const CatalogEntry& entry) { return entry.merkle_root == merkle_root; });
+}
+
+bool Ledger::verify_chain(bool full) {
+    metrics::ScopedTimer timer(metrics::Stage::LedgerVerify);
+    // Resume after the last verified entry, provided the log still holds
+    // that entry at the recorded offset
+    Checkpoint start;
+    start.offset = kHeaderSize;
+    Checkpoint saved;
+    Record record;
+    if (!full && read_checkpoint(saved) && saved.count <= tail_.count && saved.offset <= tail_.committed) {
+        if (saved.count == 0 ||
+            (read_record_before(saved.offset, record) && record.entry_hash == saved.hash)) {
+            start = saved;
+        } else {
+            std::cerr << "WARNING: Ledger checkpoint does not match the log, verifying from genesis." << std::endl;
+        }
+    }
+
+    Checkpoint at = start;
+    while (at.offset < tail_.committed) {
+        if (!read_record(at.offset, tail_.committed, record) || record.prev_hash != at.hash) {
             return false;
         }
-        std::string calculated = calculate_entry_hash(
-            entry["prev_hash"], 
-            entry["payload"].dump(), 
-            entry["ts"]
-        );
-        if (calculated != entry["entry_hash"]) {
+        // The hash input keeps the hex text that the original JSON ledger used
+        if (calculate_entry_hash(utils::HashUtils::to_hex(at.hash), record.payload, record.ts) != record.entry_hash) {
             return false;
         }
-        prev_hash = entry["entry_hash"];
+        timer.add_bytes(record.end - record.offset);
+        at.hash = record.entry_hash;
+        at.offset = record.end;
+        at.count++;
+    }
+    if (at.count != tail_.count || at.hash != tail_.last_hash) {
+        return false;
+    }
+    last_verified_ = at.count - start.count;
+    if (at.count != start.count || full) {
+        write_checkpoint(at);
     }
     return true;
 }
 
-std::string Ledger::calculate_entry_hash(const std::string& prev_hash, const std::string& payload_str, const std::string& ts) {
-    return sha256(prev_hash + payload_str + ts);
+json Ledger::export_json() {
+    json entries = json::array();
+    Record record;
+    for (uint64_t offset = kHeaderSize; offset < tail_.committed && read_record(offset, tail_.committed, record);
+         offset = record.end) {
+        json entry;
+        entry["prev_hash"] = utils::HashUtils::to_hex(record.prev_hash);
+        entry["payload"] = json::parse(record.payload);
+        entry["ts"] = record.ts;
+        entry["entry_hash"] = utils::HashUtils::to_hex(record.entry_hash);
+        entries.push_back(std::move(entry));
+    }
+    return entries;
 }
 
-std::string Ledger::sha256(const std::string& data) {
-    unsigned char hash[SHA256_DIGEST_LENGTH];
-    SHA256_CTX sha256;
-    SHA256_Init(&sha256);
-    SHA256_Update(&sha256, data.c_str(), data.size());
-    SHA256_Final(hash, &sha256);
-
-    std::stringstream ss;
-    for (int i = 0; i < SHA256_DIGEST_LENGTH; i++) {
-        ss << std::hex << std::setw(2) << std::setfill('0') << (int)hash[i];
-    }
-    return ss.str();
+utils::Digest Ledger::calculate_entry_hash(const std::string& prev_hash, const std::string& payload_str, const std::string& ts) {
+    utils::Sha256 sha;
+    sha.update(reinterpret_cast<const uint8_t*>(prev_hash.data()), prev_hash.size());
+    sha.update(reinterpret_cast<const uint8_t*>(payload_str.data()), payload_str.size());
+    sha.update(reinterpret_cast<const uint8_t*>(ts.data()), ts.size());
+    return sha.final_digest();
 }
 
 } // namespace ledger
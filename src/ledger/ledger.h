@@ -1,34 +1,132 @@
 #pragma once
 
+#include "catalog.h"
+#include "../utils/hash_utils.h"
 #include <string>
 #include <vector>
+#include <fstream>
+#include <memory>
+#include <functional>
 #include <nlohmann/json.hpp>
 
 using json = nlohmann::json;
 
 namespace ledger {
 
+// Hash-chained event log, kept as an append-only file of framed records:
+//
+//   header: "SBLG" || version (u32) || reserved (u64)
+//   record: body length (u64) || body || body length (u64)
+//   body:   entry_hash[32] || prev_hash[32] || ts length (u32) || ts || payload JSON
+//
+// entry_hash = SHA-256(hex(prev_hash) || payload || ts). The trailing length
+// lets readers walk backwards from the end.
+//
+// "<log>.tail" holds the commit pointer (entry count, committed length, last
+// record offset and hash). It is replaced atomically after each fsync'd
+// append, so opening and appending cost O(1). Bytes past the committed length
+// are a torn or unacknowledged append: complete records that extend the chain
+// are kept, anything else is cut off.
+//
+// "<log>.checkpoint" records the last verified entry (count, hash, end offset)
+// so verify_chain only rehashes entries appended since.
+//
+// "<log>.catalog" is a SQLite index of the entries (see Catalog) used for
+// lookups. It is brought up to date on open, rebuilt if it disagrees with the
+// log, and the lookups fall back to scanning the log when it is unavailable.
 class Ledger {
 public:
-    Ledger(const std::string& db_path);
-    
+    // A legacy JSON ledger with the same stem ("ledger.json") is imported on first open
+    explicit Ledger(const std::string& db_path);
+
     // Append a new event (e.g., backup manifest)
     void append_event(const json& payload);
-    
+
     // Get the latest Merkle root from the ledger (if applicable)
     std::string get_latest_root();
-    
-    // Verify the hash chain integrity
-    bool verify_chain();
+
+    // Latest manifest recorded for `file_name` whose manifest URL starts with
+    // `url_prefix` (any if empty); false if there is none
+    bool find_latest_manifest(const std::string& file_name, const std::string& url_prefix, json& manifest_out);
+
+    // Latest backup entry for `file_name`; false if there is none
+    bool find_latest(const std::string& file_name, CatalogEntry& out);
+
+    // Entries stamped within [from_ts, to_ts], oldest first
+    std::vector<CatalogEntry> find_between(const std::string& from_ts, const std::string& to_ts);
+
+    // Entries whose snapshot has `merkle_root`, oldest first
+    std::vector<CatalogEntry> find_by_root(const std::string& merkle_root);
+
+    // Verify the hash chain integrity from the last checkpoint, or from
+    // genesis when `full` is set; a passing run moves the checkpoint
+    bool verify_chain(bool full = false);
+
+    // Entries hashed by the last verify_chain call
+    uint64_t last_verified() const { return last_verified_; }
+
+    // Every entry as {prev_hash, payload, ts, entry_hash}, oldest first
+    json export_json();
+
+    uint64_t size() const { return tail_.count; }
+
+    bool indexed() const { return catalog_ != nullptr; }
 
 private:
+    struct Tail {
+        uint64_t count = 0;
+        uint64_t committed = 0;     // log bytes that hold acknowledged records
+        uint64_t last_offset = 0;   // start of the newest record; 0 if none
+        utils::Digest last_hash{};
+    };
+
+    struct Checkpoint {
+        uint64_t count = 0;
+        uint64_t offset = 0;        // end of the last verified record
+        utils::Digest hash{};
+    };
+
+    struct Record {
+        uint64_t offset = 0;
+        uint64_t end = 0;
+        utils::Digest entry_hash;
+        utils::Digest prev_hash;
+        std::string ts;
+        std::string payload;
+    };
+
     std::string db_path_;
-    json ledger_data_;
-    
-    void load();
-    void save();
-    std::string calculate_entry_hash(const std::string& prev_hash, const std::string& payload_str, const std::string& ts);
-    std::string sha256(const std::string& data);
+    std::string tail_path_;
+    std::string checkpoint_path_;
+    std::string catalog_path_;
+    std::fstream log_;
+    Tail tail_;
+    std::unique_ptr<Catalog> catalog_;
+    uint64_t last_verified_ = 0;
+
+    void open();
+    void open_catalog();
+    // Indexes entries missing from the catalog; drops it on failure
+    void sync_catalog();
+    void disable_catalog(const std::exception& e);
+    // The log record behind a catalog row, if it still matches
+    bool read_indexed(const CatalogEntry& entry, Record& out);
+    // Forward scan used when there is no catalog
+    std::vector<CatalogEntry> scan(const std::function<bool(const CatalogEntry&)>& match);
+    void import_json(const std::string& json_path);
+    bool read_tail();
+    void write_tail();
+    bool read_checkpoint(Checkpoint& out);
+    void write_checkpoint(const Checkpoint& checkpoint);
+    // Adopts complete chained records from `offset` on and truncates the rest
+    void recover(uint64_t offset);
+    // False if the bytes at `offset` are not a whole record
+    bool read_record(uint64_t offset, uint64_t limit, Record& out);
+    bool read_record_before(uint64_t end, Record& out);
+    // Writes a record at the committed length (not yet synced); returns its end
+    uint64_t write_record(const utils::Digest& prev_hash, const std::string& payload_str, const std::string& ts,
+                          const utils::Digest& entry_hash);
+    utils::Digest calculate_entry_hash(const std::string& prev_hash, const std::string& payload_str, const std::string& ts);
 };
 
 } // namespace ledger
@@ -1,26 +1,196 @@
 #include "manifest.h"
+#include <algorithm>
+#include <stdexcept>
 
 namespace ledger {
 
+namespace {
+
+// One component of a snapshot path
+bool valid_entry_name(const std::string& name) {
+    return !name.empty() && name != "." && name != ".." && name.find('/') == std::string::npos;
+}
+
+json chunk_to_json(const ChunkInfo& chunk, crypto::CipherSuite cipher) {
+    json c = {
+        {"id", chunk.id},
+        {"offset", chunk.offset},
+        {"size", chunk.size},
+        {"hash", chunk.hash},
+        {"iv", chunk.iv}
+    };
+    if (chunk.pack.empty()) {
+        c["uri"] = chunk.uri;
+    } else {
+        c["pack"] = chunk.pack;
+        c["pack_offset"] = chunk.pack_offset;
+        c["pack_length"] = chunk.pack_length;
+    }
+    if (!chunk.fingerprint.empty()) {
+        c["fp"] = chunk.fingerprint;
+    }
+    if (chunk.codec != compress::Codec::None) {
+        c["codec"] = compress::codec_name(chunk.codec);
+    }
+    if (chunk.cipher != cipher) {
+        c["cipher"] = crypto::suite_name(chunk.cipher);
+    }
+    return c;
+}
+
+// Manifests written before per-chunk sizes were recorded use fixed-size chunks,
+// so offset and size default from the chunk id
+ChunkInfo chunk_from_json(const json& c, uint64_t chunk_size, uint64_t file_size, crypto::CipherSuite cipher) {
+    ChunkInfo info;
+    info.id = c.value("id", 0ULL);
+    info.offset = c.value("offset", info.id * chunk_size);
+    uint64_t remaining = file_size > info.offset ? file_size - info.offset : 0;
+    info.size = c.value("size", std::min<uint64_t>(chunk_size, remaining));
+    info.hash = c.value("hash", "");
+    info.iv = c.value("iv", "");
+    info.uri = c.value("uri", "");
+    info.pack = c.value("pack", "");
+    info.pack_offset = c.value("pack_offset", 0ULL);
+    info.pack_length = c.value("pack_length", 0ULL);
+    info.fingerprint = c.value("fp", "");
+    info.codec = compress::codec_from_name(c.value("codec", "none"));
+    info.cipher = c.contains("cipher") ? crypto::suite_from_name(c["cipher"].get<std::string>()) : cipher;
+    return info;
+}
+
+// Directory node while nesting the flat, path-keyed file list
+struct TreeNode {
+    const FileEntry* entry = nullptr;
+    std::map<std::string, TreeNode> children;
+};
+
+json node_to_json(const std::string& name, const TreeNode& node, crypto::CipherSuite cipher) {
+    json j;
+    j["name"] = name;
+    bool directory = !node.entry || node.entry->directory;
+    j["type"] = directory ? "dir" : "file";
+    if (node.entry) j["mtime_ns"] = node.entry->mtime_ns;
+    if (directory) {
+        json entries = json::array();
+        for (const auto& child : node.children) entries.push_back(node_to_json(child.first, child.second, cipher));
+        j["entries"] = entries;
+    } else {
+        j["size"] = node.entry->size;
+        json chunks = json::array();
+        for (const auto& chunk : node.entry->chunks) chunks.push_back(chunk_to_json(chunk, cipher));
+        j["chunks"] = chunks;
+    }
+    return j;
+}
+
+void node_from_json(const json& j, const std::string& prefix, uint64_t chunk_size, crypto::CipherSuite cipher,
+                    std::vector<FileEntry>& out) {
+    for (const auto& child : j.value("entries", json::array())) {
+        std::string name = child.value("name", "");
+        if (!valid_entry_name(name)) {
+            throw std::runtime_error("Invalid entry name in manifest tree: " + name);
+        }
+        FileEntry entry;
+        entry.path = prefix.empty() ? name : prefix + "/" + name;
+        entry.directory = child.value("type", "file") == "dir";
+        entry.mtime_ns = child.value("mtime_ns", 0LL);
+        if (entry.directory) {
+            out.push_back(entry);
+            node_from_json(child, entry.path, chunk_size, cipher, out);
+        } else {
+            entry.size = child.value("size", 0ULL);
+            for (const auto& c : child.value("chunks", json::array())) {
+                entry.chunks.push_back(chunk_from_json(c, chunk_size, entry.size, cipher));
+            }
+            out.push_back(std::move(entry));
+        }
+    }
+}
+
+} // namespace
+
+const std::string& Manifest::object_uri(const ChunkInfo& chunk) const {
+    if (chunk.pack.empty()) return chunk.uri;
+    auto it = packs.find(chunk.pack);
+    if (it == packs.end()) {
+        throw std::runtime_error("Chunk " + std::to_string(chunk.id) + " references unknown pack " + chunk.pack);
+    }
+    return it->second;
+}
+
+size_t Manifest::shard_height() const {
+    size_t height = 0;
+    while ((uint64_t(1) << height) < shard_chunks) height++;
+    return height;
+}
+
+uint64_t Manifest::leaf_count() const {
+    if (sharded()) return shards.back().first_chunk + shards.back().chunk_count;
+    if (!tree) return chunks.size();
+    uint64_t count = 0;
+    for (const auto& file : files) count += file.chunks.size();
+    return count;
+}
+
+std::vector<const ChunkInfo*> Manifest::ordered_chunks() const {
+    std::vector<const ChunkInfo*> ordered;
+    if (!tree) {
+        for (const auto& chunk : chunks) ordered.push_back(&chunk);
+        return ordered;
+    }
+    for (const auto& file : files) {
+        for (const auto& chunk : file.chunks) ordered.push_back(&chunk);
+    }
+    return ordered;
+}
+
 json Manifest::to_json() const {
     json j;
     j["file_name"] = file_name;
     j["original_size"] = original_size;
+    if (mtime_ns != 0) j["mtime_ns"] = mtime_ns;
     j["chunk_size"] = chunk_size;
+    j["chunking"] = chunking;
     j["merkle_root"] = merkle_root;
+    if (!merkle_tree.empty()) j["merkle_tree"] = merkle_tree;
     j["timestamp"] = timestamp;
     j["version"] = version;
+    j["cipher"] = crypto::suite_name(cipher);
 
     json chunks_json = json::array();
     for (const auto& chunk : chunks) {
-        chunks_json.push_back({
-            {"id", chunk.id},
-            {"hash", chunk.hash},
-            {"iv", chunk.iv},
-            {"uri", chunk.uri}
-        });
+        chunks_json.push_back(chunk_to_json(chunk, cipher));
     }
     j["chunks"] = chunks_json;
+    if (tree) {
+        TreeNode root;
+        for (const auto& file : files) {
+            TreeNode* node = &root;
+            size_t start = 0;
+            for (;;) {
+                size_t slash = file.path.find('/', start);
+                node = &node->children[file.path.substr(start, slash - start)];
+                if (slash == std::string::npos) break;
+                start = slash + 1;
+            }
+            node->entry = &file;
+        }
+        j["tree"] = node_to_json("", root, cipher);
+    }
+    if (!packs.empty()) {
+        j["packs"] = packs;
+    }
+    if (sharded()) {
+        j["shard_chunks"] = shard_chunks;
+        json shards_json = json::array();
+        for (const auto& shard : shards) {
+            shards_json.push_back({{"first_chunk", shard.first_chunk},
+                                   {"chunk_count", shard.chunk_count},
+                                   {"root", shard.root},
+                                   {"uri", shard.uri}});
+        }
+        j["shards"] = shards_json;
+    }
     return j;
 }
 
@@ -28,22 +198,72 @@ Manifest Manifest::from_json(const json& j) {
     Manifest m;
     m.file_name = j.value("file_name", "");
     m.original_size = j.value("original_size", 0ULL);
+    m.mtime_ns = j.value("mtime_ns", 0LL);
     m.chunk_size = j.value("chunk_size", 0ULL);
+    m.chunking = j.value("chunking", "fixed");
     m.merkle_root = j.value("merkle_root", "");
+    m.merkle_tree = j.value("merkle_tree", "");
     m.timestamp = j.value("timestamp", "");
     m.version = j.value("version", 1);
+    // Manifests from before suites were selectable are all AES-256-GCM
+    m.cipher = crypto::suite_from_name(j.value("cipher", "aes-256-gcm"));
 
     if (j.contains("chunks")) {
         for (const auto& c : j["chunks"]) {
-            ChunkInfo info;
-            info.id = c.value("id", 0ULL);
-            info.hash = c.value("hash", "");
-            info.iv = c.value("iv", "");
-            info.uri = c.value("uri", "");
-            m.chunks.push_back(info);
+            m.chunks.push_back(chunk_from_json(c, m.chunk_size, m.original_size, m.cipher));
+        }
+    }
+    if (j.contains("tree")) {
+        m.tree = true;
+        node_from_json(j["tree"], "", m.chunk_size, m.cipher, m.files);
+        // Same order as ordered_chunks() used when the Merkle root was computed
+        std::sort(m.files.begin(), m.files.end(),
+                  [](const FileEntry& a, const FileEntry& b) { return a.path < b.path; });
+    }
+    if (j.contains("packs")) {
+        m.packs = j["packs"].get<std::map<std::string, std::string>>();
+    }
+    if (j.contains("shards") && !j["shards"].empty()) {
+        m.shard_chunks = j.value("shard_chunks", 0ULL);
+        for (const auto& s : j["shards"]) {
+            ShardInfo shard;
+            shard.first_chunk = s.value("first_chunk", 0ULL);
+            shard.chunk_count = s.value("chunk_count", 0ULL);
+            shard.root = s.value("root", "");
+            shard.uri = s.value("uri", "");
+            m.shards.push_back(std::move(shard));
         }
     }
+    m.validate();
     return m;
 }
 
+void Manifest::validate() const {
+    for (const auto& file : files) {
+        size_t start = 0;
+        for (;;) {
+            size_t slash = file.path.find('/', start);
+            if (!valid_entry_name(file.path.substr(start, slash - start))) {
+                throw std::runtime_error("Invalid entry path in manifest: " + file.path);
+            }
+            if (slash == std::string::npos) break;
+            start = slash + 1;
+        }
+    }
+    if (!sharded()) return;
+    if (shard_chunks == 0 || (shard_chunks & (shard_chunks - 1)) != 0) {
+        throw std::runtime_error("Manifest shard size is not a power of two");
+    }
+    uint64_t next = 0;
+    for (size_t i = 0; i < shards.size(); i++) {
+        // Shards tile the leaves in order, full except for the last
+        const ShardInfo& shard = shards[i];
+        if (shard.first_chunk != next || shard.chunk_count == 0 || shard.chunk_count > shard_chunks ||
+            (i > 0 && shards[i - 1].chunk_count != shard_chunks)) {
+            throw std::runtime_error("Invalid shard list in manifest");
+        }
+        next += shard.chunk_count;
+    }
+}
+
 } // namespace ledger
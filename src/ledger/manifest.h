@@ -2,6 +2,9 @@
 
 #include <string>
 #include <vector>
+#include <map>
+#include "../compress/codec.h"
+#include "../crypto/cipher_suite.h"
 #include <nlohmann/json.hpp>
 
 using json = nlohmann::json;
@@ -10,22 +13,80 @@ namespace ledger {
 
 struct ChunkInfo {
     uint64_t id;
+    uint64_t offset = 0;   // position in the original file
+    uint64_t size = 0;     // plaintext bytes in this chunk
     std::string hash;
     std::string iv;
+    std::string uri;       // standalone object; empty when the chunk lives in a pack
+    std::string pack;      // pack id (key into Manifest::packs)
+    uint64_t pack_offset = 0;
+    uint64_t pack_length = 0;
+    std::string fingerprint;  // keyed plaintext fingerprint for incremental change detection
+    compress::Codec codec = compress::Codec::None;  // applied to the plaintext before sealing
+    crypto::CipherSuite cipher = crypto::CipherSuite::Aes256Gcm;  // seals the blob
+};
+
+// One file or directory of a directory snapshot
+struct FileEntry {
+    std::string path;               // relative to the snapshot root, '/'-separated
+    bool directory = false;
+    uint64_t size = 0;
+    int64_t mtime_ns = 0;
+    std::vector<ChunkInfo> chunks;  // ids and offsets are per file
+};
+
+// A run of consecutive chunks of a sharded manifest, stored as its own
+// binary manifest object. Shards hold `shard_chunks` chunks each (the last
+// may hold fewer), so shard k's root is the node shard_height() levels above
+// leaf k * shard_chunks in the full Merkle tree, and the shard roots hash up
+// to merkle_root on their own.
+struct ShardInfo {
+    uint64_t first_chunk = 0;   // Merkle leaf index of its first chunk
+    uint64_t chunk_count = 0;
+    std::string root;           // hex
     std::string uri;
 };
 
 struct Manifest {
-    std::string file_name;
-    size_t original_size;
-    size_t chunk_size;
-    std::vector<ChunkInfo> chunks;
+    std::string file_name;             // file, or snapshot root directory
+    size_t original_size;              // total bytes across all files for snapshots
+    int64_t mtime_ns = 0;              // single-file backups: source mtime when read
+    size_t chunk_size;                 // fixed size, or target average for "cdc"
+    std::string chunking = "fixed";    // "fixed" or "cdc" (content-defined)
+    std::vector<ChunkInfo> chunks;     // single-file backups
+    bool tree = false;                 // directory snapshot: contents are in `files`
+    std::vector<FileEntry> files;      // sorted by path
+    std::map<std::string, std::string> packs;  // pack id -> object URI
     std::string merkle_root;
+    std::string merkle_tree;           // URI of the stored merkle::MerkleTree levels, if uploaded
     std::string timestamp;
-    int version = 1;
+    int version = 2;                   // 2: binary Merkle leaves; 1: leaves hashed as hex text
+    // Suite new chunks were sealed with. Chunks reused from earlier backups
+    // keep their own; JSON lists a chunk's suite only where it differs.
+    crypto::CipherSuite cipher = crypto::CipherSuite::Aes256Gcm;
+    uint64_t shard_chunks = 0;         // chunks per shard, a power of two; 0 = not sharded
+    std::vector<ShardInfo> shards;     // when sharded, `chunks` stays empty
 
+    bool sharded() const { return !shards.empty(); }
+    // log2(shard_chunks)
+    size_t shard_height() const;
+    // Chunks in the whole backup, whether held here or in shards
+    uint64_t leaf_count() const;
+
+    // Object holding a chunk's blob: its own URI, or the URI of its pack
+    const std::string& object_uri(const ChunkInfo& chunk) const;
+
+    // Every chunk in Merkle leaf order: file order, then chunk order
+    std::vector<const ChunkInfo*> ordered_chunks() const;
+
+    // Snapshots serialize `files` as a nested "tree" of directory nodes
     json to_json() const;
     static Manifest from_json(const json& j);
+
+    // Throws unless every file path stays inside the snapshot root (no
+    // empty, "." or ".." parts, not absolute) and the shards tile the leaves
+    // in order. Both decoders run it, so restores can trust the paths.
+    void validate() const;
 };
 
 } // namespace ledger
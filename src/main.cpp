@@ -1,7 +1,11 @@
 #include "cli/commands.h"
+#include "metrics/metrics.h"
+#include "storage/transport.h"
 #include <iostream>
 #include <string>
+#include <vector>
 #include <cstdlib>
+#include <memory>
 
 int main(int argc, char* argv[]) {
     if (argc < 2) {
@@ -11,29 +15,281 @@ int main(int argc, char* argv[]) {
 
     std::string command = argv[1];
 
-    if (command == "backup") {
-        if (argc < 3) {
-            std::cerr << "Error: Missing file path." << std::endl;
-            cli::Commands::help();
-            return 1;
+    // Split the remaining arguments into positionals and "--name value" options
+    std::vector<std::string> args;
+    std::vector<std::pair<std::string, std::string>> options;
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.rfind("--", 0) == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: Missing value for " << arg << std::endl;
+                return 1;
+            }
+            options.emplace_back(arg, argv[++i]);
+        } else {
+            args.push_back(arg);
         }
-        std::string file_path = argv[2];
-        size_t chunk_size = 16 * 1024 * 1024; // Default 16MB
-        if (argc >= 4) {
-            chunk_size = std::stoul(argv[3]) * 1024 * 1024;
+    }
+
+    try {
+        // Transport options apply to every command; take them out before dispatch
+        storage::TransportOptions transport;
+        bool transport_threads_set = false;
+        metrics::ReportOptions report;
+        bool stats = false;
+        std::vector<std::pair<std::string, std::string>> command_options;
+        for (const auto& opt : options) {
+            if (opt.first == "--http2") {
+                transport.http2 = opt.second != "off";
+            } else if (opt.first == "--connections") {
+                transport.max_connections_per_host = std::stol(opt.second);
+            } else if (opt.first == "--transport-threads") {
+                transport.event_loops = std::stoul(opt.second);
+                transport_threads_set = true;
+            } else if (opt.first == "--stats") {
+                stats = opt.second != "off";
+                if (stats) report.format = metrics::format_from_name(opt.second);
+            } else if (opt.first == "--stats-file") {
+                report.path = opt.second;
+                stats = true;
+            } else if (opt.first == "--stats-interval") {
+                report.interval_seconds = static_cast<unsigned>(std::stoul(opt.second));
+                stats = true;
+            } else {
+                command_options.push_back(opt);
+            }
         }
-        cli::Commands::backup(file_path, chunk_size);
-    } else if (command == "verify") {
-        if (argc < 3) {
-            std::cerr << "Error: Missing manifest path." << std::endl;
+        options.swap(command_options);
+        // Reports once more when it goes out of scope, also if the command throws
+        std::unique_ptr<metrics::Reporter> reporter;
+        if (stats) reporter = std::make_unique<metrics::Reporter>(report);
+
+        if (command == "backup") {
+            if (args.empty()) {
+                std::cerr << "Error: Missing file path." << std::endl;
+                cli::Commands::help();
+                return 1;
+            }
+            std::string file_path = args[0];
+            cli::BackupOptions backup;
+            auto& backup_options = backup.pipeline;
+            auto& chunking = backup_options.chunking;
+            chunking.chunk_size = 16 * 1024 * 1024; // Default 16MB
+            if (args.size() >= 2) {
+                chunking.chunk_size = std::stoul(args[1]) * 1024 * 1024;
+            }
+            backup_options.dedup_index_path = "data/dedup";
+            backup_options.pack_size = 16 * 1024 * 1024;
+            size_t cdc_min = 0;
+            size_t cdc_max = 0;
+            std::string cipher = "auto";
+            for (const auto& opt : options) {
+                if (opt.first == "--threads") {
+                    backup_options.encrypt_threads = std::stoul(opt.second);
+                } else if (opt.first == "--uploaders") {
+                    backup_options.upload_threads = std::stoul(opt.second);
+                } else if (opt.first == "--readers") {
+                    backup_options.read_threads = std::stoul(opt.second);
+                } else if (opt.first == "--max-memory") {
+                    backup_options.max_memory = std::stoul(opt.second) * 1024 * 1024;
+                } else if (opt.first == "--chunking") {
+                    if (opt.second == "cdc") {
+                        chunking.mode = chunker::ChunkingMode::ContentDefined;
+                    } else if (opt.second == "fixed") {
+                        chunking.mode = chunker::ChunkingMode::Fixed;
+                    } else {
+                        std::cerr << "Unknown chunking mode: " << opt.second << std::endl;
+                        return 1;
+                    }
+                } else if (opt.first == "--mmap") {
+                    chunking.memory_map = opt.second == "on";
+                } else if (opt.first == "--stream-uploads") {
+                    backup_options.stream_uploads = opt.second != "off";
+                } else if (opt.first == "--incremental") {
+                    backup.incremental = opt.second != "off";
+                } else if (opt.first == "--dedup") {
+                    backup_options.dedup_index_path = opt.second == "off" ? "" : "data/dedup";
+                } else if (opt.first == "--compress") {
+                    auto codec = compress::codec_from_name(opt.second == "off" ? "none" : opt.second);
+                    if (!compress::codec_available(codec)) {
+                        std::cerr << "Error: This build has no " << opt.second << " support." << std::endl;
+                        return 1;
+                    }
+                    backup_options.compression.codec = codec;
+                } else if (opt.first == "--compress-level") {
+                    backup_options.compression.level = std::stoi(opt.second);
+                } else if (opt.first == "--storage") {
+                    backup.storage_url = opt.second;
+                } else if (opt.first == "--cipher") {
+                    cipher = opt.second;
+                } else if (opt.first == "--shard-chunks") {
+                    backup.shard_chunks = std::stoull(opt.second);
+                    if (backup.shard_chunks & (backup.shard_chunks - 1)) {
+                        std::cerr << "Error: --shard-chunks must be a power of two (or 0)." << std::endl;
+                        return 1;
+                    }
+                } else if (opt.first == "--pack-size") {
+                    backup_options.pack_size = std::stoul(opt.second) * 1024 * 1024;
+                } else if (opt.first == "--cdc-min") {
+                    cdc_min = std::stoul(opt.second) * 1024;
+                } else if (opt.first == "--cdc-max") {
+                    cdc_max = std::stoul(opt.second) * 1024;
+                } else {
+                    std::cerr << "Unknown option: " << opt.first << std::endl;
+                    cli::Commands::help();
+                    return 1;
+                }
+            }
+            std::string cipher_reason = "requested";
+            if (cipher == "auto") {
+                backup_options.cipher = crypto::detect_suite(cipher_reason);
+            } else if (cipher == "bench") {
+                backup_options.cipher = crypto::benchmark_suite(cipher_reason);
+            } else {
+                backup_options.cipher = crypto::suite_from_name(cipher);
+            }
+            std::cout << "Cipher suite: " << crypto::suite_name(backup_options.cipher) << " (" << cipher_reason << ")"
+                      << std::endl;
+            // Content-defined chunks average the requested chunk size
+            chunking.avg_size = chunking.chunk_size;
+            chunking.min_size = cdc_min ? cdc_min : chunking.avg_size / 4;
+            chunking.max_size = cdc_max ? cdc_max : chunking.avg_size * 4;
+            // Streamed chunks are encrypted on the transport threads; give each uploader one
+            if (backup_options.stream_uploads && !transport_threads_set) {
+                transport.event_loops = backup_options.upload_threads;
+            }
+            storage::Transport::configure_shared(transport);
+            cli::Commands::backup(file_path, backup);
+        } else if (command == "verify") {
+            if (args.empty()) {
+                std::cerr << "Error: Missing manifest path." << std::endl;
+                cli::Commands::help();
+                return 1;
+            }
+            std::string manifest_path = args[0];
+            cli::VerifyOptions verify_options;
+            for (const auto& opt : options) {
+                if (opt.first == "--chunk") {
+                    verify_options.single_chunk = true;
+                    verify_options.chunk_index = std::stoul(opt.second);
+                } else if (opt.first == "--sample") {
+                    verify_options.sample = true;
+                    verify_options.sampling.confidence = std::stod(opt.second);
+                } else if (opt.first == "--corruption") {
+                    verify_options.sampling.corruption = std::stod(opt.second);
+                } else if (opt.first == "--seed") {
+                    verify_options.sampling.seed = opt.second;
+                } else if (opt.first == "--downloads") {
+                    verify_options.sampling.download_threads = std::stoul(opt.second);
+                } else if (opt.first == "--ledger") {
+                    if (opt.second != "full" && opt.second != "incremental") {
+                        std::cerr << "Unknown ledger verification mode: " << opt.second << std::endl;
+                        return 1;
+                    }
+                    verify_options.full_ledger = opt.second == "full";
+                } else {
+                    std::cerr << "Unknown option: " << opt.first << std::endl;
+                    cli::Commands::help();
+                    return 1;
+                }
+            }
+            if (verify_options.single_chunk && verify_options.sample) {
+                std::cerr << "Error: --chunk and --sample cannot be combined." << std::endl;
+                return 1;
+            }
+            storage::Transport::configure_shared(transport);
+            cli::Commands::verify(manifest_path, verify_options);
+        } else if (command == "restore") {
+            if (args.size() < 2) {
+                std::cerr << "Error: Missing manifest path or output file." << std::endl;
+                cli::Commands::help();
+                return 1;
+            }
+            pipeline::RestoreOptions restore_options;
+            for (const auto& opt : options) {
+                if (opt.first == "--downloads") {
+                    restore_options.download_threads = std::stoul(opt.second);
+                } else if (opt.first == "--threads") {
+                    restore_options.decrypt_threads = std::stoul(opt.second);
+                } else if (opt.first == "--max-memory") {
+                    restore_options.max_memory = std::stoul(opt.second) * 1024 * 1024;
+                } else {
+                    std::cerr << "Unknown option: " << opt.first << std::endl;
+                    cli::Commands::help();
+                    return 1;
+                }
+            }
+            storage::Transport::configure_shared(transport);
+            cli::Commands::restore(args[0], args[1], restore_options);
+        } else if (command == "manifest") {
+            if (args.size() < 2) {
+                std::cerr << "Error: Missing input or output manifest path." << std::endl;
+                cli::Commands::help();
+                return 1;
+            }
+            std::string format;
+            for (const auto& opt : options) {
+                if (opt.first == "--format" && (opt.second == "json" || opt.second == "binary")) {
+                    format = opt.second;
+                } else {
+                    std::cerr << "Unknown option: " << opt.first << " " << opt.second << std::endl;
+                    cli::Commands::help();
+                    return 1;
+                }
+            }
+            storage::Transport::configure_shared(transport);
+            cli::Commands::convert_manifest(args[0], args[1], format);
+        } else if (command == "agent") {
+            if (args.empty()) {
+                std::cerr << "Error: Missing agent action (start, stop or status)." << std::endl;
+                cli::Commands::help();
+                return 1;
+            }
+            agent::AgentOptions agent_options;
+            agent_options.socket_path = agent::default_socket_path();
+            for (const auto& opt : options) {
+                if (opt.first == "--ttl") {
+                    agent_options.ttl_seconds = static_cast<uint32_t>(std::stoul(opt.second) * 60);
+                } else if (opt.first == "--foreground") {
+                    agent_options.foreground = opt.second != "off";
+                } else if (opt.first == "--socket") {
+                    agent_options.socket_path = opt.second;
+                } else {
+                    std::cerr << "Unknown option: " << opt.first << std::endl;
+                    cli::Commands::help();
+                    return 1;
+                }
+            }
+            if (agent_options.socket_path.empty()) {
+                std::cerr << "Error: The key agent is unavailable (no Unix sockets, or SECURE_BACKUP_AGENT_SOCK=off)." << std::endl;
+                return 1;
+            }
+            cli::Commands::agent(args[0], agent_options);
+        } else if (command == "ledger") {
+            cli::LedgerQuery query;
+            for (const auto& opt : options) {
+                if (opt.first == "--file") {
+                    query.file_name = opt.second;
+                } else if (opt.first == "--root") {
+                    query.merkle_root = opt.second;
+                } else if (opt.first == "--from") {
+                    query.from_ts = opt.second;
+                } else if (opt.first == "--to") {
+                    query.to_ts = opt.second;
+                } else {
+                    std::cerr << "Unknown option: " << opt.first << std::endl;
+                    cli::Commands::help();
+                    return 1;
+                }
+            }
+            cli::Commands::export_ledger(query);
+        } else {
+            std::cerr << "Unknown command: " << command << std::endl;
             cli::Commands::help();
             return 1;
         }
-        std::string manifest_path = argv[2];
-        cli::Commands::verify(manifest_path);
-    } else {
-        std::cerr << "Unknown command: " << command << std::endl;
-        cli::Commands::help();
+    } catch (const std::exception& e) {
+        std::cerr << "Error: Invalid argument (" << e.what() << ")" << std::endl;
         return 1;
     }
 
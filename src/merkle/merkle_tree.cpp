@@ -1,74 +1,348 @@
 #include "merkle_tree.h"
-#include <openssl/sha.h>
-#include <sstream>
-#include <iomanip>
+#include "../metrics/metrics.h"
+#include <openssl/evp.h>
 #include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
 
 namespace merkle {
 
-std::string MerkleTree::compute_root(const std::vector<std::string>& leaf_hashes) {
-    if (leaf_hashes.empty()) {
-        return "";
+namespace {
+
+// Levels smaller than this are not worth handing to threads
+constexpr size_t kParallelThreshold = 1 << 14;
+
+// SHA-256 context reused for every node a worker hashes. The digest is fetched
+// once up front; passing EVP_sha256() would repeat the provider lookup per node.
+class NodeHasher {
+public:
+    NodeHasher() : md_(EVP_MD_fetch(nullptr, "SHA256", nullptr)), ctx_(EVP_MD_CTX_new()) {
+        if (!md_ || !ctx_) {
+            EVP_MD_free(md_);
+            EVP_MD_CTX_free(ctx_);
+            throw std::runtime_error("SHA256 init failed");
+        }
     }
+    ~NodeHasher() {
+        EVP_MD_CTX_free(ctx_);
+        EVP_MD_free(md_);
+    }
+    NodeHasher(const NodeHasher&) = delete;
+    NodeHasher& operator=(const NodeHasher&) = delete;
 
-    std::vector<std::string> current_level = leaf_hashes;
+    void hash(const uint8_t* data, size_t len, Digest& out) {
+        unsigned int out_len = 0;
+        if (EVP_DigestInit_ex(ctx_, md_, nullptr) != 1 ||
+            EVP_DigestUpdate(ctx_, data, len) != 1 ||
+            EVP_DigestFinal_ex(ctx_, out.data(), &out_len) != 1) {
+            throw std::runtime_error("SHA256 digest failed");
+        }
+    }
 
-    // Hash leaves with 0x00 prefix if they are raw data, but here we assume they are already hashes?
-    // Requirement says: "hash of ciphertext".
-    // "canonicalization (0x00 leaf / 0x01 node)" usually applies when hashing the content itself.
-    // If leaf_hashes are already SHA256 strings, we should treat them as inputs to the tree.
-    // Let's assume we need to re-hash them with prefix to form the tree leaves.
-    
-    std::vector<std::string> tree_nodes;
-    for (const auto& h : leaf_hashes) {
-        tree_nodes.push_back(hash_leaf(h));
+    void leaf(const Digest& d, Digest& out) {
+        uint8_t input[1 + 32];
+        input[0] = 0x00;
+        std::memcpy(input + 1, d.data(), 32);
+        hash(input, sizeof(input), out);
     }
 
-    while (tree_nodes.size() > 1) {
-        std::vector<std::string> next_level;
-        for (size_t i = 0; i < tree_nodes.size(); i += 2) {
-            if (i + 1 < tree_nodes.size()) {
-                next_level.push_back(hash_node(tree_nodes[i], tree_nodes[i+1]));
-            } else {
-                // Odd number of nodes, duplicate the last one? Or just promote it?
-                // Common practice: duplicate last.
-                next_level.push_back(hash_node(tree_nodes[i], tree_nodes[i]));
+    void node(const Digest& left, const Digest& right, Digest& out) {
+        uint8_t input[1 + 64];
+        input[0] = 0x01;
+        std::memcpy(input + 1, left.data(), 32);
+        std::memcpy(input + 33, right.data(), 32);
+        hash(input, sizeof(input), out);
+    }
+
+private:
+    EVP_MD* md_;
+    EVP_MD_CTX* ctx_;
+};
+
+// Runs fn(hasher, begin, end) over [0, count), split across up to `threads` workers
+template <typename Fn>
+void for_each_range(size_t count, size_t threads, Fn fn) {
+    size_t workers = count < kParallelThreshold ? 1 : std::min(threads, count / (kParallelThreshold / 4));
+    if (workers <= 1) {
+        NodeHasher hasher;
+        fn(hasher, 0, count);
+        return;
+    }
+    std::vector<std::thread> pool;
+    std::vector<std::exception_ptr> errors(workers);
+    size_t step = (count + workers - 1) / workers;
+    for (size_t w = 0; w < workers; w++) {
+        size_t begin = w * step;
+        size_t end = std::min(count, begin + step);
+        pool.emplace_back([&, w, begin, end]() {
+            try {
+                NodeHasher hasher;
+                fn(hasher, begin, end);
+            } catch (...) {
+                errors[w] = std::current_exception();
             }
+        });
+    }
+    for (auto& t : pool) {
+        t.join();
+    }
+    for (auto& e : errors) {
+        if (e) std::rethrow_exception(e);
+    }
+}
+
+void hash_leaves(const Digest* leaves, size_t count, Digest* out, size_t threads) {
+    for_each_range(count, threads, [&](NodeHasher& hasher, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            hasher.leaf(leaves[i], out[i]);
+        }
+    });
+}
+
+// Hashes a level of `width` nodes into its (width + 1) / 2 parents
+void hash_parents(const Digest* level, size_t width, Digest* out, size_t threads) {
+    for_each_range((width + 1) / 2, threads, [&](NodeHasher& hasher, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const Digest& left = level[2 * i];
+            const Digest& right = 2 * i + 1 < width ? level[2 * i + 1] : left;
+            hasher.node(left, right, out[i]);
+        }
+    });
+}
+
+size_t resolve_threads(size_t threads) {
+    return threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Width of every level for `leaf_count` leaves, leaf level first
+std::vector<size_t> level_widths(size_t leaf_count) {
+    std::vector<size_t> widths{leaf_count};
+    while (widths.back() > 1) {
+        widths.push_back((widths.back() + 1) / 2);
+    }
+    return widths;
+}
+
+const char kMagic[4] = {'S', 'B', 'M', 'T'};
+const uint32_t kVersion = 1;
+
+} // namespace
+
+MerkleTree::MerkleTree(const std::vector<Digest>& leaves, size_t threads) {
+    if (leaves.empty()) {
+        throw std::invalid_argument("Merkle tree needs at least one leaf");
+    }
+    metrics::ScopedTimer timer(metrics::Stage::Merkle, leaves.size() * sizeof(Digest));
+    threads = resolve_threads(threads);
+    levels_.emplace_back(leaves.size());
+    hash_leaves(leaves.data(), leaves.size(), levels_.back().data(), threads);
+    while (levels_.back().size() > 1) {
+        const auto& below = levels_.back();
+        std::vector<Digest> above((below.size() + 1) / 2);
+        hash_parents(below.data(), below.size(), above.data(), threads);
+        levels_.push_back(std::move(above));
+    }
+}
+
+std::vector<Digest> MerkleTree::prove(size_t index) const {
+    if (index >= leaf_count()) {
+        throw std::out_of_range("Leaf index out of range");
+    }
+    std::vector<Digest> proof;
+    proof.reserve(levels_.size() - 1);
+    for (size_t k = 0; k + 1 < levels_.size(); k++, index /= 2) {
+        size_t sibling = index ^ 1;
+        proof.push_back(levels_[k][sibling < levels_[k].size() ? sibling : index]);
+    }
+    return proof;
+}
+
+bool MerkleTree::verify_proof(const Digest& leaf, size_t index, const std::vector<Digest>& proof, const Digest& root) {
+    if (proof.size() >= 64 || (index >> proof.size()) != 0) {
+        return false;
+    }
+    NodeHasher hasher;
+    Digest current;
+    hasher.leaf(leaf, current);
+    for (const auto& sibling : proof) {
+        Digest parent;
+        if (index & 1) {
+            hasher.node(sibling, current, parent);
+        } else {
+            hasher.node(current, sibling, parent);
+        }
+        current = parent;
+        index >>= 1;
+    }
+    return current == root;
+}
+
+void MerkleTree::update(size_t index, const Digest& leaf) {
+    update(std::vector<std::pair<size_t, Digest>>{{index, leaf}});
+}
+
+void MerkleTree::update(const std::vector<std::pair<size_t, Digest>>& changes) {
+    metrics::ScopedTimer timer(metrics::Stage::Merkle, changes.size() * sizeof(Digest));
+    NodeHasher hasher;
+    std::vector<size_t> dirty;
+    for (const auto& change : changes) {
+        if (change.first >= leaf_count()) {
+            throw std::out_of_range("Leaf index out of range");
         }
-        tree_nodes = next_level;
+        hasher.leaf(change.second, levels_[0][change.first]);
+        dirty.push_back(change.first / 2);
+    }
+    for (size_t k = 1; k < levels_.size(); k++) {
+        std::sort(dirty.begin(), dirty.end());
+        dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+        const auto& below = levels_[k - 1];
+        for (auto& i : dirty) {
+            const Digest& left = below[2 * i];
+            const Digest& right = 2 * i + 1 < below.size() ? below[2 * i + 1] : left;
+            hasher.node(left, right, levels_[k][i]);
+            i /= 2;
+        }
+    }
+}
+
+std::vector<uint8_t> MerkleTree::serialize() const {
+    size_t nodes = 0;
+    for (const auto& level : levels_) nodes += level.size();
+    std::vector<uint8_t> out(kHeaderSize + nodes * sizeof(Digest));
+    uint64_t count = leaf_count();
+    std::memcpy(out.data(), kMagic, 4);
+    std::memcpy(out.data() + 4, &kVersion, sizeof(kVersion));
+    std::memcpy(out.data() + 8, &count, sizeof(count));
+    uint8_t* p = out.data() + kHeaderSize;
+    for (const auto& level : levels_) {
+        std::memcpy(p, level.data(), level.size() * sizeof(Digest));
+        p += level.size() * sizeof(Digest);
+    }
+    return out;
+}
+
+MerkleTree MerkleTree::deserialize(const uint8_t* data, size_t len) {
+    if (len < kHeaderSize || std::memcmp(data, kMagic, 4) != 0) {
+        throw std::runtime_error("Not a Merkle tree file");
+    }
+    uint32_t version;
+    uint64_t count;
+    std::memcpy(&version, data + 4, sizeof(version));
+    std::memcpy(&count, data + 8, sizeof(count));
+    if (version != kVersion) {
+        throw std::runtime_error("Unsupported Merkle tree version " + std::to_string(version));
+    }
+    if (count == 0 || count > (len - kHeaderSize) / sizeof(Digest)) {
+        throw std::runtime_error("Merkle tree file is truncated");
+    }
+    auto widths = level_widths(count);
+    size_t nodes = 0;
+    for (size_t w : widths) nodes += w;
+    if (len != kHeaderSize + nodes * sizeof(Digest)) {
+        throw std::runtime_error("Merkle tree file has wrong length");
+    }
+
+    MerkleTree tree;
+    const uint8_t* p = data + kHeaderSize;
+    for (size_t w : widths) {
+        tree.levels_.emplace_back(w);
+        std::memcpy(tree.levels_.back().data(), p, w * sizeof(Digest));
+        p += w * sizeof(Digest);
     }
+    return tree;
+}
+
+std::vector<uint64_t> MerkleTree::proof_offsets(size_t leaf_count, size_t index) {
+    if (index >= leaf_count) {
+        throw std::out_of_range("Leaf index out of range");
+    }
+    auto widths = level_widths(leaf_count);
+    std::vector<uint64_t> offsets;
+    uint64_t level_start = kHeaderSize;
+    for (size_t k = 0; k + 1 < widths.size(); k++, index /= 2) {
+        size_t sibling = index ^ 1;
+        if (sibling >= widths[k]) sibling = index;
+        offsets.push_back(level_start + sibling * sizeof(Digest));
+        level_start += widths[k] * sizeof(Digest);
+    }
+    return offsets;
+}
 
-    return tree_nodes[0];
+Digest MerkleTree::compute_root(const std::vector<Digest>& leaves, size_t threads) {
+    if (leaves.empty()) {
+        return Digest{};
+    }
+    metrics::ScopedTimer timer(metrics::Stage::Merkle, leaves.size() * sizeof(Digest));
+    threads = resolve_threads(threads);
+
+    // Two buffers: the current level and room for the one above it
+    std::vector<Digest> level(leaves.size());
+    std::vector<Digest> next((leaves.size() + 1) / 2);
+    hash_leaves(leaves.data(), leaves.size(), level.data(), threads);
+    for (size_t width = leaves.size(); width > 1; width = (width + 1) / 2) {
+        hash_parents(level.data(), width, next.data(), threads);
+        level.swap(next);
+    }
+    return level[0];
 }
 
-std::string MerkleTree::hash_leaf(const std::string& data) {
-    // Prefix 0x00
-    std::string input;
-    input.push_back(0x00);
-    input += data;
-    return sha256(input);
+Digest MerkleTree::compute_subtree_root(const std::vector<Digest>& leaves, size_t height, size_t threads) {
+    if (leaves.empty() || height >= 64 || leaves.size() > (size_t(1) << height)) {
+        throw std::invalid_argument("Subtree needs between 1 and 2^height leaves");
+    }
+    Digest root = compute_root(leaves, threads);
+    size_t levels = level_widths(leaves.size()).size() - 1;
+    NodeHasher hasher;
+    for (; levels < height; levels++) {
+        hasher.node(root, root, root);
+    }
+    return root;
 }
 
-std::string MerkleTree::hash_node(const std::string& left, const std::string& right) {
-    // Prefix 0x01
-    std::string input;
-    input.push_back(0x01);
-    input += left + right;
-    return sha256(input);
+Digest MerkleTree::compute_root_from_nodes(const std::vector<Digest>& nodes) {
+    if (nodes.empty()) {
+        throw std::invalid_argument("Merkle root needs at least one node");
+    }
+    metrics::ScopedTimer timer(metrics::Stage::Merkle, nodes.size() * sizeof(Digest));
+    std::vector<Digest> level = nodes;
+    for (size_t width = level.size(); width > 1; width = (width + 1) / 2) {
+        hash_parents(level.data(), width, level.data(), 1);
+    }
+    return level[0];
 }
 
-std::string MerkleTree::sha256(const std::string& data) {
-    unsigned char hash[SHA256_DIGEST_LENGTH];
-    SHA256_CTX sha256;
-    SHA256_Init(&sha256);
-    SHA256_Update(&sha256, data.c_str(), data.size());
-    SHA256_Final(hash, &sha256);
+std::string MerkleTree::compute_root_legacy(const std::vector<std::string>& leaf_hashes) {
+    if (leaf_hashes.empty()) {
+        return "";
+    }
+
+    // Same tree shape, but every input is the hex text of the digest below it
+    NodeHasher hasher;
+    std::vector<std::string> nodes;
+    nodes.reserve(leaf_hashes.size());
+    Digest out;
+    for (const auto& h : leaf_hashes) {
+        std::string input(1, '\x00');
+        input += h;
+        hasher.hash(reinterpret_cast<const uint8_t*>(input.data()), input.size(), out);
+        nodes.push_back(utils::HashUtils::to_hex(out));
+    }
 
-    std::stringstream ss;
-    for (int i = 0; i < SHA256_DIGEST_LENGTH; i++) {
-        ss << std::hex << std::setw(2) << std::setfill('0') << (int)hash[i];
+    while (nodes.size() > 1) {
+        std::vector<std::string> next_level;
+        next_level.reserve((nodes.size() + 1) / 2);
+        for (size_t i = 0; i < nodes.size(); i += 2) {
+            const std::string& right = i + 1 < nodes.size() ? nodes[i + 1] : nodes[i];
+            std::string input(1, '\x01');
+            input += nodes[i];
+            input += right;
+            hasher.hash(reinterpret_cast<const uint8_t*>(input.data()), input.size(), out);
+            next_level.push_back(utils::HashUtils::to_hex(out));
+        }
+        nodes.swap(next_level);
     }
-    return ss.str();
+    return nodes[0];
 }
 
 } // namespace merkle
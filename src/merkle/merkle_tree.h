@@ -1,20 +1,77 @@
 #pragma once
 
+#include "../utils/hash_utils.h"
 #include <vector>
 #include <string>
 #include <array>
+#include <utility>
+#include <cstdint>
 
 namespace merkle {
 
+using Digest = utils::Digest;
+
+// Leaves are H(0x00 || d), nodes H(0x01 || l || r), and the last node of an
+// odd level is paired with itself.
+//
+// A MerkleTree keeps every level so one leaf can be proven or replaced
+// without touching the others. Serialized (little-endian):
+//
+//   "SBMT" || format version (u32) || leaf count (u64) || level 0 || ... || root
+//
+// Level 0 holds the hashed leaves; each level is its digests back to back,
+// so any node sits at a fixed offset and a proof can be read with ranges.
 class MerkleTree {
 public:
-    // Compute Merkle root from a list of leaf hashes (already hashed chunks)
-    static std::string compute_root(const std::vector<std::string>& leaf_hashes);
+    static const size_t kHeaderSize = 16;
+
+    // Builds all levels; large levels are hashed across `threads` workers
+    // (0 = hardware concurrency). Throws on an empty leaf list.
+    explicit MerkleTree(const std::vector<Digest>& leaves, size_t threads = 0);
+
+    size_t leaf_count() const { return levels_.front().size(); }
+    const Digest& root() const { return levels_.back().front(); }
+    // Node `index` of `level`; level 0 holds the hashed leaves
+    const Digest& node(size_t level, size_t index) const { return levels_.at(level).at(index); }
+
+    // Sibling digests of leaf `index`, from the leaf level up
+    std::vector<Digest> prove(size_t index) const;
+
+    // True if `leaf` at `index` hashes up to `root` through `proof`
+    static bool verify_proof(const Digest& leaf, size_t index, const std::vector<Digest>& proof, const Digest& root);
+
+    // Replaces leaves and rehashes only their paths; shared ancestors once
+    void update(size_t index, const Digest& leaf);
+    void update(const std::vector<std::pair<size_t, Digest>>& changes);
+
+    std::vector<uint8_t> serialize() const;
+    // Checks the framing only: proofs taken from the result are still
+    // checked against a trusted root
+    static MerkleTree deserialize(const uint8_t* data, size_t len);
+
+    // Offsets of prove(index)'s digests inside a serialized tree of `leaf_count` leaves
+    static std::vector<uint64_t> proof_offsets(size_t leaf_count, size_t index);
+
+    // Root without keeping the levels. Empty input yields an all-zero digest.
+    static Digest compute_root(const std::vector<Digest>& leaves, size_t threads = 0);
+
+    // Node at `height` above a block of up to 2^height leaves that starts at a
+    // multiple of 2^height, as it appears in any larger tree: a short last
+    // block keeps pairing its root with itself until it reaches `height`.
+    // The roots of consecutive blocks form level `height` of the full tree.
+    static Digest compute_subtree_root(const std::vector<Digest>& leaves, size_t height, size_t threads = 0);
+
+    // Root above a complete level of nodes (e.g. subtree roots); unlike
+    // compute_root the inputs are not hashed as leaves first
+    static Digest compute_root_from_nodes(const std::vector<Digest>& nodes);
+
+    // Scheme of version 1 manifests, which hashed the hex text of every digest
+    static std::string compute_root_legacy(const std::vector<std::string>& leaf_hashes);
 
 private:
-    static std::string hash_leaf(const std::string& data);
-    static std::string hash_node(const std::string& left, const std::string& right);
-    static std::string sha256(const std::string& data);
+    MerkleTree() = default;
+
+    std::vector<std::vector<Digest>> levels_;   // leaf level first, root last
 };
 
 } // namespace merkle
@@ -0,0 +1,237 @@
+#include "metrics.h"
+#include "../utils/file_utils.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+namespace metrics {
+
+namespace detail {
+std::atomic<bool> enabled{false};
+}
+
+namespace {
+
+const char* const kStageNames[kStageCount] = {
+    "chunk", "hash", "compress", "decompress", "encrypt", "decrypt",
+    "merkle", "manifest", "upload", "download", "ledger_append", "ledger_verify",
+};
+
+StageMetrics g_stages[kStageCount];
+std::atomic<uint64_t> g_started{0};
+
+int floor_log2(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+    return 63 - __builtin_clzll(value);
+#else
+    int log = 0;
+    while (value >>= 1) log++;
+    return log;
+#endif
+}
+
+double seconds(uint64_t nanos) {
+    return static_cast<double>(nanos) / 1e9;
+}
+
+double elapsed_seconds() {
+    uint64_t started = g_started.load(std::memory_order_relaxed);
+    return started ? seconds(now_ns() - started) : 0.0;
+}
+
+} // namespace
+
+const char* stage_name(Stage stage) {
+    return kStageNames[static_cast<size_t>(stage)];
+}
+
+size_t Histogram::bucket_of(uint64_t value) {
+    if (value < kSubBuckets) return static_cast<size_t>(value);
+    // Top bit picks the power of two, the next three bits the sub-bucket
+    int log = floor_log2(value);
+    return static_cast<size_t>(log - 2) * kSubBuckets + ((value >> (log - 3)) & (kSubBuckets - 1));
+}
+
+uint64_t Histogram::bucket_value(size_t index) {
+    if (index < kSubBuckets) return index;
+    int shift = static_cast<int>(index / kSubBuckets) - 1;
+    uint64_t lower = (kSubBuckets + index % kSubBuckets) << shift;
+    return lower + ((uint64_t(1) << shift) >> 1);
+}
+
+void Histogram::record(uint64_t value) {
+    buckets_[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+    uint64_t seen = max_.load(std::memory_order_relaxed);
+    while (value > seen && !max_.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {
+    }
+}
+
+uint64_t Histogram::count() const {
+    uint64_t total = 0;
+    for (const auto& bucket : buckets_) total += bucket.load(std::memory_order_relaxed);
+    return total;
+}
+
+uint64_t Histogram::quantile(double q) const {
+    // Counts are read once so the walk sees one consistent total
+    std::array<uint64_t, kBuckets> counts;
+    uint64_t total = 0;
+    for (size_t i = 0; i < kBuckets; i++) {
+        counts[i] = buckets_[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+    if (total == 0) return 0;
+    uint64_t rank = static_cast<uint64_t>(std::ceil(q * static_cast<double>(total)));
+    rank = std::min(std::max<uint64_t>(rank, 1), total);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBuckets; i++) {
+        seen += counts[i];
+        if (seen >= rank) return std::min(bucket_value(i), max());
+    }
+    return max();
+}
+
+void enable() {
+    uint64_t unset = 0;
+    g_started.compare_exchange_strong(unset, now_ns());
+    detail::enabled.store(true, std::memory_order_relaxed);
+}
+
+void record(Stage stage, uint64_t bytes, uint64_t nanos, bool failed) {
+    StageMetrics& m = g_stages[static_cast<size_t>(stage)];
+    m.operations.fetch_add(1, std::memory_order_relaxed);
+    m.bytes.fetch_add(bytes, std::memory_order_relaxed);
+    m.nanos.fetch_add(nanos, std::memory_order_relaxed);
+    if (failed) m.errors.fetch_add(1, std::memory_order_relaxed);
+    m.latency.record(nanos);
+}
+
+const StageMetrics& stage_metrics(Stage stage) {
+    return g_stages[static_cast<size_t>(stage)];
+}
+
+json to_json() {
+    json stages = json::object();
+    for (size_t i = 0; i < kStageCount; i++) {
+        const StageMetrics& m = g_stages[i];
+        uint64_t operations = m.operations.load(std::memory_order_relaxed);
+        if (operations == 0) continue;
+        uint64_t bytes = m.bytes.load(std::memory_order_relaxed);
+        uint64_t nanos = m.nanos.load(std::memory_order_relaxed);
+
+        json stage;
+        stage["operations"] = operations;
+        stage["bytes"] = bytes;
+        stage["errors"] = m.errors.load(std::memory_order_relaxed);
+        stage["seconds"] = seconds(nanos);
+        // Per thread: busy time is summed over all the threads of a stage
+        stage["mb_per_second"] = nanos ? static_cast<double>(bytes) / (1024.0 * 1024.0) / seconds(nanos) : 0.0;
+        stage["latency_ms"] = {
+            {"p50", static_cast<double>(m.latency.quantile(0.5)) / 1e6},
+            {"p99", static_cast<double>(m.latency.quantile(0.99)) / 1e6},
+            {"p999", static_cast<double>(m.latency.quantile(0.999)) / 1e6},
+            {"max", static_cast<double>(m.latency.max()) / 1e6},
+        };
+        stages[kStageNames[i]] = std::move(stage);
+    }
+    json j;
+    j["elapsed_seconds"] = elapsed_seconds();
+    j["stages"] = std::move(stages);
+    return j;
+}
+
+std::string to_prometheus() {
+    std::ostringstream out;
+    out << "# HELP secure_backup_elapsed_seconds Time since statistics collection started.\n"
+        << "# TYPE secure_backup_elapsed_seconds gauge\n"
+        << "secure_backup_elapsed_seconds " << elapsed_seconds() << "\n";
+
+    out << "# HELP secure_backup_stage_bytes_total Bytes processed per stage.\n"
+        << "# TYPE secure_backup_stage_bytes_total counter\n";
+    for (size_t i = 0; i < kStageCount; i++) {
+        out << "secure_backup_stage_bytes_total{stage=\"" << kStageNames[i] << "\"} "
+            << g_stages[i].bytes.load(std::memory_order_relaxed) << "\n";
+    }
+    out << "# HELP secure_backup_stage_errors_total Operations per stage that failed.\n"
+        << "# TYPE secure_backup_stage_errors_total counter\n";
+    for (size_t i = 0; i < kStageCount; i++) {
+        out << "secure_backup_stage_errors_total{stage=\"" << kStageNames[i] << "\"} "
+            << g_stages[i].errors.load(std::memory_order_relaxed) << "\n";
+    }
+
+    // _sum is the busy time summed over threads, _count the operations
+    static const std::pair<const char*, double> kQuantiles[] = {{"0.5", 0.5}, {"0.99", 0.99}, {"0.999", 0.999}};
+    out << "# HELP secure_backup_stage_latency_seconds Duration of one operation per stage.\n"
+        << "# TYPE secure_backup_stage_latency_seconds summary\n";
+    for (size_t i = 0; i < kStageCount; i++) {
+        const StageMetrics& m = g_stages[i];
+        for (const auto& q : kQuantiles) {
+            out << "secure_backup_stage_latency_seconds{stage=\"" << kStageNames[i] << "\",quantile=\"" << q.first
+                << "\"} " << seconds(m.latency.quantile(q.second)) << "\n";
+        }
+        out << "secure_backup_stage_latency_seconds_sum{stage=\"" << kStageNames[i] << "\"} "
+            << seconds(m.nanos.load(std::memory_order_relaxed)) << "\n"
+            << "secure_backup_stage_latency_seconds_count{stage=\"" << kStageNames[i] << "\"} "
+            << m.operations.load(std::memory_order_relaxed) << "\n";
+    }
+    return out.str();
+}
+
+Format format_from_name(const std::string& name) {
+    if (name == "json") return Format::Json;
+    if (name == "prometheus") return Format::Prometheus;
+    throw std::invalid_argument("Unknown stats format: " + name);
+}
+
+Reporter::Reporter(const ReportOptions& options) : options_(options) {
+    enable();
+    if (options_.interval_seconds) {
+        thread_ = std::thread([this]() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (!cv_.wait_for(lock, std::chrono::seconds(options_.interval_seconds), [this]() { return stopping_; })) {
+                write(false);
+            }
+        });
+    }
+}
+
+Reporter::~Reporter() {
+    finish();
+}
+
+void Reporter::finish() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (finished_) return;
+        finished_ = true;
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    if (thread_.joinable()) thread_.join();
+    write(true);
+}
+
+void Reporter::write(bool final) {
+    std::string text;
+    if (options_.format == Format::Json) {
+        json j = to_json();
+        j["final"] = final;
+        text = j.dump(2) + "\n";
+    } else {
+        text = to_prometheus();
+    }
+    // A failed report must not fail the run it describes
+    try {
+        if (options_.path.empty()) {
+            std::cerr << text << std::flush;
+        } else {
+            utils::FileUtils::write_file_atomic(options_.path, reinterpret_cast<const uint8_t*>(text.data()), text.size());
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "WARNING: Could not write stats to " << options_.path << ": " << e.what() << std::endl;
+    }
+}
+
+} // namespace metrics
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+namespace metrics {
+
+// Parts of a backup or restore that are counted and timed separately
+enum class Stage : uint8_t {
+    Chunk,          // reading input files and cutting them into chunks
+    Hash,           // SHA-256 over chunk data and blobs
+    Compress,
+    Decompress,
+    Encrypt,
+    Decrypt,
+    Merkle,         // building or updating trees
+    Manifest,       // encoding and decoding manifests
+    Upload,         // one storage call; a batch counts once
+    Download,
+    LedgerAppend,
+    LedgerVerify,
+};
+
+const size_t kStageCount = 12;
+
+const char* stage_name(Stage stage);
+
+// Latency distribution in log-linear buckets, 8 per power of two, so a
+// quantile is within 1/16 of the true value. Recording is lock-free and a
+// quantile can be read while other threads record.
+class Histogram {
+public:
+    static const size_t kSubBuckets = 8;
+    static const size_t kBuckets = 62 * kSubBuckets;
+
+    void record(uint64_t value);
+
+    uint64_t count() const;
+    uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+    // Smallest value at or above the `q` quantile, to bucket precision
+    uint64_t quantile(double q) const;
+
+private:
+    std::array<std::atomic<uint64_t>, kBuckets> buckets_{};
+    std::atomic<uint64_t> max_{0};
+
+    static size_t bucket_of(uint64_t value);
+    // Middle of a bucket's range
+    static uint64_t bucket_value(size_t index);
+};
+
+// Counters of one stage; time and latency in nanoseconds
+struct alignas(64) StageMetrics {
+    std::atomic<uint64_t> operations{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> nanos{0};     // summed over threads
+    std::atomic<uint64_t> errors{0};    // operations that threw
+    Histogram latency;
+};
+
+namespace detail {
+extern std::atomic<bool> enabled;
+}
+
+// Collection is off until enable(); instrumented code then costs one
+// relaxed load per operation
+inline bool enabled() { return detail::enabled.load(std::memory_order_relaxed); }
+void enable();
+
+inline uint64_t now_ns() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void record(Stage stage, uint64_t bytes, uint64_t nanos, bool failed = false);
+const StageMetrics& stage_metrics(Stage stage);
+
+// Times one operation from construction to destruction. Bytes may be added
+// once they are known; an operation left by an exception counts as an error.
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Stage stage, uint64_t bytes = 0)
+        : stage_(stage), bytes_(bytes), start_(enabled() ? now_ns() : 0),
+          exceptions_(start_ ? std::uncaught_exceptions() : 0) {}
+    ~ScopedTimer() {
+        if (start_) record(stage_, bytes_, now_ns() - start_, std::uncaught_exceptions() > exceptions_);
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    void add_bytes(uint64_t bytes) { bytes_ += bytes; }
+
+private:
+    Stage stage_;
+    uint64_t bytes_;
+    uint64_t start_;
+    int exceptions_;
+};
+
+// Stages that have seen operations, with times in seconds
+json to_json();
+// Every stage in the Prometheus text exposition format
+std::string to_prometheus();
+
+enum class Format { Json, Prometheus };
+Format format_from_name(const std::string& name);
+
+struct ReportOptions {
+    Format format = Format::Json;
+    std::string path;               // replaced atomically on each report; empty = stderr
+    unsigned interval_seconds = 0;  // 0 = only when the run ends
+};
+
+// Enables collection and reports every `interval_seconds` on a background
+// thread, then once more from finish() (or the destructor)
+class Reporter {
+public:
+    explicit Reporter(const ReportOptions& options);
+    ~Reporter();
+
+    Reporter(const Reporter&) = delete;
+    Reporter& operator=(const Reporter&) = delete;
+
+    void finish();
+
+private:
+    ReportOptions options_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stopping_ = false;
+    bool finished_ = false;
+    std::thread thread_;
+
+    void write(bool final);
+};
+
+} // namespace metrics
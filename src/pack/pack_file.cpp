@@ -0,0 +1,97 @@
+#include "pack_file.h"
+#include "../crypto/encryptor.h"
+#include "../utils/hash_utils.h"
+#include <openssl/crypto.h>
+#include <cstring>
+#include <stdexcept>
+
+namespace pack {
+
+namespace {
+
+const char kMagic[4] = {'S', 'B', 'P', 'K'};
+const uint32_t kVersion = 1;
+const size_t kEntrySize = 48; // hash(32) offset(8) length(8)
+
+} // namespace
+
+PackBuilder::PackBuilder(const std::array<uint8_t, 32>& index_key) : index_key_(index_key) {
+}
+
+PackBuilder::~PackBuilder() {
+    OPENSSL_cleanse(index_key_.data(), index_key_.size());
+}
+
+uint64_t PackBuilder::add(const uint8_t* blob, size_t len, const std::string& hash_hex) {
+    PackEntry entry;
+    utils::HashUtils::from_hex(hash_hex, entry.hash.data(), entry.hash.size());
+    entry.offset = data_.size();
+    entry.length = len;
+    data_.insert(data_.end(), blob, blob + len);
+    entries_.push_back(entry);
+    return entry.offset;
+}
+
+std::vector<uint8_t> PackBuilder::finish() {
+    std::vector<uint8_t> index(entries_.size() * kEntrySize);
+    uint8_t* p = index.data();
+    for (const auto& entry : entries_) {
+        std::memcpy(p, entry.hash.data(), 32);
+        std::memcpy(p + 32, &entry.offset, sizeof(entry.offset));
+        std::memcpy(p + 40, &entry.length, sizeof(entry.length));
+        p += kEntrySize;
+    }
+
+    crypto::Encryptor encryptor(index_key_);
+    std::vector<uint8_t> sealed;
+    encryptor.encrypt_into(index.data(), index.size(), sealed);
+
+    uint64_t sealed_len = sealed.size();
+    uint8_t footer[kFooterSize];
+    std::memcpy(footer, &sealed_len, sizeof(sealed_len));
+    std::memcpy(footer + 8, kMagic, 4);
+    std::memcpy(footer + 12, &kVersion, sizeof(kVersion));
+
+    std::vector<uint8_t> object;
+    object.swap(data_);
+    object.reserve(object.size() + sealed.size() + kFooterSize);
+    object.insert(object.end(), sealed.begin(), sealed.end());
+    object.insert(object.end(), footer, footer + kFooterSize);
+    entries_.clear();
+    return object;
+}
+
+uint64_t read_footer(const uint8_t* footer, size_t len) {
+    uint32_t version;
+    if (len != kFooterSize || std::memcmp(footer + 8, kMagic, 4) != 0) {
+        throw std::runtime_error("Not a pack footer");
+    }
+    std::memcpy(&version, footer + 12, sizeof(version));
+    if (version != kVersion) {
+        throw std::runtime_error("Unsupported pack version " + std::to_string(version));
+    }
+    uint64_t sealed_len;
+    std::memcpy(&sealed_len, footer, sizeof(sealed_len));
+    return sealed_len;
+}
+
+std::vector<PackEntry> read_index(const uint8_t* sealed, size_t len, const std::array<uint8_t, 32>& index_key) {
+    crypto::Encryptor encryptor(index_key);
+    std::vector<uint8_t> index;
+    encryptor.decrypt_from(sealed, len, index);
+    if (index.size() % kEntrySize != 0) {
+        throw std::runtime_error("Corrupt pack index");
+    }
+
+    std::vector<PackEntry> entries(index.size() / kEntrySize);
+    const uint8_t* p = index.data();
+    for (auto& entry : entries) {
+        std::memcpy(entry.hash.data(), p, 32);
+        std::memcpy(&entry.offset, p + 32, sizeof(entry.offset));
+        std::memcpy(&entry.length, p + 40, sizeof(entry.length));
+        p += kEntrySize;
+    }
+    return entries;
+}
+
+} // namespace pack
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace pack {
+
+// A pack batches many small sealed chunks into one stored object:
+//
+//   blob_0 || blob_1 || ... || sealed index || footer
+//
+// Each blob is a sealed chunk (IV || ciphertext || tag), byte-for-byte what
+// would have been uploaded on its own, so it can be fetched with a range
+// request and checked against its manifest hash. The index lists every blob
+// and is sealed under its own key, so a pack is self-describing to the key
+// holder and reveals only its total size to anyone else.
+// Footer: sealed index length (u64) || "SBPK" || format version (u32).
+
+struct PackEntry {
+    std::array<uint8_t, 32> hash;   // SHA-256 of the blob
+    uint64_t offset;
+    uint64_t length;
+};
+
+const size_t kFooterSize = 16;
+
+class PackBuilder {
+public:
+    explicit PackBuilder(const std::array<uint8_t, 32>& index_key);
+    ~PackBuilder();
+
+    // Appends a sealed blob with its hex hash; returns its offset in the pack
+    uint64_t add(const uint8_t* blob, size_t len, const std::string& hash_hex);
+
+    size_t size() const { return data_.size(); }
+    size_t count() const { return entries_.size(); }
+
+    // Appends the sealed index and footer and hands back the finished object.
+    // The builder is empty afterwards and can start the next pack.
+    std::vector<uint8_t> finish();
+
+private:
+    std::array<uint8_t, 32> index_key_;
+    std::vector<uint8_t> data_;
+    std::vector<PackEntry> entries_;
+};
+
+// Length of the sealed index, from a pack's last kFooterSize bytes.
+// The index occupies the bytes just before the footer.
+uint64_t read_footer(const uint8_t* footer, size_t len);
+
+// Authenticates and decodes a sealed index
+std::vector<PackEntry> read_index(const uint8_t* sealed, size_t len, const std::array<uint8_t, 32>& index_key);
+
+} // namespace pack
@@ -0,0 +1,538 @@
+#include "backup_pipeline.h"
+#include "error_slot.h"
+#include "../crypto/encryptor.h"
+#include "../crypto/key_manager.h"
+#include "../dedup/dedup_index.h"
+#include "../pack/pack_file.h"
+#include "../storage/storage_backend.h"
+#include "../storage/uploader.h"
+#include "../utils/bounded_queue.h"
+#include "../utils/buffer_pool.h"
+#include "../utils/file_utils.h"
+#include "../utils/hash_utils.h"
+#include <openssl/crypto.h>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+namespace pipeline {
+
+namespace {
+
+// Plaintext chunk handed from the readers to the encrypt workers. `source`
+// keeps the file's Chunker, and with it any mapping the chunk views, alive.
+struct ReadItem {
+    size_t file;
+    std::shared_ptr<chunker::Chunker> source;
+    chunker::Chunk chunk;
+    size_t reserved;
+};
+
+// Chunk handed to the uploaders: either sealed into `blob` (IV || ciphertext || tag)
+// by an encrypt worker, or still plaintext when uploads encrypt as they stream.
+// A compressed chunk that is streamed travels as `compressed` instead.
+struct UploadItem {
+    size_t file;
+    std::shared_ptr<chunker::Chunker> source;
+    chunker::Chunk chunk;
+    std::vector<uint8_t> blob;
+    std::vector<uint8_t> compressed;
+    compress::Codec codec = compress::Codec::None;
+    std::string hash;
+    std::string iv;
+    std::string fingerprint;
+    dedup::ChunkKey dedup_key;
+    size_t reserved;
+    bool packed;        // small chunk headed for a pack rather than its own object
+};
+
+// Chunk sitting in the open pack, recorded once the pack is uploaded
+struct PackMember {
+    size_t file;
+    ledger::ChunkInfo info;
+    dedup::ChunkKey dedup_key;
+};
+
+// Nominal budget charge for a streamed, mapped chunk: only curl's buffer is live
+const size_t kStreamWindow = 1024 * 1024;
+
+std::string object_name(const std::string& prefix, uint64_t id, const std::string& iv_hex) {
+    return prefix + ".chunk" + std::to_string(id) + "." + iv_hex + ".enc";
+}
+
+// Encrypts a chunk's `len` bytes of payload while the backend stores it: the IV,
+// then ciphertext produced directly into the backend's buffer (curl's send
+// buffer for HTTP), then the tag. The blob hash is computed on the way out, so
+// no buffer larger than the backend's own is ever held. Returns the URI.
+std::string stream_chunk(storage::Uploader& uploader, crypto::Encryptor& encryptor, const chunker::Chunk& chunk,
+                         const uint8_t* plaintext, size_t len, const std::string& prefix, std::string& hash_out,
+                         std::string& iv_out) {
+    uint8_t iv[crypto::Encryptor::kIvSize];
+    uint8_t tag[crypto::Encryptor::kTagSize];
+    encryptor.encrypt_init(iv);
+    iv_out = utils::HashUtils::to_hex(iv, sizeof(iv));
+
+    const size_t body_end = sizeof(iv) + len;
+    const size_t total = crypto::Encryptor::sealed_size(len);
+    size_t pos = 0;
+    utils::Sha256 hasher;
+
+    auto source = [&](uint8_t* buffer, size_t max_len) -> size_t {
+        size_t written = 0;
+        while (written < max_len && pos < total) {
+            size_t n;
+            if (pos < sizeof(iv)) {
+                n = std::min(max_len - written, sizeof(iv) - pos);
+                std::memcpy(buffer + written, iv + pos, n);
+            } else if (pos < body_end) {
+                n = std::min(max_len - written, body_end - pos);
+                encryptor.encrypt_update(plaintext + (pos - sizeof(iv)), n, buffer + written);
+            } else {
+                if (pos == body_end) encryptor.encrypt_final(tag);
+                n = std::min(max_len - written, total - pos);
+                std::memcpy(buffer + written, tag + (pos - body_end), n);
+            }
+            written += n;
+            pos += n;
+        }
+        hasher.update(buffer, written);
+        return written;
+    };
+
+    std::string uri = uploader.upload_chunk_stream(total, source, object_name(prefix, chunk.id, iv_out));
+    if (pos != total) {
+        throw std::runtime_error("Streamed upload ended early for chunk " + std::to_string(chunk.id));
+    }
+    hash_out = hasher.final_hex();
+    return uri;
+}
+
+} // namespace
+
+BackupPipeline::BackupPipeline(const crypto::OperationKeys& keys, const std::string& base_url, const PipelineOptions& options)
+    : key_(keys.data), dedup_key_(keys.dedup), pack_key_(keys.pack), fingerprint_key_(keys.fingerprint),
+      base_url_(base_url), options_(options) {
+    if (keys.scope != crypto::KeyScope::Backup) {
+        throw std::invalid_argument("Backup needs backup-scoped keys");
+    }
+    if (options_.chunking.max_chunk_size() == 0) {
+        throw std::invalid_argument("Chunk size must be positive");
+    }
+    if (options_.encrypt_threads == 0) {
+        options_.encrypt_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if (options_.upload_threads == 0) {
+        options_.upload_threads = 1;
+    }
+    if (!compress::codec_available(options_.compression.codec)) {
+        throw std::invalid_argument(std::string("This build has no ") + compress::codec_name(options_.compression.codec) +
+                                    " support");
+    }
+}
+
+BackupPipeline::~BackupPipeline() {
+    OPENSSL_cleanse(key_.data(), key_.size());
+    OPENSSL_cleanse(dedup_key_.data(), dedup_key_.size());
+    OPENSSL_cleanse(pack_key_.data(), pack_key_.size());
+    OPENSSL_cleanse(fingerprint_key_.data(), fingerprint_key_.size());
+}
+
+void BackupPipeline::set_baseline(const ledger::Manifest& previous) {
+    baseline_.clear();
+    baseline_packs_ = previous.packs;
+    for (const auto* chunk : previous.ordered_chunks()) {
+        // Older manifests carry no fingerprints; their chunks can't be matched
+        if (chunk->fingerprint.empty()) continue;
+        if (!chunk->pack.empty() && !baseline_packs_.count(chunk->pack)) continue;
+        baseline_.emplace(chunk->fingerprint, *chunk);
+    }
+}
+
+std::vector<ledger::ChunkInfo> BackupPipeline::run(const std::string& file_path, const std::string& object_prefix) {
+    SourceFile file;
+    file.path = file_path;
+    file.object_prefix = object_prefix;
+    file.size = utils::FileUtils::get_file_size(file_path);
+    return run(std::vector<SourceFile>{file}, object_prefix)[0];
+}
+
+std::vector<std::vector<ledger::ChunkInfo>> BackupPipeline::run(const std::vector<SourceFile>& files, const std::string& pack_prefix) {
+    // Entries point at objects of one store, so each store has its own index.
+    // mem:// stores die with the process; their entries would outlive them.
+    std::unique_ptr<dedup::DedupIndex> index;
+    if (!options_.dedup_index_path.empty() && storage::url_scheme(base_url_) != "mem") {
+        std::string store = storage::normalize_url(base_url_);
+        std::string id = utils::HashUtils::sha256_hex(reinterpret_cast<const uint8_t*>(store.data()), store.size());
+        index = std::make_unique<dedup::DedupIndex>(options_.dedup_index_path + "/" + id.substr(0, 16));
+    }
+
+    // One uploader for all workers: requests share the transport's connections
+    storage::Uploader uploader(base_url_);
+
+    // Each in-flight chunk holds its plaintext and, briefly, its sealed blob.
+    // Mapped chunks are views into the page cache, so only the blob is counted;
+    // streamed chunks hold no blob, but may hold compressed bytes, plus the
+    // whole stream in backends that buffer it (mem://).
+    utils::MemoryBudget budget(options_.max_memory);
+    const size_t max_chunk = options_.chunking.max_chunk_size();
+    const bool compressing = options_.compression.codec != compress::Codec::None;
+    size_t chunk_cost;
+    if (options_.stream_uploads) {
+        chunk_cost = options_.chunking.memory_map && !compressing ? kStreamWindow : max_chunk;
+        if (uploader.buffers_streams()) chunk_cost += max_chunk;
+    } else {
+        chunk_cost = (options_.chunking.memory_map ? 1 : 2) * max_chunk;
+    }
+    // Packed chunks are always sealed up front, even when streaming
+    const size_t pack_limit = options_.pack_size / 4;
+    if (pack_limit > 0) {
+        chunk_cost = std::max(chunk_cost, std::min(pack_limit, max_chunk));
+    }
+
+    utils::BoundedQueue<ReadItem> read_queue(options_.encrypt_threads * 2);
+    utils::BoundedQueue<UploadItem> upload_queue(options_.upload_threads * 2);
+    ErrorSlot error;
+
+    auto abort_all = [&](std::exception_ptr e) {
+        error.set(e);
+        budget.cancel();
+        read_queue.close();
+        upload_queue.close();
+    };
+
+    // Sealed blobs go back to the pool after upload and are reused by the encrypt workers
+    utils::BufferPool blob_pool;
+
+    std::mutex results_mutex;
+    std::vector<std::map<uint64_t, ledger::ChunkInfo>> results(files.size());
+    std::atomic<uint64_t> reused_chunks{0};
+    std::atomic<uint64_t> reused_bytes{0};
+    std::atomic<uint64_t> unchanged_chunks{0};
+    std::atomic<uint64_t> unchanged_bytes{0};
+    std::atomic<uint64_t> compressed_chunks{0};
+    std::atomic<uint64_t> compressed_from{0};
+    std::atomic<uint64_t> compressed_to{0};
+    std::atomic<uint64_t> incompressible_chunks{0};
+
+    std::mutex log_mutex;
+    auto record = [&](size_t file, ledger::ChunkInfo info, bool reused) {
+        {
+            std::lock_guard<std::mutex> lock(log_mutex);
+            std::cout << (reused ? "Reused Chunk " : "Uploaded Chunk ") << info.id;
+            if (files.size() > 1) std::cout << " of " << files[file].path;
+            std::cout << (reused ? " from " : " to ") << (info.pack.empty() ? info.uri : "pack " + info.pack) << std::endl;
+        }
+        std::lock_guard<std::mutex> lock(results_mutex);
+        results[file].emplace(info.id, std::move(info));
+    };
+
+    // The open pack; whichever upload worker fills it seals and uploads it
+    std::mutex pack_mutex;
+    pack::PackBuilder pack_builder(pack_key_);
+    std::vector<PackMember> pack_members;
+    packs_.clear();
+
+    auto upload_pack = [&](std::vector<uint8_t> object, std::vector<PackMember> members) {
+        std::string pack_id = utils::HashUtils::sha256_hex(object);
+        std::string uri = uploader.upload_chunk(object, pack_prefix + ".pack." + pack_id.substr(0, 16) + ".pack");
+        {
+            std::lock_guard<std::mutex> lock(pack_mutex);
+            packs_[pack_id] = uri;
+        }
+        for (auto& member : members) {
+            member.info.pack = pack_id;
+            if (index) {
+                dedup::DedupEntry entry;
+                entry.uri = uri;
+                entry.hash = member.info.hash;
+                entry.iv = member.info.iv;
+                entry.size = member.info.size;
+                entry.pack = pack_id;
+                entry.pack_offset = member.info.pack_offset;
+                entry.pack_length = member.info.pack_length;
+                entry.codec = member.info.codec;
+                entry.cipher = member.info.cipher;
+                index->insert(member.dedup_key, entry);
+            }
+            record(member.file, std::move(member.info), false);
+        }
+    };
+
+    // Largest files first, so the long tail is small files filling in around them
+    std::vector<size_t> order(files.size());
+    for (size_t f = 0; f < files.size(); f++) order[f] = f;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return files[a].size > files[b].size; });
+    std::atomic<size_t> next_file{0};
+
+    const size_t read_threads = std::max<size_t>(1, std::min(options_.read_threads, files.size()));
+    std::atomic<size_t> readers_running{read_threads};
+    std::vector<std::thread> readers;
+    for (size_t r = 0; r < read_threads; r++) {
+        readers.emplace_back([&] {
+            try {
+                while (!error.failed()) {
+                    size_t k = next_file++;
+                    if (k >= order.size()) break;
+                    size_t f = order[k];
+                    auto chunker = std::make_shared<chunker::Chunker>(files[f].path, options_.chunking);
+                    while (!error.failed() && chunker->hasNext()) {
+                        size_t reserved = budget.acquire(chunk_cost);
+                        if (reserved == 0) break;
+                        ReadItem item{f, chunker, chunker->next(), reserved};
+                        if (!read_queue.push(std::move(item))) {
+                            budget.release(reserved);
+                            break;
+                        }
+                    }
+                }
+            } catch (...) {
+                abort_all(std::current_exception());
+            }
+            if (--readers_running == 0) {
+                read_queue.close();
+            }
+        });
+    }
+
+    std::vector<std::thread> encrypt_workers;
+    std::atomic<size_t> encrypt_running{options_.encrypt_threads};
+    for (size_t i = 0; i < options_.encrypt_threads; i++) {
+        encrypt_workers.emplace_back([&] {
+            try {
+                crypto::Encryptor encryptor(key_, options_.cipher);
+                std::unique_ptr<compress::Compressor> compressor;
+                if (compressing) compressor = std::make_unique<compress::Compressor>(options_.compression);
+                std::vector<uint8_t> compressed;
+                while (auto item = read_queue.pop()) {
+                    if (error.failed()) {
+                        budget.release(item->reserved);
+                        continue;
+                    }
+                    // Unchanged since the baseline backup: reference its entry as is
+                    std::string fingerprint = utils::HashUtils::fast_fingerprint(fingerprint_key_, item->chunk.bytes(), item->chunk.size);
+                    auto prior = baseline_.find(fingerprint);
+                    if (prior != baseline_.end() && prior->second.size == item->chunk.size) {
+                        ledger::ChunkInfo info = prior->second;
+                        info.id = item->chunk.id;
+                        info.offset = item->chunk.offset;
+                        if (!info.pack.empty()) {
+                            std::lock_guard<std::mutex> lock(pack_mutex);
+                            packs_[info.pack] = baseline_packs_.at(info.pack);
+                        }
+                        record(item->file, std::move(info), true);
+                        unchanged_chunks++;
+                        unchanged_bytes += item->chunk.size;
+                        budget.release(item->reserved);
+                        continue;
+                    }
+
+                    // Skip encryption and upload entirely for chunks stored before
+                    dedup::ChunkKey dedup_key{};
+                    if (index) {
+                        dedup_key = utils::HashUtils::hmac_sha256(dedup_key_, item->chunk.bytes(), item->chunk.size);
+                        dedup::DedupEntry existing;
+                        if (index->lookup(dedup_key, existing) && existing.size == item->chunk.size) {
+                            ledger::ChunkInfo info;
+                            info.id = item->chunk.id;
+                            info.offset = item->chunk.offset;
+                            info.size = item->chunk.size;
+                            info.hash = existing.hash;
+                            info.iv = existing.iv;
+                            info.fingerprint = fingerprint;
+                            info.codec = existing.codec;
+                            info.cipher = existing.cipher;
+                            if (existing.pack.empty()) {
+                                info.uri = existing.uri;
+                            } else {
+                                info.pack = existing.pack;
+                                info.pack_offset = existing.pack_offset;
+                                info.pack_length = existing.pack_length;
+                                std::lock_guard<std::mutex> lock(pack_mutex);
+                                packs_[existing.pack] = existing.uri;
+                            }
+                            record(item->file, std::move(info), true);
+                            reused_chunks++;
+                            reused_bytes += item->chunk.size;
+                            budget.release(item->reserved);
+                            continue;
+                        }
+                    }
+
+                    UploadItem upload;
+                    upload.file = item->file;
+                    upload.reserved = item->reserved;
+                    upload.dedup_key = dedup_key;
+                    upload.fingerprint = fingerprint;
+
+                    // What gets sealed: the plaintext, or its compressed form if that is smaller
+                    const uint8_t* payload = item->chunk.bytes();
+                    size_t payload_size = item->chunk.size;
+                    if (compressor) {
+                        upload.codec = compressor->compress(payload, payload_size, compressed);
+                        if (upload.codec != compress::Codec::None) {
+                            payload = compressed.data();
+                            payload_size = compressed.size();
+                            compressed_chunks++;
+                            compressed_from += item->chunk.size;
+                            compressed_to += payload_size;
+                        } else {
+                            incompressible_chunks++;
+                        }
+                    }
+
+                    upload.packed = pack_limit > 0 && crypto::Encryptor::sealed_size(payload_size) <= pack_limit;
+                    if (!options_.stream_uploads || upload.packed) {
+                        upload.blob = blob_pool.acquire();
+                        encryptor.encrypt_into(payload, payload_size, upload.blob);
+                        // The manifest hash covers the whole uploaded blob (IV + ciphertext + tag)
+                        upload.hash = utils::HashUtils::sha256_hex(upload.blob);
+                        upload.iv = utils::HashUtils::to_hex(upload.blob.data(), crypto::Encryptor::kIvSize);
+                        item->chunk.data = std::vector<uint8_t>();
+                    } else if (upload.codec != compress::Codec::None) {
+                        upload.compressed.assign(compressed.begin(), compressed.end());
+                        item->chunk.data = std::vector<uint8_t>();
+                    }
+                    upload.chunk = std::move(item->chunk);
+                    // Streamed chunks still read from the source when uploaded
+                    if (options_.stream_uploads && !upload.packed && upload.codec == compress::Codec::None) {
+                        upload.source = std::move(item->source);
+                    }
+
+                    if (!upload_queue.push(std::move(upload))) {
+                        budget.release(item->reserved);
+                    }
+                }
+            } catch (...) {
+                abort_all(std::current_exception());
+            }
+            if (--encrypt_running == 0) {
+                upload_queue.close();
+            }
+        });
+    }
+
+    std::vector<std::thread> upload_workers;
+    for (size_t i = 0; i < options_.upload_threads; i++) {
+        upload_workers.emplace_back([&] {
+            std::unique_ptr<crypto::Encryptor> stream_encryptor;
+            while (auto item = upload_queue.pop()) {
+                if (error.failed()) {
+                    budget.release(item->reserved);
+                    continue;
+                }
+                try {
+                    if (item->packed) {
+                        std::vector<uint8_t> object;
+                        std::vector<PackMember> members;
+                        {
+                            std::lock_guard<std::mutex> lock(pack_mutex);
+                            PackMember member;
+                            member.file = item->file;
+                            member.info.id = item->chunk.id;
+                            member.info.offset = item->chunk.offset;
+                            member.info.size = item->chunk.size;
+                            member.info.hash = item->hash;
+                            member.info.iv = item->iv;
+                            member.info.fingerprint = item->fingerprint;
+                            member.info.codec = item->codec;
+                            member.info.cipher = options_.cipher;
+                            member.info.pack_offset = pack_builder.add(item->blob.data(), item->blob.size(), item->hash);
+                            member.info.pack_length = item->blob.size();
+                            member.dedup_key = item->dedup_key;
+                            pack_members.push_back(std::move(member));
+                            if (pack_builder.size() >= options_.pack_size) {
+                                object = pack_builder.finish();
+                                members.swap(pack_members);
+                            }
+                        }
+                        // The blob now lives in the pack; free its slot before the upload
+                        blob_pool.release(std::move(item->blob));
+                        budget.release(item->reserved);
+                        item->reserved = 0;
+                        if (!object.empty()) upload_pack(std::move(object), std::move(members));
+                        continue;
+                    }
+
+                    std::string uri;
+                    if (options_.stream_uploads) {
+                        if (!stream_encryptor) stream_encryptor = std::make_unique<crypto::Encryptor>(key_, options_.cipher);
+                        const bool raw = item->codec == compress::Codec::None;
+                        uri = stream_chunk(uploader, *stream_encryptor, item->chunk,
+                                                     raw ? item->chunk.bytes() : item->compressed.data(),
+                                                     raw ? item->chunk.size : item->compressed.size(),
+                                                     files[item->file].object_prefix, item->hash, item->iv);
+                    } else {
+                        uri = uploader.upload_chunk(item->blob, object_name(files[item->file].object_prefix,
+                                                                            item->chunk.id, item->iv));
+                    }
+
+                    ledger::ChunkInfo info;
+                    info.id = item->chunk.id;
+                    info.offset = item->chunk.offset;
+                    info.size = item->chunk.size;
+                    info.hash = item->hash;
+                    info.iv = item->iv;
+                    info.fingerprint = item->fingerprint;
+                    info.codec = item->codec;
+                    info.cipher = options_.cipher;
+                    info.uri = uri;
+                    if (index) {
+                        dedup::DedupEntry entry;
+                        entry.uri = info.uri;
+                        entry.hash = info.hash;
+                        entry.iv = info.iv;
+                        entry.size = info.size;
+                        entry.codec = info.codec;
+                        entry.cipher = info.cipher;
+                        index->insert(item->dedup_key, entry);
+                    }
+                    record(item->file, std::move(info), false);
+                } catch (...) {
+                    abort_all(std::current_exception());
+                }
+                blob_pool.release(std::move(item->blob));
+                budget.release(item->reserved);
+            }
+        });
+    }
+
+    for (auto& t : readers) t.join();
+    for (auto& t : encrypt_workers) t.join();
+    for (auto& t : upload_workers) t.join();
+    error.rethrow();
+    if (pack_builder.count() > 0) {
+        upload_pack(pack_builder.finish(), std::move(pack_members));
+    }
+    if (index) index->flush();
+
+    stats_ = PipelineStats();
+    stats_.deduplicated = index != nullptr;
+    stats_.reused_chunks = reused_chunks;
+    stats_.reused_bytes = reused_bytes;
+    stats_.unchanged_chunks = unchanged_chunks;
+    stats_.unchanged_bytes = unchanged_bytes;
+    stats_.compressed_chunks = compressed_chunks;
+    stats_.compressed_from = compressed_from;
+    stats_.compressed_to = compressed_to;
+    stats_.incompressible_chunks = incompressible_chunks;
+
+    std::vector<std::vector<ledger::ChunkInfo>> chunks(files.size());
+    for (size_t f = 0; f < files.size(); f++) {
+        chunks[f].reserve(results[f].size());
+        for (auto& entry : results[f]) {
+            stats_.chunks++;
+            stats_.bytes += entry.second.size;
+            chunks[f].push_back(std::move(entry.second));
+        }
+    }
+    return chunks;
+}
+
+} // namespace pipeline
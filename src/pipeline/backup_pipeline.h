@@ -0,0 +1,100 @@
+#pragma once
+
+#include "../chunker/chunker.h"
+#include "../compress/codec.h"
+#include "../crypto/cipher_suite.h"
+#include "../crypto/key_manager.h"
+#include "../ledger/manifest.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+namespace pipeline {
+
+struct PipelineOptions {
+    chunker::ChunkingParams chunking;
+    size_t encrypt_threads = 0;              // 0 = one per hardware thread
+    size_t upload_threads = 4;
+    size_t read_threads = 4;                 // files chunked concurrently in multi-file runs
+    size_t max_memory = 256 * 1024 * 1024;   // cap on chunk bytes held in flight
+    std::string dedup_index_path;            // one index per store below it; empty disables dedup
+    bool stream_uploads = false;             // encrypt inside the upload instead of sealing whole blobs
+    size_t pack_size = 0;                    // target pack object size; 0 uploads every chunk on its own
+    compress::CompressionParams compression; // codec None leaves chunks uncompressed
+    crypto::CipherSuite cipher = crypto::CipherSuite::Aes256Gcm;   // seals new chunks
+};
+
+// One input of a multi-file run
+struct SourceFile {
+    std::string path;
+    std::string object_prefix;   // chunk objects are "<object_prefix>.chunk<id>.<iv>.enc"
+    uint64_t size = 0;           // larger files are started first
+};
+
+struct PipelineStats {
+    bool deduplicated = false;    // a dedup index was consulted
+    uint64_t chunks = 0;
+    uint64_t bytes = 0;
+    uint64_t reused_chunks = 0;   // served from the dedup index, not uploaded
+    uint64_t reused_bytes = 0;
+    uint64_t unchanged_chunks = 0;  // matched the baseline manifest by fingerprint
+    uint64_t unchanged_bytes = 0;
+    uint64_t compressed_chunks = 0;      // uploaded compressed
+    uint64_t compressed_from = 0;        // plaintext bytes of those chunks
+    uint64_t compressed_to = 0;          // and what they compressed to
+    uint64_t incompressible_chunks = 0;  // rejected by the entropy probe or not smaller
+
+    double dedup_ratio() const { return bytes ? static_cast<double>(reused_bytes) / bytes : 0.0; }
+};
+
+// Staged backup engine: reader threads, a pool of compress/encrypt/hash
+// workers and a pool of uploaders, connected by bounded queues. Chunks complete out of
+// order but the returned lists are always sorted by chunk id.
+class BackupPipeline {
+public:
+    // `keys` must be of the backup scope
+    BackupPipeline(const crypto::OperationKeys& keys, const std::string& base_url, const PipelineOptions& options);
+    ~BackupPipeline();
+
+    // Chunks, encrypts and uploads a file. Objects are named
+    // "<object_prefix>.chunk<id>.<iv>.enc" so a new upload never overwrites an
+    // object that an older manifest or the dedup index points at.
+    // With packing on, chunks that seal to at most a quarter of pack_size are
+    // batched into "<object_prefix>.pack.<id>.pack" objects instead.
+    std::vector<ledger::ChunkInfo> run(const std::string& file_path, const std::string& object_prefix);
+
+    // Backs up many files in one run and returns each file's chunks, in input
+    // order. Readers claim whole files, largest first, but every stage after
+    // them works per chunk, so one huge file and thousands of tiny ones keep
+    // all workers equally busy. Packs are named "<pack_prefix>.pack.<id>.pack".
+    std::vector<std::vector<ledger::ChunkInfo>> run(const std::vector<SourceFile>& files, const std::string& pack_prefix);
+
+    // Counters for the last run()
+    const PipelineStats& stats() const { return stats_; }
+
+    // Incremental runs: chunks of `previous` become reusable by fingerprint.
+    // A new chunk with the same size and fingerprint references the old entry
+    // instead of being encrypted and uploaded again.
+    void set_baseline(const ledger::Manifest& previous);
+
+    // Packs referenced by the chunks of the last run(): pack id -> object URI
+    const std::map<std::string, std::string>& packs() const { return packs_; }
+
+private:
+    std::array<uint8_t, 32> key_;
+    std::array<uint8_t, 32> dedup_key_;
+    std::array<uint8_t, 32> pack_key_;
+    std::array<uint8_t, 32> fingerprint_key_;
+    PipelineStats stats_;
+    std::map<std::string, std::string> packs_;
+    std::unordered_map<std::string, ledger::ChunkInfo> baseline_;   // by fingerprint
+    std::map<std::string, std::string> baseline_packs_;
+    std::string base_url_;
+    PipelineOptions options_;
+};
+
+} // namespace pipeline
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <atomic>
+#include <exception>
+#include <mutex>
+
+namespace pipeline {
+
+// First failure wins; every stage checks it and bails out early
+class ErrorSlot {
+public:
+    void set(std::exception_ptr e) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!error_) error_ = e;
+        failed_ = true;
+    }
+    bool failed() const { return failed_; }
+    void rethrow() {
+        if (error_) std::rethrow_exception(error_);
+    }
+
+private:
+    std::mutex mutex_;
+    std::exception_ptr error_;
+    std::atomic<bool> failed_{false};
+};
+
+} // namespace pipeline
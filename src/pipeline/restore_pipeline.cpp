@@ -0,0 +1,312 @@
+#include "restore_pipeline.h"
+#include "error_slot.h"
+#include "shard_loader.h"
+#include "../compress/codec.h"
+#include "../crypto/encryptor.h"
+#include "../storage/downloader.h"
+#include "../utils/bounded_queue.h"
+#include "../utils/buffer_pool.h"
+#include "../utils/file_utils.h"
+#include "../utils/hash_utils.h"
+#include "../utils/positional_file.h"
+#include <openssl/crypto.h>
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+namespace pipeline {
+
+namespace {
+
+// One output file and the chunks it is assembled from; the chunks of a
+// sharded manifest are not known until their shards are loaded
+struct Target {
+    const std::vector<ledger::ChunkInfo>* chunks;
+    uint64_t size;
+    std::string path;
+    std::string label;   // shown in progress output for snapshots
+};
+
+// `shard` keeps a lazily loaded shard alive while its chunks are in flight
+struct FetchItem {
+    size_t target;
+    const ledger::ChunkInfo* chunk;
+    std::shared_ptr<const ledger::Manifest> shard;
+    size_t reserved;
+};
+
+struct BlobItem {
+    size_t target;
+    const ledger::ChunkInfo* chunk;
+    std::shared_ptr<const ledger::Manifest> shard;
+    std::vector<uint8_t> blob;
+    size_t reserved;
+};
+
+// Chunks must tile [start, end) exactly, or positional writes would leave
+// holes or overlap; returns end
+uint64_t check_tiling(const std::vector<ledger::ChunkInfo>& chunks, uint64_t start, const std::string& path) {
+    std::vector<const ledger::ChunkInfo*> by_offset;
+    for (const auto& chunk : chunks) by_offset.push_back(&chunk);
+    std::sort(by_offset.begin(), by_offset.end(),
+              [](const ledger::ChunkInfo* a, const ledger::ChunkInfo* b) { return a->offset < b->offset; });
+
+    uint64_t expected = start;
+    for (const auto* chunk : by_offset) {
+        if (chunk->offset != expected) {
+            throw std::runtime_error("Manifest chunks do not cover " + path + " contiguously at offset " +
+                                     std::to_string(expected));
+        }
+        expected += chunk->size;
+    }
+    return expected;
+}
+
+void check_layout(const Target& target) {
+    if (check_tiling(*target.chunks, 0, target.path) != target.size) {
+        throw std::runtime_error("Manifest chunk sizes do not add up to the size of " + target.path);
+    }
+}
+
+} // namespace
+
+RestorePipeline::RestorePipeline(const std::array<uint8_t, 32>& key, const RestoreOptions& options)
+    : key_(key), options_(options) {
+    if (options_.decrypt_threads == 0) {
+        options_.decrypt_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if (options_.download_threads == 0) {
+        options_.download_threads = 1;
+    }
+}
+
+RestorePipeline::~RestorePipeline() {
+    OPENSSL_cleanse(key_.data(), key_.size());
+}
+
+void RestorePipeline::run(const ledger::Manifest& manifest, const std::string& output_path) {
+    std::vector<Target> targets;
+    if (manifest.tree) {
+        // Manifest::validate, run by both the JSON and the binary decoder, keeps
+        // every path relative and free of "." and ".." parts
+        fs::create_directories(output_path);
+        for (const auto& file : manifest.files) {
+            fs::path path = fs::path(output_path) / fs::path(file.path);
+            if (file.directory) {
+                fs::create_directories(path);
+            } else {
+                fs::create_directories(path.parent_path());
+                targets.push_back(Target{&file.chunks, file.size, path.string(), file.path});
+            }
+        }
+    } else {
+        targets.push_back(Target{manifest.sharded() ? nullptr : &manifest.chunks, manifest.original_size, output_path, ""});
+    }
+    for (const auto& target : targets) {
+        if (target.chunks) check_layout(target);
+    }
+    std::unique_ptr<ShardLoader> shards;
+    if (manifest.sharded()) {
+        shards = std::make_unique<ShardLoader>(manifest, options_.download_threads);
+    }
+
+    // Outputs are opened as the dispatcher reaches them and closed by whichever
+    // decrypt worker writes their last chunk, so only files with chunks in
+    // flight hold a descriptor, however many files a snapshot has
+    std::vector<std::unique_ptr<utils::PositionalFile>> outputs(targets.size());
+    std::vector<std::atomic<size_t>> remaining(targets.size());
+    auto finish_target = [&](size_t t) {
+        outputs[t]->close();
+        outputs[t].reset();
+        fs::rename(targets[t].path + ".partial", targets[t].path);
+    };
+
+    // In-flight window: each chunk holds its blob and then its plaintext
+    utils::MemoryBudget budget(options_.max_memory);
+    utils::BoundedQueue<FetchItem> fetch_queue(options_.download_threads * 2);
+    utils::BoundedQueue<BlobItem> decrypt_queue(options_.decrypt_threads * 2);
+    utils::BufferPool pool;
+    ErrorSlot error;
+
+    auto abort_all = [&](std::exception_ptr e) {
+        error.set(e);
+        budget.cancel();
+        fetch_queue.close();
+        decrypt_queue.close();
+    };
+
+    // Queues a run of chunks; false once the run is being torn down
+    auto dispatch = [&](size_t t, const std::vector<ledger::ChunkInfo>& chunks,
+                        const std::shared_ptr<const ledger::Manifest>& shard) {
+        for (const auto& chunk : chunks) {
+            if (error.failed()) return false;
+            // Blob and decrypted plaintext; compressed chunks also hold the inflated copy
+            size_t cost = crypto::Encryptor::sealed_size(chunk.size) + chunk.size;
+            if (chunk.codec != compress::Codec::None) cost += chunk.size;
+            size_t reserved = budget.acquire(cost);
+            if (reserved == 0) return false;
+            if (!fetch_queue.push(FetchItem{t, &chunk, shard, reserved})) {
+                budget.release(reserved);
+                return false;
+            }
+        }
+        return true;
+    };
+
+    // Shards are loaded a batch ahead of the one being dispatched, so only
+    // two batches of chunk entries are held at any time
+    auto dispatch_shards = [&](size_t t) {
+        size_t batch = std::max<size_t>(1, options_.download_threads);
+        auto load_batch = [&](size_t first) {
+            std::vector<size_t> indexes;
+            for (size_t i = first; i < std::min(first + batch, shards->shard_count()); i++) indexes.push_back(i);
+            return std::async(std::launch::async, [&shards, indexes] { return shards->load(indexes); });
+        };
+        uint64_t offset = 0;
+        auto next = load_batch(0);
+        for (size_t first = 0; first < shards->shard_count(); first += batch) {
+            auto loaded = next.get();
+            if (first + batch < shards->shard_count()) next = load_batch(first + batch);
+            for (const auto& shard : loaded) {
+                offset = check_tiling(shard->chunks, offset, targets[t].path);
+                if (!dispatch(t, shard->chunks, shard)) return;
+            }
+        }
+        if (offset != targets[t].size) {
+            throw std::runtime_error("Manifest chunk sizes do not add up to the size of " + targets[t].path);
+        }
+    };
+
+    std::thread dispatcher([&] {
+        try {
+            for (size_t t = 0; t < targets.size() && !error.failed(); t++) {
+                outputs[t] = std::make_unique<utils::PositionalFile>(targets[t].path + ".partial", targets[t].size);
+                if (!targets[t].chunks) {
+                    remaining[t] = manifest.leaf_count();
+                    dispatch_shards(t);
+                    continue;
+                }
+                const auto& chunks = *targets[t].chunks;
+                remaining[t] = chunks.size();
+                if (chunks.empty()) {
+                    finish_target(t);
+                    continue;
+                }
+                if (!dispatch(t, chunks, nullptr)) break;
+            }
+        } catch (...) {
+            abort_all(std::current_exception());
+        }
+        fetch_queue.close();
+    });
+
+    // One downloader for all workers: requests share the transport's connections
+    storage::Downloader downloader;
+
+    std::atomic<size_t> downloads_running{options_.download_threads};
+    std::vector<std::thread> download_workers;
+    for (size_t t = 0; t < options_.download_threads; t++) {
+        download_workers.emplace_back([&] {
+            while (auto item = fetch_queue.pop()) {
+                if (error.failed()) {
+                    budget.release(item->reserved);
+                    continue;
+                }
+                try {
+                    const auto& chunk = *item->chunk;
+                    BlobItem blob_item{item->target, item->chunk, item->shard, pool.acquire(), item->reserved};
+                    if (chunk.pack.empty()) {
+                        downloader.download(chunk.uri, blob_item.blob, crypto::Encryptor::sealed_size(chunk.size));
+                    } else {
+                        // A shard lists the packs its own chunks use
+                        const ledger::Manifest& owner = item->shard ? *item->shard : manifest;
+                        downloader.download_range(owner.object_uri(chunk), chunk.pack_offset, chunk.pack_length, blob_item.blob);
+                    }
+                    if (utils::HashUtils::sha256_hex(blob_item.blob) != chunk.hash) {
+                        throw std::runtime_error("Chunk " + std::to_string(chunk.id) + " does not match its manifest hash");
+                    }
+                    if (!decrypt_queue.push(std::move(blob_item))) {
+                        budget.release(item->reserved);
+                    }
+                } catch (...) {
+                    abort_all(std::current_exception());
+                    budget.release(item->reserved);
+                }
+            }
+            if (--downloads_running == 0) {
+                decrypt_queue.close();
+            }
+        });
+    }
+
+    std::mutex log_mutex;
+    std::vector<std::thread> decrypt_workers;
+    for (size_t t = 0; t < options_.decrypt_threads; t++) {
+        decrypt_workers.emplace_back([&] {
+            try {
+                // One per suite, created on first use; chunks reused across
+                // backups can be sealed with different suites
+                std::unique_ptr<crypto::Encryptor> encryptors[2];
+                compress::Decompressor decompressor;
+                std::vector<uint8_t> plaintext = pool.acquire();
+                std::vector<uint8_t> inflated;
+                while (auto item = decrypt_queue.pop()) {
+                    if (!error.failed()) {
+                        const Target& target = targets[item->target];
+                        const auto& chunk = *item->chunk;
+                        // Authenticates before anything reaches the output file
+                        auto& encryptor = encryptors[static_cast<size_t>(chunk.cipher)];
+                        if (!encryptor) encryptor = std::make_unique<crypto::Encryptor>(key_, chunk.cipher);
+                        encryptor->decrypt_from(item->blob.data(), item->blob.size(), plaintext);
+                        const std::vector<uint8_t>* data = &plaintext;
+                        if (chunk.codec != compress::Codec::None) {
+                            decompressor.decompress(chunk.codec, plaintext.data(), plaintext.size(), chunk.size, inflated);
+                            data = &inflated;
+                        }
+                        if (data->size() != chunk.size) {
+                            throw std::runtime_error("Chunk " + std::to_string(chunk.id) + " has the wrong size");
+                        }
+                        outputs[item->target]->write_at(chunk.offset, data->data(), data->size());
+                        if (--remaining[item->target] == 0) {
+                            finish_target(item->target);
+                        }
+
+                        std::lock_guard<std::mutex> lock(log_mutex);
+                        std::cout << "Restored Chunk " << chunk.id;
+                        if (!target.label.empty()) std::cout << " of " << target.label;
+                        std::cout << std::endl;
+                    }
+                    pool.release(std::move(item->blob));
+                    item->shard.reset();
+                    budget.release(item->reserved);
+                }
+                OPENSSL_cleanse(plaintext.data(), plaintext.size());
+                OPENSSL_cleanse(inflated.data(), inflated.size());
+                pool.release(std::move(plaintext));
+            } catch (...) {
+                abort_all(std::current_exception());
+            }
+        });
+    }
+
+    dispatcher.join();
+    for (auto& t : download_workers) t.join();
+    for (auto& t : decrypt_workers) t.join();
+
+    if (error.failed()) {
+        // Files completed before the failure stay in place; unfinished ones are removed
+        for (size_t t = 0; t < targets.size(); t++) {
+            if (!outputs[t]) continue;
+            outputs[t].reset();
+            utils::FileUtils::remove_file(targets[t].path + ".partial");
+        }
+        error.rethrow();
+    }
+}
+
+} // namespace pipeline
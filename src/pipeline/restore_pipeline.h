@@ -0,0 +1,35 @@
+#pragma once
+
+#include "../ledger/manifest.h"
+#include <string>
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+namespace pipeline {
+
+struct RestoreOptions {
+    size_t download_threads = 8;
+    size_t decrypt_threads = 0;              // 0 = one per hardware thread
+    size_t max_memory = 256 * 1024 * 1024;   // cap on blob/plaintext bytes held in flight
+};
+
+// Reassembles a file from its manifest: concurrent downloads feed a pool of
+// decrypt workers, which authenticate each chunk and write it at its offset
+// in a preallocated output file. Chunks may complete in any order.
+class RestorePipeline {
+public:
+    RestorePipeline(const std::array<uint8_t, 32>& key, const RestoreOptions& options);
+    ~RestorePipeline();
+
+    // Writes to "<output_path>.partial" and renames over output_path on success.
+    // A snapshot manifest is restored into the directory output_path, each
+    // file through its own ".partial" file; chunks of all files share the workers.
+    void run(const ledger::Manifest& manifest, const std::string& output_path);
+
+private:
+    std::array<uint8_t, 32> key_;
+    RestoreOptions options_;
+};
+
+} // namespace pipeline
@@ -0,0 +1,190 @@
+#include "sampled_verifier.h"
+#include "error_slot.h"
+#include "shard_loader.h"
+#include "../crypto/encryptor.h"
+#include "../storage/downloader.h"
+#include "../utils/hash_utils.h"
+#include <openssl/rand.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_set>
+
+namespace pipeline {
+
+SeededSampler::SeededSampler(const std::array<uint8_t, 32>& seed) : seed_(seed) {
+}
+
+uint64_t SeededSampler::next() {
+    if (used_ == block_.size()) {
+        uint8_t counter[8];
+        std::memcpy(counter, &counter_, sizeof(counter));
+        counter_++;
+        auto mac = utils::HashUtils::hmac_sha256(seed_, counter, sizeof(counter));
+        std::memcpy(block_.data(), mac.data(), mac.size());
+        used_ = 0;
+    }
+    return block_[used_++];
+}
+
+uint64_t SeededSampler::uniform(uint64_t bound) {
+    if (bound == 0) {
+        throw std::invalid_argument("Empty sampling range");
+    }
+    // Largest multiple of bound that fits; draws at or above it are retried
+    uint64_t limit = UINT64_MAX - (UINT64_MAX % bound + 1) % bound;
+    uint64_t value;
+    do {
+        value = next();
+    } while (value > limit);
+    return value % bound;
+}
+
+std::vector<size_t> SeededSampler::sample(size_t n, size_t k) {
+    if (k > n) {
+        throw std::invalid_argument("Sample larger than population");
+    }
+    std::unordered_set<size_t> chosen;
+    chosen.reserve(k);
+    for (size_t j = n - k; j < n; j++) {
+        size_t t = uniform(j + 1);
+        chosen.insert(chosen.count(t) ? j : t);
+    }
+    std::vector<size_t> out(chosen.begin(), chosen.end());
+    std::sort(out.begin(), out.end());
+    return out;
+}
+
+SampledVerifier::SampledVerifier(const SampleOptions& options) : options_(options) {
+    if (options_.download_threads == 0) options_.download_threads = 1;
+}
+
+SamplePlan SampledVerifier::plan(size_t chunk_count, double confidence, double corruption) {
+    if (!(confidence > 0.0 && confidence <= 1.0)) {
+        throw std::invalid_argument("Confidence must be in (0, 1]");
+    }
+    if (!(corruption > 0.0 && corruption <= 1.0)) {
+        throw std::invalid_argument("Corruption fraction must be in (0, 1]");
+    }
+    SamplePlan plan;
+    plan.chunk_count = chunk_count;
+    if (chunk_count == 0) {
+        return plan;
+    }
+    plan.corrupt_chunks = std::min(chunk_count, std::max<size_t>(1, static_cast<size_t>(std::ceil(corruption * chunk_count))));
+
+    // Grow k until the chance that every sample misses the bad chunks is low
+    // enough. Reaches zero by k = n - bad + 1, so the loop always ends.
+    size_t n = chunk_count;
+    size_t bad = plan.corrupt_chunks;
+    double miss = 1.0;
+    size_t k = 0;
+    while (k < n && 1.0 - miss < confidence) {
+        miss *= static_cast<double>(n - bad - std::min(n - bad, k)) / static_cast<double>(n - k);
+        k++;
+    }
+    plan.sample_size = k;
+    plan.confidence = 1.0 - miss;
+    return plan;
+}
+
+SampleReport SampledVerifier::run(const ledger::Manifest& manifest) {
+    uint64_t chunk_count = manifest.leaf_count();
+
+    SampleReport report;
+    report.plan = plan(chunk_count, options_.confidence, options_.corruption);
+
+    std::array<uint8_t, 32> seed;
+    if (options_.seed.empty()) {
+        if (RAND_bytes(seed.data(), static_cast<int>(seed.size())) != 1) {
+            throw std::runtime_error("Failed to generate sampling seed");
+        }
+    } else {
+        utils::HashUtils::from_hex(options_.seed, seed.data(), seed.size());
+    }
+    report.seed = utils::HashUtils::to_hex(seed.data(), seed.size());
+    report.sampled = SeededSampler(seed).sample(chunk_count, report.plan.sample_size);
+
+    // Each sampled chunk with the manifest (or shard) that lists it; a
+    // sharded manifest only loads the shards that were sampled
+    std::vector<const ledger::ChunkInfo*> chunks(report.sampled.size());
+    std::vector<const ledger::Manifest*> owners(report.sampled.size(), &manifest);
+    std::vector<std::shared_ptr<const ledger::Manifest>> shards;
+    if (manifest.sharded()) {
+        ShardLoader loader(manifest, options_.download_threads);
+        std::vector<size_t> needed;
+        for (size_t index : report.sampled) {
+            if (needed.empty() || needed.back() != loader.shard_of(index)) needed.push_back(loader.shard_of(index));
+        }
+        shards = loader.load(needed);
+        size_t s = 0;
+        for (size_t n = 0; n < report.sampled.size(); n++) {
+            while (needed[s] != loader.shard_of(report.sampled[n])) s++;
+            owners[n] = shards[s].get();
+            chunks[n] = &shards[s]->chunks[report.sampled[n] - manifest.shards[needed[s]].first_chunk];
+        }
+        std::cout << "Loaded " << needed.size() << " of " << loader.shard_count() << " manifest shards." << std::endl;
+    } else {
+        auto ordered = manifest.ordered_chunks();
+        for (size_t n = 0; n < report.sampled.size(); n++) chunks[n] = ordered[report.sampled[n]];
+    }
+
+    // Download workers claim sampled chunks in order; each hashes its own blobs
+    std::atomic<size_t> cursor{0};
+    std::mutex report_mutex;
+    ErrorSlot error;
+    auto worker = [&]() {
+        try {
+            storage::Downloader downloader;
+            std::vector<uint8_t> blob;
+            for (;;) {
+                size_t n = cursor.fetch_add(1);
+                if (n >= report.sampled.size() || error.failed()) break;
+                size_t index = report.sampled[n];
+                const auto& chunk = *chunks[n];
+
+                // Missing or unreadable objects count as detected corruption
+                std::string failure;
+                try {
+                    if (chunk.pack.empty()) {
+                        downloader.download(chunk.uri, blob, crypto::Encryptor::sealed_size(chunk.size));
+                    } else {
+                        downloader.download_range(owners[n]->object_uri(chunk), chunk.pack_offset, chunk.pack_length, blob);
+                    }
+                    if (utils::HashUtils::sha256(blob.data(), blob.size()) != utils::HashUtils::digest_from_hex(chunk.hash)) {
+                        failure = "Hash mismatch";
+                    }
+                } catch (const std::exception& e) {
+                    failure = e.what();
+                }
+                std::lock_guard<std::mutex> lock(report_mutex);
+                std::cout << "Verifying chunk " << index << "... "
+                          << (failure.empty() ? "OK" : "FAILED (" + failure + ")") << std::endl;
+                if (!failure.empty()) report.failed.push_back(index);
+            }
+        } catch (...) {
+            error.set(std::current_exception());
+        }
+    };
+
+    std::vector<std::thread> workers;
+    size_t threads = std::min(options_.download_threads, std::max<size_t>(1, report.sampled.size()));
+    for (size_t i = 0; i < threads; i++) {
+        workers.emplace_back(worker);
+    }
+    for (auto& t : workers) {
+        t.join();
+    }
+    error.rethrow();
+
+    std::sort(report.failed.begin(), report.failed.end());
+    return report;
+}
+
+} // namespace pipeline
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "../ledger/manifest.h"
+#include <string>
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace pipeline {
+
+struct SampleOptions {
+    double confidence = 0.99;     // target probability of catching the corruption below
+    double corruption = 0.01;     // fraction of chunks assumed damaged or missing
+    std::string seed;             // 64 hex chars; empty = fresh random seed
+    size_t download_threads = 8;
+};
+
+// Sample size for `chunk_count` chunks. Sampling is without replacement, so
+// the miss probability is hypergeometric: prod (n - bad - i) / (n - i).
+struct SamplePlan {
+    size_t chunk_count = 0;
+    size_t corrupt_chunks = 0;    // ceil(corruption * n), at least one
+    size_t sample_size = 0;       // smallest k reaching the target
+    double confidence = 0.0;      // detection probability that k actually gives
+};
+
+struct SampleReport {
+    SamplePlan plan;
+    std::string seed;                 // hex, to repeat the same sample
+    std::vector<size_t> sampled;      // Merkle leaf indices, ascending
+    std::vector<size_t> failed;       // subset of sampled that did not authenticate
+};
+
+// Deterministic CSPRNG: HMAC-SHA256(seed, counter) blocks. The same seed
+// always picks the same chunks, so an audit can be repeated exactly.
+class SeededSampler {
+public:
+    explicit SeededSampler(const std::array<uint8_t, 32>& seed);
+
+    // Uniform in [0, bound), by rejection so there is no modulo bias
+    uint64_t uniform(uint64_t bound);
+
+    // `k` distinct values from [0, n), ascending (Floyd's algorithm)
+    std::vector<size_t> sample(size_t n, size_t k);
+
+private:
+    uint64_t next();
+
+    std::array<uint8_t, 32> seed_;
+    uint64_t counter_ = 0;
+    std::array<uint64_t, 4> block_;
+    size_t used_ = 4;
+};
+
+// Spot-checks a random subset of a manifest's chunks: the sampled blobs are
+// fetched concurrently and hashed against the manifest. The caller is
+// expected to have checked the manifest's hashes against its Merkle root,
+// which is what ties every sampled hash to the root. For a sharded manifest
+// only the shards holding sampled chunks are fetched, and ShardLoader
+// performs that check.
+class SampledVerifier {
+public:
+    explicit SampledVerifier(const SampleOptions& options);
+
+    static SamplePlan plan(size_t chunk_count, double confidence, double corruption);
+
+    SampleReport run(const ledger::Manifest& manifest);
+
+private:
+    SampleOptions options_;
+};
+
+} // namespace pipeline
@@ -0,0 +1,98 @@
+#include "shard_loader.h"
+#include "error_slot.h"
+#include "../ledger/binary_manifest.h"
+#include "../merkle/merkle_tree.h"
+#include "../utils/hash_utils.h"
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+
+namespace pipeline {
+
+ShardLoader::ShardLoader(const ledger::Manifest& top, size_t threads)
+    : top_(top), threads_(std::max<size_t>(1, threads)) {
+    if (!top_.sharded()) {
+        throw std::invalid_argument("Manifest is not sharded");
+    }
+    if (top_.version < 2 || top_.shards.size() < 2) {
+        throw std::runtime_error("Sharded manifest needs version 2 Merkle hashing and at least two shards");
+    }
+    std::vector<merkle::Digest> roots;
+    for (const auto& shard : top_.shards) {
+        roots.push_back(utils::HashUtils::digest_from_hex(shard.root));
+    }
+    if (utils::HashUtils::to_hex(merkle::MerkleTree::compute_root_from_nodes(roots)) != top_.merkle_root) {
+        throw std::runtime_error("Shard roots do not match the manifest Merkle root");
+    }
+}
+
+std::shared_ptr<const ledger::Manifest> ShardLoader::load(size_t index) {
+    if (index >= top_.shards.size()) {
+        throw std::out_of_range("Shard " + std::to_string(index) + " out of range");
+    }
+    const auto& info = top_.shards[index];
+    auto data = downloader_.download(info.uri);
+    if (!ledger::BinaryManifest::detect(data.data(), data.size())) {
+        throw std::runtime_error("Shard " + std::to_string(index) + " is not a binary manifest");
+    }
+    auto shard = std::make_shared<ledger::Manifest>(ledger::BinaryManifest(std::move(data)).to_manifest());
+    if (shard->tree || shard->sharded() || shard->chunks.size() != info.chunk_count) {
+        throw std::runtime_error("Shard " + std::to_string(index) + " does not match its entry in the manifest");
+    }
+
+    std::vector<merkle::Digest> leaves;
+    leaves.reserve(shard->chunks.size());
+    for (const auto& chunk : shard->chunks) {
+        leaves.push_back(utils::HashUtils::digest_from_hex(chunk.hash));
+    }
+    if (utils::HashUtils::to_hex(merkle::MerkleTree::compute_subtree_root(leaves, top_.shard_height(), 1)) !=
+        info.root) {
+        throw std::runtime_error("Shard " + std::to_string(index) + " chunk hashes do not match its root");
+    }
+    return shard;
+}
+
+std::vector<std::shared_ptr<const ledger::Manifest>> ShardLoader::load(const std::vector<size_t>& shards) {
+    std::vector<std::shared_ptr<const ledger::Manifest>> loaded(shards.size());
+    std::atomic<size_t> cursor{0};
+    ErrorSlot error;
+    auto worker = [&]() {
+        try {
+            for (size_t n; (n = cursor.fetch_add(1)) < shards.size() && !error.failed();) {
+                loaded[n] = load(shards[n]);
+            }
+        } catch (...) {
+            error.set(std::current_exception());
+        }
+    };
+
+    std::vector<std::thread> workers;
+    size_t count = std::min(threads_, shards.size());
+    for (size_t i = 1; i < count; i++) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto& t : workers) {
+        t.join();
+    }
+    error.rethrow();
+    return loaded;
+}
+
+ledger::Manifest ShardLoader::load_all() {
+    std::vector<size_t> all(top_.shards.size());
+    for (size_t i = 0; i < all.size(); i++) all[i] = i;
+
+    ledger::Manifest flat = top_;
+    flat.shards.clear();
+    flat.shard_chunks = 0;
+    flat.chunks.reserve(top_.leaf_count());
+    for (const auto& shard : load(all)) {
+        flat.chunks.insert(flat.chunks.end(), shard->chunks.begin(), shard->chunks.end());
+        flat.packs.insert(shard->packs.begin(), shard->packs.end());
+    }
+    return flat;
+}
+
+} // namespace pipeline
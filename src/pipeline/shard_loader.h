@@ -0,0 +1,38 @@
+#pragma once
+
+#include "../ledger/manifest.h"
+#include "../storage/downloader.h"
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace pipeline {
+
+// Fetches the shards of a sharded manifest as they are needed. The shard
+// roots in the top-level manifest are checked against its Merkle root once,
+// on construction, and every shard's chunk hashes against its root as it is
+// loaded, so a loaded shard is as trustworthy as the root itself.
+class ShardLoader {
+public:
+    // `top` must outlive the loader; `threads` bounds concurrent fetches
+    explicit ShardLoader(const ledger::Manifest& top, size_t threads = 4);
+
+    size_t shard_count() const { return top_.shards.size(); }
+    size_t shard_of(uint64_t leaf) const { return static_cast<size_t>(leaf / top_.shard_chunks); }
+
+    std::shared_ptr<const ledger::Manifest> load(size_t shard);
+    // Fetched concurrently; results in the order requested
+    std::vector<std::shared_ptr<const ledger::Manifest>> load(const std::vector<size_t>& shards);
+
+    // Every chunk of every shard, flattened into a copy of the top-level
+    // manifest (for callers that really need them all)
+    ledger::Manifest load_all();
+
+private:
+    const ledger::Manifest& top_;
+    size_t threads_;
+    storage::Downloader downloader_;
+};
+
+} // namespace pipeline
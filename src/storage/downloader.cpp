@@ -1,50 +1,54 @@
 #include "downloader.h"
-#include <curl/curl.h>
+#include "../metrics/metrics.h"
+#include <map>
 #include <stdexcept>
 
 namespace storage {
 
 Downloader::Downloader() {
-    // curl_global_init is handled in Uploader or main, but safe to call multiple times if balanced?
-    // Better to have a global init helper. For now, we assume it's initialized.
 }
 
 Downloader::~Downloader() {
 }
 
-size_t Downloader::write_callback(void* contents, size_t size, size_t nmemb, void* userp) {
-    size_t realsize = size * nmemb;
-    std::vector<uint8_t>* mem = (std::vector<uint8_t>*)userp;
-    size_t old_size = mem->size();
-    mem->resize(old_size + realsize);
-    std::memcpy(mem->data() + old_size, contents, realsize);
-    return realsize;
+std::vector<uint8_t> Downloader::download(const std::string& uri) {
+    std::vector<uint8_t> buffer;
+    download(uri, buffer, 0);
+    return buffer;
 }
 
-std::vector<uint8_t> Downloader::download(const std::string& uri) {
-    CURL* curl;
-    CURLcode res;
+void Downloader::download(const std::string& uri, std::vector<uint8_t>& buffer, size_t size_hint) {
+    metrics::ScopedTimer timer(metrics::Stage::Download);
+    backend_for(uri)->get(uri, buffer, size_hint);
+    timer.add_bytes(buffer.size());
+}
+
+std::vector<uint8_t> Downloader::download_range(const std::string& uri, uint64_t offset, uint64_t length) {
     std::vector<uint8_t> buffer;
+    download_range(uri, offset, length, buffer);
+    return buffer;
+}
+
+void Downloader::download_range(const std::string& uri, uint64_t offset, uint64_t length, std::vector<uint8_t>& buffer) {
+    metrics::ScopedTimer timer(metrics::Stage::Download, length);
+    backend_for(uri)->get_range(uri, offset, length, buffer);
+}
 
-    curl = curl_easy_init();
-    if (curl) {
-        curl_easy_setopt(curl, CURLOPT_URL, uri.c_str());
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &buffer);
-        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-
-        res = curl_easy_perform(curl);
-        if (res != CURLE_OK) {
-            std::string error_msg = curl_easy_strerror(res);
-            curl_easy_cleanup(curl);
-            throw std::runtime_error("CURL download failed: " + error_msg);
-        }
-
-        curl_easy_cleanup(curl);
-    } else {
-        throw std::runtime_error("Failed to init CURL");
+bool Downloader::exists(const std::string& uri) {
+    return backend_for(uri)->exists(uri);
+}
+
+void Downloader::download_batch(const std::vector<GetRequest>& requests) {
+    // Requests are grouped per backend so each group can run as one batch
+    std::map<std::shared_ptr<StorageBackend>, std::vector<GetRequest>> groups;
+    for (const auto& r : requests) {
+        groups[backend_for(r.uri)].push_back(r);
     }
-    return buffer;
+    metrics::ScopedTimer timer(metrics::Stage::Download);
+    for (const auto& group : groups) {
+        group.first->get_batch(group.second);
+    }
+    for (const auto& r : requests) timer.add_bytes(r.out->size());
 }
 
 } // namespace storage
@@ -1,10 +1,15 @@
 #pragma once
 
+#include "storage_backend.h"
 #include <string>
 #include <vector>
+#include <memory>
 
 namespace storage {
 
+// Reads objects by URI from whichever backend serves its scheme (see
+// backend_for), so one manifest may refer to objects in several stores.
+// Missing objects and HTTP error statuses are reported as exceptions.
 class Downloader {
 public:
     Downloader();
@@ -13,8 +18,19 @@ public:
     // Downloads data from a URI
     std::vector<uint8_t> download(const std::string& uri);
 
-private:
-    static size_t write_callback(void* contents, size_t size, size_t nmemb, void* userp);
+    // Downloads into a reusable buffer (cleared first, capacity reserved for
+    // `size_hint` bytes)
+    void download(const std::string& uri, std::vector<uint8_t>& buffer, size_t size_hint);
+
+    // Downloads `length` bytes starting at `offset` (HTTP Range request)
+    std::vector<uint8_t> download_range(const std::string& uri, uint64_t offset, uint64_t length);
+    void download_range(const std::string& uri, uint64_t offset, uint64_t length, std::vector<uint8_t>& buffer);
+
+    bool exists(const std::string& uri);
+
+    // Fetches several objects or ranges at once, concurrently where the
+    // backend allows
+    void download_batch(const std::vector<GetRequest>& requests);
 };
 
 } // namespace storage
@@ -0,0 +1,187 @@
+#include "http_backend.h"
+#include <nlohmann/json.hpp>
+#include <exception>
+#include <future>
+#include <stdexcept>
+
+using json = nlohmann::json;
+
+namespace storage {
+
+namespace {
+
+// `field` of the server's JSON answer
+std::string answer_field(const HttpResponse& response, const char* field, const std::string& what) {
+    json answer = json::parse(response.body.begin(), response.body.end(), nullptr, false);
+    if (!answer.is_object() || !answer.contains(field) || !answer[field].is_string()) {
+        throw std::runtime_error("Unexpected answer to the upload of " + what + " (HTTP " +
+                                 std::to_string(response.status) + ")");
+    }
+    return answer[field];
+}
+
+HttpRequest range_request(const std::string& uri, uint64_t offset, uint64_t length, std::vector<uint8_t>& out) {
+    HttpRequest request;
+    request.url = uri;
+    request.range = std::to_string(offset) + "-" + std::to_string(offset + length - 1);
+    request.fail_on_http_error = true;
+    request.sink = &out;
+    return request;
+}
+
+void check_range(const std::string& uri, const HttpResponse& response, uint64_t offset, uint64_t length,
+                 std::vector<uint8_t>& out) {
+    // A server that ignores Range answers 200 with the whole object
+    if (response.status == 200 && out.size() > length) {
+        if (offset + length > out.size()) {
+            throw std::runtime_error("Range past end of " + uri);
+        }
+        out.erase(out.begin(), out.begin() + offset);
+        out.resize(length);
+    }
+    if (out.size() != length) {
+        throw std::runtime_error("Short range read from " + uri + ": expected " + std::to_string(length) +
+                                 " bytes, got " + std::to_string(out.size()));
+    }
+}
+
+} // namespace
+
+HttpBackend::HttpBackend(const std::string& base_url, std::shared_ptr<Transport> transport)
+    : base_url_(base_url), transport_(std::move(transport)) {
+    while (!base_url_.empty() && base_url_.back() == '/') base_url_.pop_back();
+}
+
+const std::string& HttpBackend::base_url() const {
+    if (base_url_.empty()) {
+        throw std::logic_error("HTTP backend opened for reading only");
+    }
+    return base_url_;
+}
+
+HttpRequest HttpBackend::upload_request(const std::string& name) const {
+    HttpRequest request;
+    request.method = HttpRequest::Method::Post;
+    request.url = base_url() + "/upload";
+    request.form_field = "chunk";
+    request.form_filename = name;
+    request.fail_on_http_error = true;
+    return request;
+}
+
+std::string HttpBackend::put(const std::string& name, const uint8_t* data, size_t len) {
+    HttpRequest request = upload_request(name);
+    request.body = data;
+    request.body_size = len;
+    return answer_field(transport_->perform(std::move(request)), "uri", name);
+}
+
+std::string HttpBackend::put_stream(const std::string& name, size_t total_size, const StreamSource& source) {
+    HttpRequest request = upload_request(name);
+    request.body_size = total_size;
+    request.body_source = source;
+    return answer_field(transport_->perform(std::move(request)), "uri", name);
+}
+
+std::string HttpBackend::put_manifest(const std::string& manifest_json) {
+    HttpRequest request;
+    request.method = HttpRequest::Method::Post;
+    request.url = base_url() + "/manifest";
+    request.body = reinterpret_cast<const uint8_t*>(manifest_json.data());
+    request.body_size = manifest_json.size();
+    request.content_type = "application/json";
+    request.fail_on_http_error = true;
+    return answer_field(transport_->perform(std::move(request)), "url", "the manifest");
+}
+
+void HttpBackend::get(const std::string& uri, std::vector<uint8_t>& out, size_t size_hint) {
+    out.clear();
+    out.reserve(size_hint);
+
+    HttpRequest request;
+    request.url = uri;
+    request.fail_on_http_error = true;
+    request.sink = &out;
+    transport_->perform(std::move(request));
+}
+
+void HttpBackend::get_range(const std::string& uri, uint64_t offset, uint64_t length, std::vector<uint8_t>& out) {
+    out.clear();
+    if (length == 0) return;
+    out.reserve(length);
+    HttpResponse response = transport_->perform(range_request(uri, offset, length, out));
+    check_range(uri, response, offset, length, out);
+}
+
+bool HttpBackend::exists(const std::string& uri) {
+    HttpRequest request;
+    request.method = HttpRequest::Method::Head;
+    request.url = uri;
+    HttpResponse response = transport_->perform(std::move(request));
+    if (response.status == 404) return false;
+    if (response.status >= 200 && response.status < 300) return true;
+    throw std::runtime_error("HTTP " + std::to_string(response.status) + " checking " + uri);
+}
+
+std::vector<std::string> HttpBackend::put_batch(const std::vector<PutRequest>& objects) {
+    std::vector<std::future<HttpResponse>> pending;
+    pending.reserve(objects.size());
+    for (const auto& object : objects) {
+        HttpRequest request = upload_request(object.name);
+        request.body = object.data;
+        request.body_size = object.size;
+        pending.push_back(transport_->submit(std::move(request)));
+    }
+
+    // Every transfer is waited for, even after a failure, since they read the callers' buffers
+    std::vector<std::string> uris(objects.size());
+    std::exception_ptr error;
+    for (size_t i = 0; i < pending.size(); i++) {
+        try {
+            uris[i] = answer_field(pending[i].get(), "uri", objects[i].name);
+        } catch (...) {
+            if (!error) error = std::current_exception();
+        }
+    }
+    if (error) std::rethrow_exception(error);
+    return uris;
+}
+
+void HttpBackend::get_batch(const std::vector<GetRequest>& requests) {
+    std::vector<std::future<HttpResponse>> pending;
+    pending.reserve(requests.size());
+    for (const auto& r : requests) {
+        r.out->clear();
+        if (r.range) {
+            if (r.length == 0) {
+                pending.emplace_back();
+                continue;
+            }
+            r.out->reserve(r.length);
+            pending.push_back(transport_->submit(range_request(r.uri, r.offset, r.length, *r.out)));
+        } else {
+            HttpRequest request;
+            request.url = r.uri;
+            request.fail_on_http_error = true;
+            request.sink = r.out;
+            pending.push_back(transport_->submit(std::move(request)));
+        }
+    }
+
+    // As for puts, the sinks must outlive every transfer
+    std::exception_ptr error;
+    for (size_t i = 0; i < pending.size(); i++) {
+        if (!pending[i].valid()) continue;
+        try {
+            HttpResponse response = pending[i].get();
+            if (requests[i].range) {
+                check_range(requests[i].uri, response, requests[i].offset, requests[i].length, *requests[i].out);
+            }
+        } catch (...) {
+            if (!error) error = std::current_exception();
+        }
+    }
+    if (error) std::rethrow_exception(error);
+}
+
+} // namespace storage
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "storage_backend.h"
+#include "transport.h"
+#include <memory>
+#include <string>
+
+namespace storage {
+
+// The upload server: objects are POSTed as multipart "chunk" parts to
+// <base>/upload and manifests as JSON to <base>/manifest, which answer with
+// {"uri": ...} and {"url": ...}. Reads are plain GETs (Range for ranges,
+// HEAD for exists), so any HTTP server holding the objects can serve them.
+// Batches are submitted to the transport together and run concurrently.
+class HttpBackend : public StorageBackend {
+public:
+    // An empty `base_url` gives a read-only backend
+    explicit HttpBackend(const std::string& base_url, std::shared_ptr<Transport> transport = Transport::shared());
+
+    std::string put(const std::string& name, const uint8_t* data, size_t len) override;
+    std::string put_stream(const std::string& name, size_t total_size, const StreamSource& source) override;
+    std::string put_manifest(const std::string& manifest_json) override;
+
+    void get(const std::string& uri, std::vector<uint8_t>& out, size_t size_hint = 0) override;
+    void get_range(const std::string& uri, uint64_t offset, uint64_t length, std::vector<uint8_t>& out) override;
+    bool exists(const std::string& uri) override;
+
+    std::vector<std::string> put_batch(const std::vector<PutRequest>& objects) override;
+    void get_batch(const std::vector<GetRequest>& requests) override;
+
+private:
+    std::string base_url_;
+    std::shared_ptr<Transport> transport_;
+
+    const std::string& base_url() const;
+    HttpRequest upload_request(const std::string& name) const;
+};
+
+} // namespace storage
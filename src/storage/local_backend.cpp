@@ -0,0 +1,132 @@
+#include "local_backend.h"
+#include "../utils/file_utils.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <stdexcept>
+
+namespace storage {
+
+namespace {
+
+const char kFilePrefix[] = "file://";
+// Bytes pulled from a stream source per write
+const size_t kStreamPiece = 1024 * 1024;
+
+} // namespace
+
+LocalBackend::LocalBackend(const std::string& root) {
+    if (root.empty()) return;
+    root_ = fs::absolute(root).lexically_normal().string();
+    while (root_.size() > 1 && root_.back() == '/') root_.pop_back();
+    fs::create_directories(fs::path(root_) / "manifests");
+}
+
+std::string LocalBackend::object_path(const std::string& name) const {
+    if (root_.empty()) {
+        throw std::logic_error("Local backend opened for reading only");
+    }
+    fs::path relative = fs::path(name).lexically_normal();
+    if (name.empty() || relative.is_absolute() || *relative.begin() == "..") {
+        throw std::invalid_argument("Object name leaves the storage directory: " + name);
+    }
+    fs::path path = fs::path(root_) / relative;
+    fs::create_directories(path.parent_path());
+    return path.string();
+}
+
+std::string LocalBackend::path_of(const std::string& uri) {
+    if (uri.compare(0, sizeof(kFilePrefix) - 1, kFilePrefix) != 0) {
+        throw std::invalid_argument("Not a file:// URI: " + uri);
+    }
+    return uri.substr(sizeof(kFilePrefix) - 1);
+}
+
+std::string LocalBackend::put(const std::string& name, const uint8_t* data, size_t len) {
+    std::string path = object_path(name);
+    utils::FileUtils::write_file_atomic(path, data, len);
+    return kFilePrefix + path;
+}
+
+std::string LocalBackend::put_stream(const std::string& name, size_t total_size, const StreamSource& source) {
+    // Written through a small buffer, so the object is never held whole
+    std::string path = object_path(name);
+    std::string tmp = utils::FileUtils::temp_path(path);
+    try {
+        {
+            std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+            std::vector<uint8_t> piece(std::min(total_size, kStreamPiece));
+            size_t filled = 0;
+            while (filled < total_size) {
+                size_t n = source(piece.data(), std::min(piece.size(), total_size - filled));
+                if (n == 0) {
+                    throw std::runtime_error("Stream for " + name + " ended after " + std::to_string(filled) + " of " +
+                                             std::to_string(total_size) + " bytes");
+                }
+                file.write(reinterpret_cast<const char*>(piece.data()), static_cast<std::streamsize>(n));
+                filled += n;
+            }
+            if (!file.flush()) {
+                throw std::runtime_error("Failed to write " + tmp);
+            }
+        }
+        utils::FileUtils::replace_file(tmp, path);
+    } catch (...) {
+        std::error_code ec;
+        fs::remove(tmp, ec);
+        throw;
+    }
+    return kFilePrefix + path;
+}
+
+std::string LocalBackend::put_manifest(const std::string& manifest_json) {
+    // Named like the upload server's; bumped past any manifest stored in the same millisecond
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                  std::chrono::system_clock::now().time_since_epoch()).count();
+    std::string path;
+    do {
+        path = object_path("manifests/manifest_" + std::to_string(ms++) + ".json");
+    } while (fs::exists(path));
+    utils::FileUtils::write_file_atomic(path, reinterpret_cast<const uint8_t*>(manifest_json.data()),
+                                        manifest_json.size());
+    return kFilePrefix + path;
+}
+
+void LocalBackend::get(const std::string& uri, std::vector<uint8_t>& out, size_t size_hint) {
+    std::string path = path_of(uri);
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in) {
+        throw std::runtime_error("Object not found: " + uri);
+    }
+    size_t size = static_cast<size_t>(in.tellg());
+    out.clear();
+    out.reserve(std::max(size, size_hint));
+    out.resize(size);
+    in.seekg(0);
+    if (!in.read(reinterpret_cast<char*>(out.data()), static_cast<std::streamsize>(size))) {
+        throw std::runtime_error("Failed to read " + path);
+    }
+}
+
+void LocalBackend::get_range(const std::string& uri, uint64_t offset, uint64_t length, std::vector<uint8_t>& out) {
+    std::string path = path_of(uri);
+    out.clear();
+    if (length == 0) return;
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Object not found: " + uri);
+    }
+    out.resize(length);
+    in.seekg(static_cast<std::streamoff>(offset));
+    in.read(reinterpret_cast<char*>(out.data()), static_cast<std::streamsize>(length));
+    if (static_cast<uint64_t>(in.gcount()) != length) {
+        throw std::runtime_error("Short range read from " + uri + ": expected " + std::to_string(length) +
+                                 " bytes, got " + std::to_string(in.gcount()));
+    }
+}
+
+bool LocalBackend::exists(const std::string& uri) {
+    return fs::is_regular_file(path_of(uri));
+}
+
+} // namespace storage
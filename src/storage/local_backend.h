@@ -0,0 +1,33 @@
+#pragma once
+
+#include "storage_backend.h"
+#include <string>
+
+namespace storage {
+
+// Objects as files under a root directory, addressed as file:// URIs of their
+// absolute paths; manifests go to <root>/manifests like on the upload server.
+// Each put is synced and renamed into place before it returns, so an object
+// a manifest refers to survives a crash. Reads accept any file:// URI.
+class LocalBackend : public StorageBackend {
+public:
+    // Creates `root` if missing; an empty root gives a read-only backend
+    explicit LocalBackend(const std::string& root);
+
+    std::string put(const std::string& name, const uint8_t* data, size_t len) override;
+    std::string put_stream(const std::string& name, size_t total_size, const StreamSource& source) override;
+    std::string put_manifest(const std::string& manifest_json) override;
+
+    void get(const std::string& uri, std::vector<uint8_t>& out, size_t size_hint = 0) override;
+    void get_range(const std::string& uri, uint64_t offset, uint64_t length, std::vector<uint8_t>& out) override;
+    bool exists(const std::string& uri) override;
+
+private:
+    std::string root_;
+
+    // Path for a new object; rejects names that would leave the root
+    std::string object_path(const std::string& name) const;
+    static std::string path_of(const std::string& uri);
+};
+
+} // namespace storage
@@ -0,0 +1,116 @@
+#include "memory_backend.h"
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+
+namespace storage {
+
+std::shared_ptr<MemoryBackend> MemoryBackend::open(const std::string& store) {
+    static std::mutex registry_mutex;
+    static std::map<std::string, std::shared_ptr<MemoryBackend>> registry;
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    auto& backend = registry[store];
+    if (!backend) backend = std::make_shared<MemoryBackend>(store);
+    return backend;
+}
+
+MemoryBackend::MemoryBackend(const std::string& store) : prefix_("mem://" + store + "/") {
+    if (store.empty() || store.find('/') != std::string::npos) {
+        throw std::invalid_argument("Bad in-memory store name: " + store);
+    }
+}
+
+std::string MemoryBackend::store(const std::string& name, std::vector<uint8_t> data) {
+    if (name.empty()) {
+        throw std::invalid_argument("Empty object name");
+    }
+    auto object = std::make_shared<const std::vector<uint8_t>>(std::move(data));
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    auto& slot = objects_[name];
+    if (slot) bytes_ -= slot->size();
+    bytes_ += object->size();
+    slot = std::move(object);
+    return prefix_ + name;
+}
+
+MemoryBackend::Object MemoryBackend::find(const std::string& uri) const {
+    if (uri.compare(0, prefix_.size(), prefix_) != 0) {
+        throw std::invalid_argument("Not an object of " + prefix_ + ": " + uri);
+    }
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto it = objects_.find(uri.substr(prefix_.size()));
+    if (it == objects_.end()) {
+        throw std::runtime_error("Object not found: " + uri);
+    }
+    return it->second;
+}
+
+std::string MemoryBackend::put(const std::string& name, const uint8_t* data, size_t len) {
+    return store(name, std::vector<uint8_t>(data, data + len));
+}
+
+std::string MemoryBackend::put_stream(const std::string& name, size_t total_size, const StreamSource& source) {
+    std::vector<uint8_t> data(total_size);
+    size_t filled = 0;
+    while (filled < total_size) {
+        size_t n = source(data.data() + filled, total_size - filled);
+        if (n == 0) {
+            throw std::runtime_error("Stream for " + name + " ended after " + std::to_string(filled) + " of " +
+                                     std::to_string(total_size) + " bytes");
+        }
+        filled += n;
+    }
+    return store(name, std::move(data));
+}
+
+std::string MemoryBackend::put_manifest(const std::string& manifest_json) {
+    uint64_t n;
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        n = ++manifests_;
+    }
+    return store("manifests/manifest_" + std::to_string(n) + ".json",
+                 std::vector<uint8_t>(manifest_json.begin(), manifest_json.end()));
+}
+
+void MemoryBackend::get(const std::string& uri, std::vector<uint8_t>& out, size_t size_hint) {
+    Object object = find(uri);
+    out.clear();
+    out.reserve(std::max(object->size(), size_hint));
+    out.assign(object->begin(), object->end());
+}
+
+void MemoryBackend::get_range(const std::string& uri, uint64_t offset, uint64_t length, std::vector<uint8_t>& out) {
+    Object object = find(uri);
+    out.clear();
+    if (length == 0) return;
+    if (offset > object->size() || length > object->size() - offset) {
+        throw std::runtime_error("Range past end of " + uri);
+    }
+    out.assign(object->begin() + offset, object->begin() + offset + length);
+}
+
+bool MemoryBackend::exists(const std::string& uri) {
+    if (uri.compare(0, prefix_.size(), prefix_) != 0) return false;
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return objects_.count(uri.substr(prefix_.size())) != 0;
+}
+
+size_t MemoryBackend::object_count() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return objects_.size();
+}
+
+uint64_t MemoryBackend::stored_bytes() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return bytes_;
+}
+
+void MemoryBackend::clear() {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    objects_.clear();
+    bytes_ = 0;
+}
+
+} // namespace storage
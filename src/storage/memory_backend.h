@@ -0,0 +1,52 @@
+#pragma once
+
+#include "storage_backend.h"
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace storage {
+
+// Objects held in process memory, addressed as mem://<store>/<name>. Stores
+// are process-wide and live until the process exits, so a backup and a
+// restore run in the same process see the same objects; it exists to time
+// the client pipeline without a server or disk in the way.
+class MemoryBackend : public StorageBackend {
+public:
+    // The store called `store`, created on first use
+    static std::shared_ptr<MemoryBackend> open(const std::string& store);
+
+    explicit MemoryBackend(const std::string& store);
+
+    std::string put(const std::string& name, const uint8_t* data, size_t len) override;
+    std::string put_stream(const std::string& name, size_t total_size, const StreamSource& source) override;
+    std::string put_manifest(const std::string& manifest_json) override;
+    // Streams end up in memory like everything else here
+    bool buffers_streams() const override { return true; }
+
+    void get(const std::string& uri, std::vector<uint8_t>& out, size_t size_hint = 0) override;
+    void get_range(const std::string& uri, uint64_t offset, uint64_t length, std::vector<uint8_t>& out) override;
+    bool exists(const std::string& uri) override;
+
+    size_t object_count() const;
+    uint64_t stored_bytes() const;
+    // Drops every object
+    void clear();
+
+private:
+    using Object = std::shared_ptr<const std::vector<uint8_t>>;
+
+    std::string prefix_;   // "mem://<store>/"
+    mutable std::shared_mutex mutex_;
+    std::unordered_map<std::string, Object> objects_;   // by name
+    uint64_t bytes_ = 0;
+    uint64_t manifests_ = 0;
+
+    std::string store(const std::string& name, std::vector<uint8_t> data);
+    // Throws if `uri` is not in this store or missing
+    Object find(const std::string& uri) const;
+};
+
+} // namespace storage
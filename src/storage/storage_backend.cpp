@@ -0,0 +1,100 @@
+#include "storage_backend.h"
+#include "http_backend.h"
+#include "local_backend.h"
+#include "memory_backend.h"
+#include "../utils/file_utils.h"
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+
+namespace storage {
+
+namespace {
+
+// "<store>" of "mem://<store>[/...]"
+std::string memory_store(const std::string& url) {
+    std::string rest = url.substr(url.find("://") + 3);
+    return rest.substr(0, rest.find('/'));
+}
+
+} // namespace
+
+std::vector<std::string> StorageBackend::put_batch(const std::vector<PutRequest>& objects) {
+    std::vector<std::string> uris;
+    uris.reserve(objects.size());
+    for (const auto& object : objects) {
+        uris.push_back(put(object.name, object.data, object.size));
+    }
+    return uris;
+}
+
+void StorageBackend::get_batch(const std::vector<GetRequest>& requests) {
+    for (const auto& r : requests) {
+        if (r.range) {
+            get_range(r.uri, r.offset, r.length, *r.out);
+        } else {
+            get(r.uri, *r.out);
+        }
+    }
+}
+
+std::string url_scheme(const std::string& url) {
+    size_t end = url.find("://");
+    if (end == std::string::npos) return "";
+    std::string scheme = url.substr(0, end);
+    std::transform(scheme.begin(), scheme.end(), scheme.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return scheme;
+}
+
+std::string normalize_url(const std::string& url) {
+    std::string scheme = url_scheme(url);
+    if (scheme.empty() || scheme == "file") {
+        // Same form as the URIs LocalBackend returns
+        std::string root = fs::absolute(scheme.empty() ? url : url.substr(7)).lexically_normal().string();
+        while (root.size() > 1 && root.back() == '/') root.pop_back();
+        return "file://" + root;
+    }
+    std::string rest = url.substr(scheme.size() + 3);
+    size_t host_end = std::min(rest.find('/'), rest.size());
+    std::transform(rest.begin(), rest.begin() + host_end, rest.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    while (!rest.empty() && rest.back() == '/') rest.pop_back();
+    return scheme + "://" + rest;
+}
+
+std::shared_ptr<StorageBackend> open_backend(const std::string& url) {
+    std::string scheme = url_scheme(url);
+    if (scheme == "http" || scheme == "https") {
+        return std::make_shared<HttpBackend>(url);
+    }
+    if (scheme == "file") {
+        return std::make_shared<LocalBackend>(url.substr(7));
+    }
+    if (scheme == "mem") {
+        return MemoryBackend::open(memory_store(url));
+    }
+    if (scheme.empty() && !url.empty()) {
+        return std::make_shared<LocalBackend>(url);
+    }
+    throw std::invalid_argument("Unsupported storage URL: " + url);
+}
+
+std::shared_ptr<StorageBackend> backend_for(const std::string& uri) {
+    std::string scheme = url_scheme(uri);
+    if (scheme == "http" || scheme == "https") {
+        // Reads need no base URL; every request shares the one transport
+        static std::shared_ptr<StorageBackend> http = std::make_shared<HttpBackend>("");
+        return http;
+    }
+    if (scheme == "file") {
+        static std::shared_ptr<StorageBackend> local = std::make_shared<LocalBackend>("");
+        return local;
+    }
+    if (scheme == "mem") {
+        return MemoryBackend::open(memory_store(uri));
+    }
+    throw std::invalid_argument("No storage backend for " + uri);
+}
+
+} // namespace storage
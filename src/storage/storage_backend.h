@@ -0,0 +1,78 @@
+#pragma once
+
+#include "transport.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace storage {
+
+// One object to store with put_batch. `data` is not owned and must stay
+// valid until the call returns.
+struct PutRequest {
+    std::string name;
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+};
+
+// One object, or a byte range of one, to fetch with get_batch
+struct GetRequest {
+    std::string uri;
+    bool range = false;        // otherwise the whole object
+    uint64_t offset = 0;
+    uint64_t length = 0;
+    std::vector<uint8_t>* out = nullptr;
+};
+
+// Object store behind backups and restores. Objects are stored under a name
+// chosen by the caller and addressed afterwards by the absolute URI put
+// returns; that URI is what manifests and the dedup index record, and its
+// scheme picks the backend that reads it back (see backend_for).
+//
+// Implementations are shared by the pipeline workers and must be thread-safe.
+// Errors, including missing objects, are reported as exceptions.
+class StorageBackend {
+public:
+    virtual ~StorageBackend() = default;
+
+    // Stores an object and returns its URI
+    virtual std::string put(const std::string& name, const uint8_t* data, size_t len) = 0;
+    // Same, pulling exactly `total_size` bytes from `source` while storing
+    virtual std::string put_stream(const std::string& name, size_t total_size, const StreamSource& source) = 0;
+    // Stores a manifest under a name of the backend's choosing and returns its URI
+    virtual std::string put_manifest(const std::string& manifest_json) = 0;
+    // True if put_stream holds the whole object in memory while storing it
+    virtual bool buffers_streams() const { return false; }
+
+    // Whole object into `out` (cleared first, `size_hint` bytes reserved)
+    virtual void get(const std::string& uri, std::vector<uint8_t>& out, size_t size_hint = 0) = 0;
+    // Exactly `length` bytes starting at `offset`
+    virtual void get_range(const std::string& uri, uint64_t offset, uint64_t length, std::vector<uint8_t>& out) = 0;
+    virtual bool exists(const std::string& uri) = 0;
+
+    // Several objects at once; URIs in request order. The defaults run the
+    // requests one after another; backends with latency to hide overlap them.
+    virtual std::vector<std::string> put_batch(const std::vector<PutRequest>& objects);
+    virtual void get_batch(const std::vector<GetRequest>& requests);
+};
+
+// Backend that stores objects at `url`:
+//   http://host[:port], https://...   the upload server (POST /upload, /manifest)
+//   file:///path, or a plain path      a local directory, created if missing
+//   mem://name                         a process-wide in-memory store
+std::shared_ptr<StorageBackend> open_backend(const std::string& url);
+
+// Backend that reads `uri`, by scheme; one instance per scheme (per store
+// for mem://) is shared process-wide
+std::shared_ptr<StorageBackend> backend_for(const std::string& uri);
+
+// Lowercase scheme of `url` ("http", "file", ...); empty if it has none
+std::string url_scheme(const std::string& url);
+
+// Canonical form of a storage URL, naming the store it opens: lowercase
+// scheme and host, no trailing slash, local paths as absolute file:// URLs.
+// URIs of objects in the store start with it followed by '/'.
+std::string normalize_url(const std::string& url);
+
+} // namespace storage
@@ -0,0 +1,264 @@
+#include "transport.h"
+#include <curl/curl.h>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+namespace storage {
+
+namespace {
+
+const size_t kMaxIdleHandles = 64;
+
+// One in-flight request and everything curl needs to stay alive for it
+struct Transfer {
+    HttpRequest request;
+    HttpResponse response;
+    std::promise<HttpResponse> promise;
+    curl_mime* mime = nullptr;
+    curl_slist* headers = nullptr;
+    size_t body_pos = 0;
+    std::exception_ptr callback_error;
+    char error_buffer[CURL_ERROR_SIZE] = {0};
+};
+
+size_t write_callback(void* contents, size_t size, size_t nmemb, void* userp) {
+    size_t realsize = size * nmemb;
+    std::vector<uint8_t>* out = static_cast<std::vector<uint8_t>*>(userp);
+    const uint8_t* bytes = static_cast<const uint8_t*>(contents);
+    out->insert(out->end(), bytes, bytes + realsize);
+    return realsize;
+}
+
+size_t read_callback(char* buffer, size_t size, size_t nitems, void* userp) {
+    Transfer* t = static_cast<Transfer*>(userp);
+    size_t max_len = size * nitems;
+    // Exceptions must not unwind through libcurl; park them and abort the transfer
+    try {
+        if (t->request.body_source) {
+            return t->request.body_source(reinterpret_cast<uint8_t*>(buffer), max_len);
+        }
+        size_t n = std::min(max_len, t->request.body_size - t->body_pos);
+        std::memcpy(buffer, t->request.body + t->body_pos, n);
+        t->body_pos += n;
+        return n;
+    } catch (...) {
+        t->callback_error = std::current_exception();
+        return CURL_READFUNC_ABORT;
+    }
+}
+
+int seek_callback(void* userp, curl_off_t offset, int origin) {
+    Transfer* t = static_cast<Transfer*>(userp);
+    // In-memory bodies can be replayed (redirects, auth); pulled streams cannot
+    if (t->request.body_source || origin != SEEK_SET || offset < 0 ||
+        static_cast<size_t>(offset) > t->request.body_size) {
+        return CURL_SEEKFUNC_CANTSEEK;
+    }
+    t->body_pos = static_cast<size_t>(offset);
+    return CURL_SEEKFUNC_OK;
+}
+
+} // namespace
+
+struct Transport::Loop {
+    const TransportOptions& options;
+    CURLM* multi;
+    std::thread thread;
+    std::mutex mutex;
+    std::deque<std::unique_ptr<Transfer>> pending;
+    bool stopping = false;
+    std::unordered_map<CURL*, std::unique_ptr<Transfer>> active;
+    std::vector<CURL*> idle_handles;
+
+    explicit Loop(const TransportOptions& opts) : options(opts), multi(curl_multi_init()) {
+        if (!multi) throw std::runtime_error("Failed to init CURL multi handle");
+        if (options.http2) {
+            curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+        }
+        if (options.max_connections_per_host > 0) {
+            curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, options.max_connections_per_host);
+        }
+        thread = std::thread([this] { run(); });
+    }
+
+    ~Loop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        curl_multi_wakeup(multi);
+        thread.join();
+        for (CURL* easy : idle_handles) curl_easy_cleanup(easy);
+        curl_multi_cleanup(multi);
+    }
+
+    void enqueue(std::unique_ptr<Transfer> transfer) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending.push_back(std::move(transfer));
+        }
+        curl_multi_wakeup(multi);
+    }
+
+    void run() {
+        for (;;) {
+            std::deque<std::unique_ptr<Transfer>> starting;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (stopping && pending.empty() && active.empty()) break;
+                starting.swap(pending);
+            }
+            for (auto& transfer : starting) start(std::move(transfer));
+
+            int running = 0;
+            curl_multi_perform(multi, &running);
+
+            int left = 0;
+            while (CURLMsg* msg = curl_multi_info_read(multi, &left)) {
+                if (msg->msg == CURLMSG_DONE) finish(msg->easy_handle, msg->data.result);
+            }
+
+            curl_multi_poll(multi, NULL, 0, 1000, NULL);
+        }
+    }
+
+    void start(std::unique_ptr<Transfer> transfer) {
+        CURL* easy;
+        if (!idle_handles.empty()) {
+            easy = idle_handles.back();
+            idle_handles.pop_back();
+            curl_easy_reset(easy);
+        } else {
+            easy = curl_easy_init();
+        }
+        if (!easy) {
+            transfer->promise.set_exception(std::make_exception_ptr(std::runtime_error("Failed to init CURL")));
+            return;
+        }
+
+        Transfer* t = transfer.get();
+        const HttpRequest& req = t->request;
+        curl_easy_setopt(easy, CURLOPT_URL, req.url.c_str());
+        curl_easy_setopt(easy, CURLOPT_PRIVATE, t);
+        curl_easy_setopt(easy, CURLOPT_ERRORBUFFER, t->error_buffer);
+        curl_easy_setopt(easy, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(easy, CURLOPT_TCP_KEEPALIVE, 1L);
+        curl_easy_setopt(easy, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, write_callback);
+        curl_easy_setopt(easy, CURLOPT_WRITEDATA, req.sink ? req.sink : &t->response.body);
+        if (req.fail_on_http_error) curl_easy_setopt(easy, CURLOPT_FAILONERROR, 1L);
+        if (options.http2) {
+            curl_easy_setopt(easy, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+            // Wait for a multiplexable connection rather than opening a new one
+            curl_easy_setopt(easy, CURLOPT_PIPEWAIT, 1L);
+        }
+        if (!req.range.empty()) curl_easy_setopt(easy, CURLOPT_RANGE, req.range.c_str());
+        if (req.method == HttpRequest::Method::Head) curl_easy_setopt(easy, CURLOPT_NOBODY, 1L);
+
+        if (req.method == HttpRequest::Method::Post) {
+            curl_off_t size = static_cast<curl_off_t>(req.body_size);
+            if (!req.form_field.empty()) {
+                t->mime = curl_mime_init(easy);
+                curl_mimepart* part = curl_mime_addpart(t->mime);
+                curl_mime_name(part, req.form_field.c_str());
+                curl_mime_data_cb(part, size, read_callback, seek_callback, NULL, t);
+                if (!req.form_filename.empty()) curl_mime_filename(part, req.form_filename.c_str());
+                curl_easy_setopt(easy, CURLOPT_MIMEPOST, t->mime);
+            } else {
+                curl_easy_setopt(easy, CURLOPT_POST, 1L);
+                curl_easy_setopt(easy, CURLOPT_READFUNCTION, read_callback);
+                curl_easy_setopt(easy, CURLOPT_READDATA, t);
+                curl_easy_setopt(easy, CURLOPT_SEEKFUNCTION, seek_callback);
+                curl_easy_setopt(easy, CURLOPT_SEEKDATA, t);
+                curl_easy_setopt(easy, CURLOPT_POSTFIELDSIZE_LARGE, size);
+                if (!req.content_type.empty()) {
+                    t->headers = curl_slist_append(t->headers, ("Content-Type: " + req.content_type).c_str());
+                }
+                // Skip the 100-continue round trip; bodies here are small or streamed
+                t->headers = curl_slist_append(t->headers, "Expect:");
+                curl_easy_setopt(easy, CURLOPT_HTTPHEADER, t->headers);
+            }
+        }
+
+        active.emplace(easy, std::move(transfer));
+        curl_multi_add_handle(multi, easy);
+    }
+
+    void finish(CURL* easy, CURLcode result) {
+        auto it = active.find(easy);
+        if (it == active.end()) return;
+        std::unique_ptr<Transfer> transfer = std::move(it->second);
+        active.erase(it);
+
+        curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &transfer->response.status);
+        curl_multi_remove_handle(multi, easy);
+        if (transfer->mime) curl_mime_free(transfer->mime);
+        if (transfer->headers) curl_slist_free_all(transfer->headers);
+        if (idle_handles.size() < kMaxIdleHandles) {
+            idle_handles.push_back(easy);
+        } else {
+            curl_easy_cleanup(easy);
+        }
+
+        if (transfer->callback_error) {
+            transfer->promise.set_exception(transfer->callback_error);
+        } else if (result != CURLE_OK) {
+            std::string detail = transfer->error_buffer[0] ? transfer->error_buffer : curl_easy_strerror(result);
+            transfer->promise.set_exception(std::make_exception_ptr(
+                std::runtime_error("CURL request to " + transfer->request.url + " failed: " + detail)));
+        } else {
+            transfer->promise.set_value(std::move(transfer->response));
+        }
+    }
+};
+
+Transport::Transport(const TransportOptions& options) : options_(options), next_loop_(0) {
+    curl_global_init(CURL_GLOBAL_ALL);
+    if (options_.event_loops == 0) options_.event_loops = 1;
+    for (size_t i = 0; i < options_.event_loops; i++) {
+        loops_.push_back(std::make_unique<Loop>(options_));
+    }
+}
+
+Transport::~Transport() {
+    loops_.clear();
+    curl_global_cleanup();
+}
+
+std::future<HttpResponse> Transport::submit(HttpRequest request) {
+    auto transfer = std::make_unique<Transfer>();
+    transfer->request = std::move(request);
+    std::future<HttpResponse> result = transfer->promise.get_future();
+    loops_[next_loop_++ % loops_.size()]->enqueue(std::move(transfer));
+    return result;
+}
+
+HttpResponse Transport::perform(HttpRequest request) {
+    return submit(std::move(request)).get();
+}
+
+namespace {
+
+std::mutex shared_mutex;
+TransportOptions shared_options;
+std::shared_ptr<Transport> shared_transport;
+
+} // namespace
+
+void Transport::configure_shared(const TransportOptions& options) {
+    std::lock_guard<std::mutex> lock(shared_mutex);
+    if (!shared_transport) shared_options = options;
+}
+
+std::shared_ptr<Transport> Transport::shared() {
+    std::lock_guard<std::mutex> lock(shared_mutex);
+    if (!shared_transport) shared_transport = std::make_shared<Transport>(shared_options);
+    return shared_transport;
+}
+
+} // namespace storage
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace storage {
+
+// Fills `buffer` with up to `max_len` next bytes of a streamed body; returns bytes written
+using StreamSource = std::function<size_t(uint8_t* buffer, size_t max_len)>;
+
+struct HttpRequest {
+    enum class Method { Get, Post, Head };
+
+    Method method = Method::Get;
+    std::string url;
+
+    // POST body: a multipart file part when form_field is set, a raw body otherwise.
+    // The bytes come from `body` (non-owning, must outlive the transfer) or are
+    // pulled from `body_source` while sending.
+    std::string form_field;
+    std::string form_filename;
+    const uint8_t* body = nullptr;
+    size_t body_size = 0;
+    StreamSource body_source;
+    std::string content_type;          // raw bodies only
+
+    std::string range;                 // "first-last" byte range for GET
+    bool fail_on_http_error = false;   // HTTP status >= 400 becomes an exception
+    std::vector<uint8_t>* sink = nullptr; // optional caller buffer for the response body
+};
+
+struct HttpResponse {
+    long status = 0;
+    std::vector<uint8_t> body;         // empty when the request supplied a sink
+};
+
+struct TransportOptions {
+    size_t event_loops = 1;            // threads driving transfers (body callbacks run on them)
+    bool http2 = false;                // negotiate HTTP/2 and multiplex over one connection
+    long max_connections_per_host = 0; // 0 = unlimited
+};
+
+// Shared HTTP transport: each event loop owns a curl multi handle, so
+// connections (and TLS sessions) stay open and are reused across requests
+// instead of being set up per call. Requests are submitted asynchronously and
+// complete through a future; perform() is the blocking convenience.
+class Transport {
+public:
+    explicit Transport(const TransportOptions& options = TransportOptions());
+    ~Transport();
+
+    Transport(const Transport&) = delete;
+    Transport& operator=(const Transport&) = delete;
+
+    std::future<HttpResponse> submit(HttpRequest request);
+    HttpResponse perform(HttpRequest request);
+
+    // Process-wide transport used by Uploader/Downloader by default.
+    // configure_shared only has an effect before the first shared() call.
+    static void configure_shared(const TransportOptions& options);
+    static std::shared_ptr<Transport> shared();
+
+private:
+    struct Loop;
+    TransportOptions options_;
+    std::vector<std::unique_ptr<Loop>> loops_;
+    std::atomic<size_t> next_loop_;
+};
+
+} // namespace storage
@@ -1,29 +1,40 @@
 #pragma once
 
+#include "storage_backend.h"
 #include <string>
 #include <vector>
-#include <functional>
+#include <memory>
 
 namespace storage {
 
 class Uploader {
 public:
-    Uploader(const std::string& base_url);
+    // `url` picks the backend objects are stored in (see open_backend)
+    explicit Uploader(const std::string& url);
+    explicit Uploader(std::shared_ptr<StorageBackend> backend);
     ~Uploader();
 
-    // Uploads a chunk and returns the URI
+    using StreamSource = storage::StreamSource;
+
+    // Uploads a chunk and returns its URI
     std::string upload_chunk(const std::vector<uint8_t>& data, const std::string& chunk_name);
 
-    // Uploads the manifest
+    // Uploads a chunk of known total size whose bytes are pulled from `source`
+    // as the backend stores them. HTTP and local backends never hold the whole
+    // body; see buffers_streams for the ones that do.
+    std::string upload_chunk_stream(size_t total_size, const StreamSource& source, const std::string& chunk_name);
+
+    // Uploads several objects at once; URIs in request order
+    std::vector<std::string> upload_batch(const std::vector<PutRequest>& objects);
+
+    // Uploads the manifest and returns its URL
     std::string upload_manifest(const std::string& manifest_json);
 
+    // True if streamed chunks are held whole by the backend anyway
+    bool buffers_streams() const { return backend_->buffers_streams(); }
+
 private:
-    std::string base_url_;
-    
-    // Helper for curl
-    static size_t write_callback(void* contents, size_t size, size_t nmemb, void* userp);
-    std::string perform_post(const std::string& url, const std::vector<uint8_t>& data, const std::string& filename);
-    std::string perform_post_json(const std::string& url, const std::string& json_data);
+    std::shared_ptr<StorageBackend> backend_;
 };
 
 } // namespace storage
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+namespace utils {
+
+// Blocking FIFO with a fixed capacity, used to connect pipeline stages.
+// close() wakes all waiters; pop() then drains what is left and returns nullopt.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity_(capacity == 0 ? 1 : capacity) {}
+
+    // Returns false if the queue was closed before the item could be queued
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this] { return closed_ || items_.size() < capacity_; });
+        if (closed_) return false;
+        items_.push_back(std::move(item));
+        not_empty_.notify_one();
+        return true;
+    }
+
+    std::optional<T> pop() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+        if (items_.empty()) return std::nullopt;
+        T item = std::move(items_.front());
+        items_.pop_front();
+        not_full_.notify_one();
+        return item;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+
+private:
+    size_t capacity_;
+    std::deque<T> items_;
+    bool closed_ = false;
+    std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+};
+
+// Byte budget shared by pipeline stages to cap the data held in flight.
+// A single request larger than the whole budget is clamped so progress is always possible.
+class MemoryBudget {
+public:
+    explicit MemoryBudget(size_t limit) : limit_(limit == 0 ? 1 : limit) {}
+
+    // Returns the number of bytes actually reserved (0 if cancelled)
+    size_t acquire(size_t bytes) {
+        if (bytes > limit_) bytes = limit_;
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [&] { return cancelled_ || used_ + bytes <= limit_; });
+        if (cancelled_) return 0;
+        used_ += bytes;
+        return bytes;
+    }
+
+    void release(size_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        used_ -= bytes;
+        cv_.notify_all();
+    }
+
+    void cancel() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cancelled_ = true;
+        cv_.notify_all();
+    }
+
+private:
+    size_t limit_;
+    size_t used_ = 0;
+    bool cancelled_ = false;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+};
+
+} // namespace utils
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace utils {
+
+// Recycles byte buffers between pipeline stages so steady-state chunk
+// processing does no heap allocation. The number of buffers is bounded by
+// whatever limits the items in flight (e.g. a MemoryBudget).
+class BufferPool {
+public:
+    std::vector<uint8_t> acquire() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (free_.empty()) return std::vector<uint8_t>();
+        std::vector<uint8_t> buffer = std::move(free_.back());
+        free_.pop_back();
+        return buffer;
+    }
+
+    void release(std::vector<uint8_t> buffer) {
+        if (buffer.capacity() == 0) return;
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.push_back(std::move(buffer));
+    }
+
+private:
+    std::mutex mutex_;
+    std::vector<std::vector<uint8_t>> free_;
+};
+
+} // namespace utils
@@ -1,6 +1,18 @@
 #include "file_utils.h"
 #include <stdexcept>
 #include <iostream>
+#include <chrono>
+#include <atomic>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#else
+#include <process.h>
+#endif
 
 namespace utils {
 
@@ -15,6 +27,20 @@ size_t FileUtils::get_file_size(const std::string& path) {
     return fs::file_size(path);
 }
 
+int64_t FileUtils::get_mtime_ns(const std::string& path) {
+#ifndef _WIN32
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0) {
+        throw std::runtime_error("Cannot stat file: " + path);
+    }
+    return static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000LL + st.st_mtim.tv_nsec;
+#else
+    // file_clock has an unspecified epoch before C++20; only equality comparisons are meaningful
+    auto since_epoch = fs::last_write_time(path).time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(since_epoch).count();
+#endif
+}
+
 std::vector<uint8_t> FileUtils::read_file(const std::string& path) {
     if (!exists(path)) {
         throw std::runtime_error("File not found: " + path);
@@ -55,6 +81,62 @@ void FileUtils::remove_file(const std::string& path) {
     }
 }
 
+void FileUtils::sync(const std::string& path) {
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open " + path + " for sync (" + std::strerror(errno) + ")");
+    }
+    int rc = ::fsync(fd);
+    int saved = errno;
+    ::close(fd);
+    if (rc != 0) {
+        throw std::runtime_error("Failed to sync " + path + " (" + std::strerror(saved) + ")");
+    }
+#else
+    (void)path;  // no portable fsync for a path here; the rename below is still atomic
+#endif
+}
+
+void FileUtils::write_file_atomic(const std::string& path, const std::vector<uint8_t>& data) {
+    write_file_atomic(path, data.data(), data.size());
+}
+
+void FileUtils::write_file_atomic(const std::string& path, const uint8_t* data, size_t len) {
+    std::string tmp = temp_path(path);
+    try {
+        {
+            std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+            file.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(len));
+            if (!file.flush()) {
+                throw std::runtime_error("Failed to write " + tmp);
+            }
+        }
+        replace_file(tmp, path);
+    } catch (...) {
+        std::error_code ec;
+        fs::remove(tmp, ec);
+        throw;
+    }
+}
+
+std::string FileUtils::temp_path(const std::string& path) {
+    static std::atomic<uint64_t> counter{0};
+#ifndef _WIN32
+    long pid = static_cast<long>(::getpid());
+#else
+    long pid = static_cast<long>(::_getpid());
+#endif
+    return path + ".tmp." + std::to_string(pid) + "." + std::to_string(counter++);
+}
+
+void FileUtils::replace_file(const std::string& tmp, const std::string& path) {
+    sync(tmp);
+    fs::rename(tmp, path);
+    fs::path parent = fs::path(path).parent_path();
+    sync(parent.empty() ? "." : parent.string());
+}
+
 std::string FileUtils::get_filename(const std::string& path) {
     return fs::path(path).filename().string();
 }
@@ -2,6 +2,7 @@
 
 #include <string>
 #include <vector>
+#include <cstdint>
 #include <fstream>
 #include <filesystem>
 
@@ -13,11 +14,24 @@ class FileUtils {
 public:
     static bool exists(const std::string& path);
     static size_t get_file_size(const std::string& path);
+    // Last modification time in nanoseconds since the Unix epoch
+    static int64_t get_mtime_ns(const std::string& path);
     static std::vector<uint8_t> read_file(const std::string& path);
     static void write_file(const std::string& path, const std::vector<uint8_t>& data);
     static void write_file(const std::string& path, const std::string& data);
     static void create_directory(const std::string& path);
     static void remove_file(const std::string& path);
+    // Flushes a file's (or directory's) contents to stable storage
+    static void sync(const std::string& path);
+    // Replaces `path` via a synced temporary and rename, so readers see
+    // either the old or the new contents even across a crash
+    static void write_file_atomic(const std::string& path, const std::vector<uint8_t>& data);
+    static void write_file_atomic(const std::string& path, const uint8_t* data, size_t len);
+    // Temporary name next to `path`, unique per process and call, so writers
+    // of the same path never share one
+    static std::string temp_path(const std::string& path);
+    // Syncs `tmp` and renames it over `path` (the last steps of write_file_atomic)
+    static void replace_file(const std::string& tmp, const std::string& path);
     static std::string get_filename(const std::string& path);
 };
 
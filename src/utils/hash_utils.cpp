@@ -0,0 +1,219 @@
+#include "hash_utils.h"
+#include "../metrics/metrics.h"
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <stdexcept>
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace utils {
+
+Sha256::Sha256() : ctx_(EVP_MD_CTX_new()) {
+    if (!ctx_ || EVP_DigestInit_ex(ctx_, EVP_sha256(), nullptr) != 1) {
+        EVP_MD_CTX_free(ctx_);
+        throw std::runtime_error("SHA256 init failed");
+    }
+}
+
+Sha256::~Sha256() {
+    EVP_MD_CTX_free(ctx_);
+}
+
+void Sha256::update(const uint8_t* data, size_t len) {
+    metrics::ScopedTimer timer(metrics::Stage::Hash, len);
+    if (EVP_DigestUpdate(ctx_, data, len) != 1) {
+        throw std::runtime_error("SHA256 update failed");
+    }
+}
+
+std::string Sha256::final_hex() {
+    unsigned char hash[EVP_MAX_MD_SIZE];
+    unsigned int hash_len = 0;
+    if (EVP_DigestFinal_ex(ctx_, hash, &hash_len) != 1) {
+        throw std::runtime_error("SHA256 final failed");
+    }
+    return HashUtils::to_hex(hash, hash_len);
+}
+
+Digest Sha256::final_digest() {
+    Digest digest;
+    unsigned int hash_len = 0;
+    if (EVP_DigestFinal_ex(ctx_, digest.data(), &hash_len) != 1 || hash_len != digest.size()) {
+        throw std::runtime_error("SHA256 final failed");
+    }
+    return digest;
+}
+
+Digest HashUtils::sha256(const uint8_t* data, size_t len) {
+    metrics::ScopedTimer timer(metrics::Stage::Hash, len);
+    Digest digest;
+    unsigned int hash_len = 0;
+    if (EVP_Digest(data, len, digest.data(), &hash_len, EVP_sha256(), nullptr) != 1) {
+        throw std::runtime_error("SHA256 digest failed");
+    }
+    return digest;
+}
+
+std::string HashUtils::sha256_hex(const uint8_t* data, size_t len) {
+    metrics::ScopedTimer timer(metrics::Stage::Hash, len);
+    unsigned char hash[EVP_MAX_MD_SIZE];
+    unsigned int hash_len = 0;
+    if (EVP_Digest(data, len, hash, &hash_len, EVP_sha256(), nullptr) != 1) {
+        throw std::runtime_error("SHA256 digest failed");
+    }
+    return to_hex(hash, hash_len);
+}
+
+std::string HashUtils::sha256_hex(const std::vector<uint8_t>& data) {
+    return sha256_hex(data.data(), data.size());
+}
+
+std::array<uint8_t, 32> HashUtils::hmac_sha256(const std::array<uint8_t, 32>& key, const uint8_t* data, size_t len) {
+    std::array<uint8_t, 32> mac;
+    unsigned int mac_len = 0;
+    if (!HMAC(EVP_sha256(), key.data(), static_cast<int>(key.size()), data, len, mac.data(), &mac_len) || mac_len != mac.size()) {
+        throw std::runtime_error("HMAC-SHA256 failed");
+    }
+    return mac;
+}
+
+namespace {
+
+const uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+const uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+
+inline uint64_t lane_round(uint64_t acc, const uint8_t* p) {
+    uint64_t in;
+    std::memcpy(&in, p, sizeof(in));
+    acc += in * kPrime2;
+    acc = (acc << 31) | (acc >> 33);
+    return acc * kPrime1;
+}
+
+} // namespace
+
+std::string HashUtils::fast_fingerprint(const std::array<uint8_t, 32>& key, const uint8_t* data, size_t len) {
+    uint64_t lanes[4];
+    std::memcpy(lanes, key.data(), sizeof(lanes));
+
+    size_t pos = 0;
+    for (; pos + 32 <= len; pos += 32) {
+        lanes[0] = lane_round(lanes[0], data + pos);
+        lanes[1] = lane_round(lanes[1], data + pos + 8);
+        lanes[2] = lane_round(lanes[2], data + pos + 16);
+        lanes[3] = lane_round(lanes[3], data + pos + 24);
+    }
+
+    // Lane state, tail bytes and length together determine the fingerprint
+    uint8_t state[32 + 32 + sizeof(uint64_t)];
+    uint64_t length = len;
+    size_t tail = len - pos;
+    std::memcpy(state, lanes, 32);
+    std::memset(state + 32, 0, 32);
+    if (tail > 0) std::memcpy(state + 32, data + pos, tail);
+    std::memcpy(state + 64, &length, sizeof(length));
+
+    std::array<uint8_t, 32> mac = hmac_sha256(key, state, sizeof(state));
+    return to_hex(mac.data(), 16);
+}
+
+#if defined(__SSE2__)
+namespace {
+
+// Nibbles 0..15 to their lowercase hex characters
+inline __m128i nibbles_to_ascii(__m128i n) {
+    __m128i letters = _mm_cmpgt_epi8(n, _mm_set1_epi8(9));
+    __m128i ascii = _mm_add_epi8(n, _mm_set1_epi8('0'));
+    return _mm_add_epi8(ascii, _mm_and_si128(letters, _mm_set1_epi8('a' - '0' - 10)));
+}
+
+// Hex characters to nibbles; clears `ok` if any byte is not a hex digit
+inline __m128i ascii_to_nibbles(__m128i c, bool& ok) {
+    __m128i is_digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+                                     _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+    __m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+    __m128i is_alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                     _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+    if (_mm_movemask_epi8(_mm_or_si128(is_digit, is_alpha)) != 0xffff) {
+        ok = false;
+    }
+    __m128i digit = _mm_and_si128(is_digit, _mm_sub_epi8(c, _mm_set1_epi8('0')));
+    __m128i alpha = _mm_and_si128(is_alpha, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10)));
+    return _mm_or_si128(digit, alpha);
+}
+
+// Sixteen nibbles (high, low, high, low, ...) to eight bytes in the low 16-bit lanes
+inline __m128i join_nibbles(__m128i n) {
+    __m128i high = _mm_and_si128(n, _mm_set1_epi16(0x00ff));
+    __m128i low = _mm_srli_epi16(n, 8);
+    return _mm_or_si128(_mm_slli_epi16(high, 4), low);
+}
+
+} // namespace
+#endif
+
+std::string HashUtils::to_hex(const uint8_t* data, size_t len) {
+    static const char digits[] = "0123456789abcdef";
+    std::string out(len * 2, '0');
+    char* dst = &out[0];
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    for (; i + 16 <= len; i += 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i high = nibbles_to_ascii(_mm_and_si128(_mm_srli_epi16(bytes, 4), mask));
+        __m128i low = nibbles_to_ascii(_mm_and_si128(bytes, mask));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 2 * i), _mm_unpacklo_epi8(high, low));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 2 * i + 16), _mm_unpackhi_epi8(high, low));
+    }
+#endif
+    for (; i < len; i++) {
+        dst[2 * i] = digits[data[i] >> 4];
+        dst[2 * i + 1] = digits[data[i] & 0x0f];
+    }
+    return out;
+}
+
+std::string HashUtils::to_hex(const Digest& digest) {
+    return to_hex(digest.data(), digest.size());
+}
+
+void HashUtils::from_hex(const std::string& hex, uint8_t* out, size_t len) {
+    if (hex.size() != len * 2) {
+        throw std::invalid_argument("Hex string has wrong length");
+    }
+    auto nibble = [](char c) -> uint8_t {
+        if (c >= '0' && c <= '9') return static_cast<uint8_t>(c - '0');
+        if (c >= 'a' && c <= 'f') return static_cast<uint8_t>(c - 'a' + 10);
+        if (c >= 'A' && c <= 'F') return static_cast<uint8_t>(c - 'A' + 10);
+        throw std::invalid_argument("Invalid hex character");
+    };
+    const char* src = hex.data();
+    size_t i = 0;
+#if defined(__SSE2__)
+    bool ok = true;
+    for (; i + 16 <= len; i += 16) {
+        __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * i));
+        __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * i + 16));
+        __m128i bytes = _mm_packus_epi16(join_nibbles(ascii_to_nibbles(first, ok)),
+                                         join_nibbles(ascii_to_nibbles(second, ok)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), bytes);
+    }
+    if (!ok) {
+        throw std::invalid_argument("Invalid hex character");
+    }
+#endif
+    for (; i < len; i++) {
+        out[i] = static_cast<uint8_t>((nibble(src[2 * i]) << 4) | nibble(src[2 * i + 1]));
+    }
+}
+
+Digest HashUtils::digest_from_hex(const std::string& hex) {
+    Digest digest;
+    from_hex(hex, digest.data(), digest.size());
+    return digest;
+}
+
+} // namespace utils
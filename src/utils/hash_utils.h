@@ -0,0 +1,59 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+typedef struct evp_md_ctx_st EVP_MD_CTX;
+
+namespace utils {
+
+// Raw SHA-256 digest; hex only appears where digests cross into JSON
+using Digest = std::array<uint8_t, 32>;
+
+// Incremental SHA-256 for data that is never held in one buffer
+class Sha256 {
+public:
+    Sha256();
+    ~Sha256();
+    Sha256(const Sha256&) = delete;
+    Sha256& operator=(const Sha256&) = delete;
+
+    void update(const uint8_t* data, size_t len);
+    std::string final_hex();
+    Digest final_digest();
+
+private:
+    EVP_MD_CTX* ctx_;
+};
+
+class HashUtils {
+public:
+    // SHA-256 of a buffer
+    static Digest sha256(const uint8_t* data, size_t len);
+
+    // SHA-256 of a buffer, as lowercase hex
+    static std::string sha256_hex(const uint8_t* data, size_t len);
+    static std::string sha256_hex(const std::vector<uint8_t>& data);
+
+    // HMAC-SHA256 of a buffer under a 32-byte key
+    static std::array<uint8_t, 32> hmac_sha256(const std::array<uint8_t, 32>& key, const uint8_t* data, size_t len);
+
+    // Cheap keyed fingerprint of a buffer (32 hex chars) for change detection.
+    // Four 64-bit multiply/rotate lanes seeded from `key` run at memory speed;
+    // only their final state goes through HMAC-SHA256, so the result is safe
+    // to store next to ciphertext. Not a substitute for sha256 integrity checks.
+    static std::string fast_fingerprint(const std::array<uint8_t, 32>& key, const uint8_t* data, size_t len);
+
+    // Lowercase hex encoding of raw bytes (16 bytes per step with SSE2)
+    static std::string to_hex(const uint8_t* data, size_t len);
+    static std::string to_hex(const Digest& digest);
+
+    // Decodes hex into exactly `len` bytes; throws on bad length or characters
+    static void from_hex(const std::string& hex, uint8_t* out, size_t len);
+    static Digest digest_from_hex(const std::string& hex);
+};
+
+} // namespace utils
@@ -0,0 +1,89 @@
+#include "positional_file.h"
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace utils {
+
+#ifndef _WIN32
+
+PositionalFile::PositionalFile(const std::string& path, uint64_t size) : path_(path), fd_(-1) {
+    fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd_ < 0) {
+        throw std::runtime_error("Failed to open file for writing: " + path + " (" + std::strerror(errno) + ")");
+    }
+    if (size > 0) {
+        // Allocate blocks now so concurrent writes never extend the file;
+        // fall back to a sparse size where fallocate is unsupported
+        int rc = ::posix_fallocate(fd_, 0, static_cast<off_t>(size));
+        if (rc != 0 && ::ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+            ::close(fd_);
+            throw std::runtime_error("Failed to preallocate " + path + " (" + std::strerror(errno) + ")");
+        }
+    }
+}
+
+PositionalFile::~PositionalFile() {
+    if (fd_ >= 0) ::close(fd_);
+}
+
+void PositionalFile::write_at(uint64_t offset, const uint8_t* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = ::pwrite(fd_, data, len, static_cast<off_t>(offset));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error("Write failed on " + path_ + " (" + std::strerror(errno) + ")");
+        }
+        data += n;
+        len -= static_cast<size_t>(n);
+        offset += static_cast<uint64_t>(n);
+    }
+}
+
+void PositionalFile::close() {
+    if (fd_ < 0) return;
+    int sync_rc = ::fsync(fd_);
+    int close_rc = ::close(fd_);
+    fd_ = -1;
+    if (sync_rc != 0 || close_rc != 0) {
+        throw std::runtime_error("Failed to flush " + path_ + " (" + std::strerror(errno) + ")");
+    }
+}
+
+#else
+
+PositionalFile::PositionalFile(const std::string& path, uint64_t size) : path_(path) {
+    file_.open(path, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file_) {
+        throw std::runtime_error("Failed to open file for writing: " + path);
+    }
+    if (size > 0) {
+        file_.seekp(static_cast<std::streamoff>(size - 1));
+        file_.put('\0');
+    }
+}
+
+PositionalFile::~PositionalFile() {}
+
+void PositionalFile::write_at(uint64_t offset, const uint8_t* data, size_t len) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    file_.seekp(static_cast<std::streamoff>(offset));
+    file_.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(len));
+    if (!file_) {
+        throw std::runtime_error("Write failed on " + path_);
+    }
+}
+
+void PositionalFile::close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    file_.close();
+}
+
+#endif
+
+} // namespace utils
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <fstream>
+#include <mutex>
+
+namespace utils {
+
+// Output file written at explicit offsets from many threads at once.
+// Uses pwrite on POSIX; elsewhere falls back to a locked stream.
+class PositionalFile {
+public:
+    // Creates/truncates `path` and reserves `size` bytes up front
+    PositionalFile(const std::string& path, uint64_t size);
+    ~PositionalFile();
+
+    PositionalFile(const PositionalFile&) = delete;
+    PositionalFile& operator=(const PositionalFile&) = delete;
+
+    void write_at(uint64_t offset, const uint8_t* data, size_t len);
+
+    // Flush to stable storage and close; further writes are invalid
+    void close();
+
+private:
+    std::string path_;
+#ifndef _WIN32
+    int fd_;
+#else
+    std::fstream file_;
+    std::mutex mutex_;
+#endif
+};
+
+} // namespace utils
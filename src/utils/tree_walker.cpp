@@ -0,0 +1,84 @@
+#include "tree_walker.h"
+#include "file_utils.h"
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+namespace utils {
+
+std::vector<WalkEntry> TreeWalker::walk(const std::string& root, size_t threads) {
+    if (!fs::is_directory(root)) {
+        throw std::runtime_error("Not a directory: " + root);
+    }
+    if (threads == 0) threads = 1;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<std::string> pending{""};   // relative paths still to list
+    size_t busy = 0;
+    std::exception_ptr error;
+    std::vector<WalkEntry> results;
+
+    auto worker = [&] {
+        for (;;) {
+            std::string dir;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                // Done once nothing is queued and no one is still listing (and may queue more)
+                cv.wait(lock, [&] { return !pending.empty() || busy == 0 || error; });
+                if (pending.empty() || error) return;
+                dir = std::move(pending.back());
+                pending.pop_back();
+                busy++;
+            }
+
+            std::vector<std::string> subdirs;
+            std::vector<WalkEntry> found;
+            try {
+                fs::path base = dir.empty() ? fs::path(root) : fs::path(root) / dir;
+                for (const auto& entry : fs::directory_iterator(base)) {
+                    fs::file_status status = entry.symlink_status();
+                    std::string name = entry.path().filename().string();
+                    std::string rel = dir.empty() ? name : dir + "/" + name;
+                    WalkEntry item;
+                    item.path = rel;
+                    if (fs::is_directory(status)) {
+                        item.directory = true;
+                        subdirs.push_back(rel);
+                    } else if (fs::is_regular_file(status)) {
+                        item.size = entry.file_size();
+                        item.mtime_ns = FileUtils::get_mtime_ns(entry.path().string());
+                    } else {
+                        continue;
+                    }
+                    found.push_back(std::move(item));
+                }
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error) error = std::current_exception();
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                busy--;
+                pending.insert(pending.end(), subdirs.begin(), subdirs.end());
+                results.insert(results.end(), std::make_move_iterator(found.begin()), std::make_move_iterator(found.end()));
+            }
+            cv.notify_all();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < threads; i++) workers.emplace_back(worker);
+    for (auto& t : workers) t.join();
+    if (error) std::rethrow_exception(error);
+
+    std::sort(results.begin(), results.end(),
+              [](const WalkEntry& a, const WalkEntry& b) { return a.path < b.path; });
+    return results;
+}
+
+} // namespace utils
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace utils {
+
+struct WalkEntry {
+    std::string path;       // relative to the walk root, '/'-separated
+    bool directory = false;
+    uint64_t size = 0;      // regular files only
+    int64_t mtime_ns = 0;
+};
+
+class TreeWalker {
+public:
+    // Lists every directory and regular file below `root` (excluding root
+    // itself), sorted by path. Directories are listed by `threads` workers
+    // sharing one stack of pending directories, so wide and deep trees both
+    // spread across them. Symlinks are not followed; other file types are skipped.
+    static std::vector<WalkEntry> walk(const std::string& root, size_t threads);
+};
+
+} // namespace utils
@@ -0,0 +1,118 @@
+#include "test.h"
+#include "dedup/dedup_index.h"
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+dedup::ChunkKey key_of(uint64_t n) {
+    // Spread like the HMAC outputs the index expects; the fingerprint is the first 8 bytes
+    dedup::ChunkKey key{};
+    uint64_t mixed = (n + 1) * 0x9e3779b97f4a7c15ULL;
+    std::memcpy(key.data(), &mixed, sizeof(mixed));
+    std::memcpy(key.data() + 8, &n, sizeof(n));
+    return key;
+}
+
+dedup::DedupEntry entry_of(uint64_t n) {
+    dedup::DedupEntry entry;
+    entry.uri = "file:///store/chunk" + std::to_string(n);
+    entry.hash = std::string(64, "0123456789abcdef"[n % 16]);
+    entry.iv = std::string(24, 'c');
+    entry.size = 1000 + n;
+    if (n % 3 == 0) {
+        entry.pack = "pack" + std::to_string(n / 3);
+        entry.pack_offset = n * 10;
+        entry.pack_length = 1028 + n;
+    }
+    return entry;
+}
+
+bool has(dedup::DedupIndex& index, uint64_t n) {
+    dedup::DedupEntry found;
+    if (!index.lookup(key_of(n), found)) return false;
+    dedup::DedupEntry expected = entry_of(n);
+    return found.uri == expected.uri && found.hash == expected.hash && found.iv == expected.iv &&
+           found.size == expected.size && found.pack == expected.pack &&
+           found.pack_offset == expected.pack_offset && found.pack_length == expected.pack_length;
+}
+
+void fill(const std::string& dir, uint64_t from, uint64_t to) {
+    dedup::DedupIndex index(dir);
+    for (uint64_t n = from; n < to; n++) index.insert(key_of(n), entry_of(n));
+}
+
+void reopen_finds_entries() {
+    test::TempDir dir("dedup_reopen");
+    fill(dir.path(), 0, 200);
+    dedup::DedupIndex index(dir.path());
+    CHECK(index.size() == 200);
+    for (uint64_t n = 0; n < 200; n++) CHECK(has(index, n));
+    CHECK(!has(index, 200));
+}
+
+void short_log_rebuilds() {
+    test::TempDir dir("dedup_short");
+    fill(dir.path(), 0, 100);
+    // The header counts records the log no longer holds
+    fs::resize_file(dir / "records.log", 100);
+    {
+        dedup::DedupIndex index(dir.path());
+        CHECK(index.size() == 0);
+        CHECK(!has(index, 0));
+        index.insert(key_of(500), entry_of(500));
+    }
+    dedup::DedupIndex index(dir.path());
+    CHECK(index.size() == 1);
+    CHECK(has(index, 500));
+}
+
+void trailing_log_bytes_dropped() {
+    test::TempDir dir("dedup_trailing");
+    fill(dir.path(), 0, 100);
+    // A record appended after the last header write
+    {
+        std::ofstream log(dir / "records.log", std::ios::binary | std::ios::app);
+        log << std::string(150, 'x');
+    }
+    fill(dir.path(), 100, 110);
+    dedup::DedupIndex index(dir.path());
+    CHECK(index.size() == 110);
+    for (uint64_t n = 0; n < 110; n++) CHECK(has(index, n));
+}
+
+void missing_bloom_is_rebuilt() {
+    test::TempDir dir("dedup_bloom");
+    fill(dir.path(), 0, 50);
+    fs::remove(dir / "bloom.bin");
+    dedup::DedupIndex index(dir.path());
+    for (uint64_t n = 0; n < 50; n++) CHECK(has(index, n));
+}
+
+void growth_keeps_entries() {
+    test::TempDir dir("dedup_grow");
+    // Past 70% of the initial 65536 slots
+    const uint64_t count = 50000;
+    fill(dir.path(), 0, count);
+    dedup::DedupIndex index(dir.path());
+    CHECK(index.size() == count);
+    for (uint64_t n = 0; n < count; n += 97) CHECK(has(index, n));
+    CHECK(has(index, count - 1));
+}
+
+} // namespace
+
+int main() {
+    return test::run_all({
+        {"reopen_finds_entries", reopen_finds_entries},
+        {"short_log_rebuilds", short_log_rebuilds},
+        {"trailing_log_bytes_dropped", trailing_log_bytes_dropped},
+        {"missing_bloom_is_rebuilt", missing_bloom_is_rebuilt},
+        {"growth_keeps_entries", growth_keeps_entries},
+    });
+}
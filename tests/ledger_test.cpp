@@ -0,0 +1,140 @@
+#include "test.h"
+#include "ledger/ledger.h"
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+json backup_event(const std::string& file_name, const std::string& manifest_url, int n) {
+    json event;
+    event["file_name"] = file_name;
+    event["merkle_root"] = std::string(63, '0') + std::to_string(n % 10);
+    event["manifest_url"] = manifest_url;
+    return event;
+}
+
+void append_bytes(const std::string& path, const std::string& bytes) {
+    std::ofstream out(path, std::ios::binary | std::ios::app);
+    out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+}
+
+void reopen_keeps_entries() {
+    test::TempDir dir("ledger_reopen");
+    std::string log = dir / "ledger.log";
+    {
+        ledger::Ledger l(log);
+        for (int i = 0; i < 3; i++) l.append_event(backup_event("a.bin", "file:///s/manifests/m", i));
+    }
+    ledger::Ledger l(log);
+    CHECK(l.size() == 3);
+    CHECK(l.verify_chain(true));
+}
+
+void torn_append_is_cut() {
+    test::TempDir dir("ledger_torn");
+    std::string log = dir / "ledger.log";
+    uint64_t committed;
+    {
+        ledger::Ledger l(log);
+        for (int i = 0; i < 3; i++) l.append_event(backup_event("a.bin", "file:///s/manifests/m", i));
+        committed = fs::file_size(log);
+    }
+    // Length prefix of a record whose body never made it to disk
+    append_bytes(log, std::string("\x40\x00\x00\x00\x00\x00\x00\x00partial", 15));
+
+    ledger::Ledger l(log);
+    CHECK(l.size() == 3);
+    CHECK(fs::file_size(log) == committed);
+    l.append_event(backup_event("a.bin", "file:///s/manifests/m", 3));
+    CHECK(l.size() == 4);
+    CHECK(l.verify_chain(true));
+}
+
+void unacknowledged_record_is_adopted() {
+    test::TempDir dir("ledger_adopt");
+    std::string log = dir / "ledger.log";
+    {
+        ledger::Ledger l(log);
+        for (int i = 0; i < 2; i++) l.append_event(backup_event("a.bin", "file:///s/manifests/m", i));
+        fs::copy_file(log + ".tail", dir / "saved.tail");
+        l.append_event(backup_event("a.bin", "file:///s/manifests/m", 2));
+    }
+    // Crash between the log fsync and the commit pointer update
+    fs::copy_file(dir / "saved.tail", log + ".tail", fs::copy_options::overwrite_existing);
+
+    ledger::Ledger l(log);
+    CHECK(l.size() == 3);
+    CHECK(l.verify_chain(true));
+}
+
+void unchained_record_is_dropped() {
+    test::TempDir dir("ledger_unchained");
+    std::string log = dir / "ledger.log";
+    uint64_t committed;
+    {
+        ledger::Ledger l(log);
+        for (int i = 0; i < 2; i++) l.append_event(backup_event("a.bin", "file:///s/manifests/m", i));
+        committed = fs::file_size(log);
+        fs::copy_file(log + ".tail", dir / "saved.tail");
+        l.append_event(backup_event("a.bin", "file:///s/manifests/m", 2));
+    }
+    fs::copy_file(dir / "saved.tail", log + ".tail", fs::copy_options::overwrite_existing);
+    // A whole record whose payload no longer matches its entry hash
+    {
+        std::fstream f(log, std::ios::in | std::ios::out | std::ios::binary);
+        f.seekp(static_cast<std::streamoff>(fs::file_size(log) - 12));
+        f.put('#');
+    }
+
+    ledger::Ledger l(log);
+    CHECK(l.size() == 2);
+    CHECK(fs::file_size(log) == committed);
+    CHECK(l.verify_chain(true));
+}
+
+void lost_tail_rescans_log() {
+    test::TempDir dir("ledger_rescan");
+    std::string log = dir / "ledger.log";
+    {
+        ledger::Ledger l(log);
+        for (int i = 0; i < 3; i++) l.append_event(backup_event("a.bin", "file:///s/manifests/m", i));
+    }
+    fs::remove(log + ".tail");
+
+    ledger::Ledger l(log);
+    CHECK(l.size() == 3);
+    CHECK(l.verify_chain(true));
+}
+
+void latest_manifest_by_store() {
+    test::TempDir dir("ledger_store");
+    std::string log = dir / "ledger.log";
+    ledger::Ledger l(log);
+    l.append_event(backup_event("a.bin", "file:///one/manifests/m1", 1));
+    l.append_event(backup_event("a.bin", "file:///two/manifests/m2", 2));
+    l.append_event(backup_event("b.bin", "file:///one/manifests/m3", 3));
+
+    json found;
+    CHECK(l.find_latest_manifest("a.bin", "file:///one/", found));
+    CHECK(found["manifest_url"] == "file:///one/manifests/m1");
+    CHECK(l.find_latest_manifest("a.bin", "", found));
+    CHECK(found["manifest_url"] == "file:///two/manifests/m2");
+    CHECK(!l.find_latest_manifest("a.bin", "file:///three/", found));
+}
+
+} // namespace
+
+int main() {
+    return test::run_all({
+        {"reopen_keeps_entries", reopen_keeps_entries},
+        {"torn_append_is_cut", torn_append_is_cut},
+        {"unacknowledged_record_is_adopted", unacknowledged_record_is_adopted},
+        {"unchained_record_is_dropped", unchained_record_is_dropped},
+        {"lost_tail_rescans_log", lost_tail_rescans_log},
+        {"latest_manifest_by_store", latest_manifest_by_store},
+    });
+}
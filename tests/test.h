@@ -0,0 +1,67 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <unistd.h>
+
+// Minimal harness: each test binary lists its cases in main() and returns
+// run_all's exit code to ctest. A failed CHECK ends its case only.
+namespace test {
+
+struct Failure : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+#define CHECK(cond)                                                                              \
+    do {                                                                                         \
+        if (!(cond)) {                                                                           \
+            throw ::test::Failure(std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " + #cond); \
+        }                                                                                        \
+    } while (0)
+
+// Fresh directory under the system temp dir, removed with its contents
+class TempDir {
+public:
+    explicit TempDir(const std::string& name) {
+        path_ = (std::filesystem::temp_directory_path() /
+                 ("secure_backup_" + name + "." + std::to_string(::getpid()))).string();
+        std::filesystem::remove_all(path_);
+        std::filesystem::create_directories(path_);
+    }
+    ~TempDir() {
+        std::error_code ec;
+        std::filesystem::remove_all(path_, ec);
+    }
+
+    TempDir(const TempDir&) = delete;
+    TempDir& operator=(const TempDir&) = delete;
+
+    const std::string& path() const { return path_; }
+    std::string operator/(const std::string& name) const { return path_ + "/" + name; }
+
+private:
+    std::string path_;
+};
+
+using Case = std::pair<const char*, std::function<void()>>;
+
+inline int run_all(const std::vector<Case>& cases) {
+    int failed = 0;
+    for (const auto& c : cases) {
+        try {
+            c.second();
+            std::cout << "PASS " << c.first << std::endl;
+        } catch (const std::exception& e) {
+            std::cout << "FAIL " << c.first << ": " << e.what() << std::endl;
+            failed++;
+        }
+    }
+    return failed ? 1 : 0;
+}
+
+} // namespace test